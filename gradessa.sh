@@ -0,0 +1,139 @@
+#!/bin/bash
+# round trip every program in testdata through SSA form
+# the compiler verifies each function after Build & the optimizations on
+# SSA form, before Destruct, & prints "SSA: " on what's wrong, programs with
+# reference output in lab6 are also run & diffed against it
+# all of it once as is, once with subscripts checked & once with the links
+# cached, refs/bounds has what the checked programs print instead, &
+# testcases/bounds the programs that only stop with a check
+#============some output color
+SYS=$(uname -s)
+if [[ $SYS == "Linux" ]]; then
+    RED_COLOR='\E[1;31m'
+    GREEN_COLOR='\E[1;32m'
+    YELOW_COLOR='\E[1;33m'
+    BLUE_COLOR='\E[1;34m'
+    PINK='\E[1;35m'
+    RES='\E[0m'
+fi
+
+BIN=tiger-compiler
+TESTDATADIR=../testdata
+RUNTIMEPATH=../src/tiger/runtime/runtime.c
+REFOUTDIR=../testdata/lab6/refs
+MERGECASEDIR=../testdata/lab6/testcases/merge
+MERGEREFDIR=../testdata/lab6/refs/merge
+BOUNDSCASEDIR=../testdata/lab6/testcases/bounds
+BOUNDSREFDIR=../testdata/lab6/refs/bounds
+WORKDIR=_ssa
+DIFFOPTION="-w -B"
+verified=0
+rejected=0
+ran=0
+failed=0
+
+base_name=$(basename "$PWD")
+if [[ ! $base_name =~ "tiger-compiler" ]]; then
+    echo "[-_-]: Not in Lab Root Dir"
+    exit 1
+fi
+
+mkdir -p build
+cd build
+
+cmake .. >&/dev/null
+make ${BIN} -j >/dev/null
+if [[ $? != 0 ]]; then
+    echo -e "${RED_COLOR}[-_-]: Compile Error${RES}"
+    exit 123
+fi
+
+# the corpus compiled with the flags given, lab6 programs run
+roundtrip() {
+    flags="$*"
+    cases=$(ls $TESTDATADIR/lab*/testcases/*.tig)
+    # programs that stop on a subscript out of range, only checked ones do
+    if [[ $flags =~ "-check-bounds" ]]; then
+        cases="$cases $(ls $BOUNDSCASEDIR/*.tig)"
+    fi
+    rm -rf $WORKDIR
+    mkdir -p $WORKDIR
+    for tcase in $cases; do
+        tfileName=${tcase##*/}
+        lab=${tcase#$TESTDATADIR/}
+        lab=${lab%%/*}
+        # the same names come up in several labs
+        work=$WORKDIR/${lab}_${tfileName}
+        cp $tcase $work
+        ./$BIN $work $flags >$work.log 2>&1
+        status=$?
+        if grep -q "^SSA: " $work.log; then
+            echo -e "${RED_COLOR}[*_*]: SSA verification failed. [$lab/$tfileName $flags]${RES}"
+            grep "^SSA: " $work.log
+            failed=$((failed + 1))
+            continue
+        fi
+        # the front end stops before the .s is even created, its errors abort
+        # too, on type errors or what it can't translate
+        if [ ! -e $work.s ]; then
+            rejected=$((rejected + 1))
+            continue
+        fi
+        # killed by a signal past that, an assertion or a fault in the back end,
+        # most likely with nothing flushed to the .s
+        if [[ $status != 0 ]]; then
+            echo -e "${RED_COLOR}[*_*]: Compiler crashed, status $status. [$lab/$tfileName $flags]${RES}"
+            tail -n 1 $work.log
+            failed=$((failed + 1))
+            continue
+        fi
+        verified=$((verified + 1))
+
+        if [ $lab != "lab6" ]; then
+            continue
+        fi
+        gcc -Wl,--wrap,getchar -m64 $work.s $RUNTIMEPATH -o $work.out &>/dev/null
+        if [ ! -s $work.out ]; then
+            echo -e "${BLUE_COLOR}[*_*]: Link error. [$lab/$tfileName $flags]${RES}"
+            failed=$((failed + 1))
+            continue
+        fi
+        if [ $tfileName = "merge.tig" ]; then
+            for mergecase in $(ls $MERGECASEDIR); do
+                ./$work.out <$MERGECASEDIR/$mergecase >&$work.txt
+                diff $DIFFOPTION $work.txt $MERGEREFDIR/${mergecase%.*}.out >&/dev/null
+                if [[ $? != 0 ]]; then
+                    echo -e "${BLUE_COLOR}[*_*]: Output mismatches. [$lab/$tfileName < $mergecase $flags]${RES}"
+                    failed=$((failed + 1))
+                else
+                    ran=$((ran + 1))
+                fi
+            done
+        else
+            # what a checked program prints where it goes out of range
+            ref=$REFOUTDIR/${tfileName%.*}.out
+            if [[ $flags =~ "-check-bounds" && -e $BOUNDSREFDIR/${tfileName%.*}.out ]]; then
+                ref=$BOUNDSREFDIR/${tfileName%.*}.out
+            fi
+            ./$work.out </dev/null >&$work.txt
+            diff $DIFFOPTION $work.txt $ref >&/dev/null
+            if [[ $? != 0 ]]; then
+                echo -e "${BLUE_COLOR}[*_*]: Output mismatches. [$lab/$tfileName $flags]${RES}"
+                failed=$((failed + 1))
+            else
+                ran=$((ran + 1))
+            fi
+        fi
+    done
+}
+
+roundtrip
+roundtrip -check-bounds
+roundtrip -cache-links
+
+rm -rf $WORKDIR
+if [[ $failed != 0 ]]; then
+    echo -e "${RED_COLOR}verified ${verified}, rejected ${rejected}, ran ${ran}, failed ${failed}${RES}"
+    exit 1
+fi
+echo -e "${GREEN_COLOR}verified ${verified}, rejected ${rejected}, ran ${ran}, all passed${RES}"
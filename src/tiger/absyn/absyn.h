@@ -569,10 +569,12 @@ class FunDec {
   FieldList *params;
   S::Symbol *result;
   Exp *body;
+  bool static_link;
 
   FunDec(int pos, S::Symbol *name, FieldList *params, S::Symbol *result,
          Exp *body)
-      : pos(pos), name(name), params(params), result(result), body(body) {}
+      : pos(pos), name(name), params(params), result(result), body(body),
+        static_link(true) {}
 
   void Print(FILE *out, int d) const;
 };
@@ -81,16 +81,23 @@ static std::string format(std::string assem, TEMP::TempList* dst,
 }
 
 void OperInstr::Print(FILE* out, TEMP::Map* m) const {
-  std::string result =
-      format(this->assem, this->dst, this->src, this->jumps, m);
+  std::string result = Format(m);
   fprintf(out, "%s\n", result.c_str());
 }
 
+std::string OperInstr::Format(TEMP::Map* m) const {
+  return format(this->assem, this->dst, this->src, this->jumps, m);
+}
+
 void LabelInstr::Print(FILE* out, TEMP::Map* m) const {
-  std::string result = format(this->assem, nullptr, nullptr, nullptr, m);
+  std::string result = Format(m);
   fprintf(out, "%s:\n", result.c_str());
 }
 
+std::string LabelInstr::Format(TEMP::Map* m) const {
+  return format(this->assem, nullptr, nullptr, nullptr, m);
+}
+
 void MoveInstr::Print(FILE* out, TEMP::Map* m) const {
   if ((this->dst == nullptr) && (this->src == nullptr)) {
     std::size_t srcpos = this->assem.find_first_of('%');
@@ -104,10 +111,14 @@ void MoveInstr::Print(FILE* out, TEMP::Map* m) const {
       }
     }
   }
-  std::string result = format(this->assem, this->dst, this->src, nullptr, m);
+  std::string result = Format(m);
   fprintf(out, "%s\n", result.c_str());
 }
 
+std::string MoveInstr::Format(TEMP::Map* m) const {
+  return format(this->assem, this->dst, this->src, nullptr, m);
+}
+
 void InstrList::Print(FILE* out, TEMP::Map* m) const {
   const InstrList* p = this;
   for (; p; p = p->tail) {
@@ -25,6 +25,8 @@ class Instr {
   Instr(Kind kind) : kind(kind) {}
 
   virtual void Print(FILE* out, TEMP::Map* m) const = 0;
+  // the assembly text with every temp replaced by its name in m
+  virtual std::string Format(TEMP::Map* m) const = 0;
 };
 
 class OperInstr : public Instr {
@@ -38,6 +40,7 @@ class OperInstr : public Instr {
       : Instr(OPER), assem(assem), dst(dst), src(src), jumps(jumps) {}
 
   void Print(FILE* out, TEMP::Map* m) const override;
+  std::string Format(TEMP::Map* m) const override;
 };
 
 class LabelInstr : public Instr {
@@ -49,6 +52,7 @@ class LabelInstr : public Instr {
       : Instr(LABEL), assem(assem), label(label) {}
 
   void Print(FILE* out, TEMP::Map* m) const override;
+  std::string Format(TEMP::Map* m) const override;
 };
 
 class MoveInstr : public Instr {
@@ -60,6 +64,7 @@ class MoveInstr : public Instr {
       : Instr(MOVE), assem(assem), dst(dst), src(src) {}
 
   void Print(FILE* out, TEMP::Map* m) const override;
+  std::string Format(TEMP::Map* m) const override;
 };
 
 class InstrList {
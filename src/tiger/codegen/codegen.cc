@@ -2,6 +2,7 @@
 #include "tiger/frame/x64frame.h"
 
 #include <sstream>
+#include <vector>
 
 namespace F {
 class X64Frame;
@@ -63,6 +64,14 @@ std::string get_x8664_movq_temp_offset_fp(const int offset, const F::Frame *f)
   return ss.str();
 }
 std::string get_x8664_cmp() { return "cmpq `s0, `s1"; }
+std::string get_x8664_cmp_imm(int imm)
+{
+  std::ostringstream ss;
+  ss << "cmpq $" << imm << ", `s0";
+  return ss.str();
+}
+std::string get_x8664_cmp_mem(const MemOperand &m) { return "cmpq " + m.format(1) + ", `s0"; }
+std::string get_x8664_testq() { return "testq `s0, `s0"; }
 std::string get_x8664_fp(const F::Frame *f) { return "leaq " + get_framesize(f) + "(`s0), `d0"; }
 std::string get_x8664_cjump(T::RelOp oper)
 {
@@ -75,6 +84,10 @@ std::string get_x8664_cjump(T::RelOp oper)
     case T::GT_OP: op = "jg"; break;
     case T::LE_OP: op = "jle"; break;
     case T::GE_OP: op = "jge"; break;
+    case T::ULT_OP: op = "jb"; break;
+    case T::UGT_OP: op = "ja"; break;
+    case T::ULE_OP: op = "jbe"; break;
+    case T::UGE_OP: op = "jae"; break;
     default: fprintf(stdout, "warning: not supported op in cjump");
   }
   return op + " `j0";
@@ -83,6 +96,23 @@ std::string get_x8664_jump() { return "jmp `j0"; }
 std::string get_x8664_addq() { return "addq `s0, `d0"; }
 std::string get_x8664_subq() { return "subq `s0, `d0"; }
 std::string get_x8664_imulq() { return "imulq `s0, `d0"; }
+std::string get_x8664_imulq_imm(int imm)
+{
+  std::ostringstream ss;
+  ss << "imulq $" << imm << ", `s0, `d0";
+  return ss.str();
+}
+std::string get_x8664_binop_imm(std::string op, int imm)
+{
+  std::ostringstream ss;
+  ss << op << " $" << imm << ", `d0";
+  return ss.str();
+}
+// the destination is always `s0, memory operand starts from `s1
+std::string get_x8664_binop_mem(std::string op, const MemOperand &m)
+{
+  return op + " " + m.format(1) + ", `d0";
+}
 std::string get_x8664_idivq() { return "idivq `s0"; }
 std::string get_x8664_leaq(int offset)
 {
@@ -91,6 +121,44 @@ std::string get_x8664_leaq(int offset)
   return ss.str();
 }
 std::string get_x8664_callq(std::string label) { return "callq " + label; }
+std::string get_x8664_tail_jump(std::string label) { return "jmp " + label; }
+
+bool isRematerializable(AS::Instr *instr)
+{
+  if(instr->kind != AS::Instr::OPER)
+    return false;
+  AS::OperInstr *oper = (AS::OperInstr *)instr;
+  if(oper->jumps || !oper->dst || oper->dst->tail)
+    return false;
+  // movq $imm, `d0
+  if(oper->assem.compare(0, 6, "movq $") == 0)
+    return oper->src == nullptr;
+  // leaq label(%rip), `d0 & leaq (off+fs)(`s0), `d0 with `s0 = %rsp
+  if(oper->assem.compare(0, 5, "leaq ") == 0) {
+    for(TEMP::TempList *s = oper->src; s; s = s->tail)
+      if(s->head != F::X64Frame::rsp)
+        return false;
+    return true;
+  }
+  return false;
+}
+
+std::string MemOperand::format(int first) const
+{
+  std::ostringstream ss;
+  ss << disp << "(`s" << first;
+  if(index)
+    ss << ", `s" << (first + 1) << ", " << scale;
+  ss << ')';
+  return ss.str();
+}
+
+TEMP::TempList *MemOperand::temps(TEMP::TempList *tail) const
+{
+  if(index)
+    tail = new TEMP::TempList(index, tail);
+  return new TEMP::TempList(base, tail);
+}
 
 ASManager::ASManager() {
   prehead = new AS::InstrList(nullptr, nullptr);
@@ -103,6 +171,159 @@ void ASManager::emit(AS::Instr *instr) {
 
 inline AS::InstrList *ASManager::getHead() { return prehead->tail; }
 
+namespace {
+
+inline bool isConst(T::Exp *e) { return e->kind == T::Exp::CONST; }
+inline int constOf(T::Exp *e) { return ((T::ConstExp *)e)->consti; }
+
+inline bool isFramePointer(T::Exp *e, const F::Frame *f)
+{
+  return e->kind == T::Exp::TEMP && ((T::TempExp *)e)->temp == f->getFramePointer();
+}
+
+// index * scale, where scale can be encoded in an address
+bool isScaledIndex(T::Exp *e, T::Exp **index, int *scale)
+{
+  if(e->kind != T::Exp::BINOP || ((T::BinopExp *)e)->op != T::MUL_OP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)e;
+  T::Exp *c = isConst(b->right) ? b->right : (isConst(b->left) ? b->left : nullptr);
+  if(c == nullptr)
+    return false;
+  int s = constOf(c);
+  if(s != 1 && s != 2 && s != 4 && s != 8)
+    return false;
+  *index = c == b->right ? b->left : b->right;
+  *scale = s;
+  return true;
+}
+
+std::string binopName(T::BinOp op)
+{
+  switch(op)
+  {
+    case T::PLUS_OP:  return "addq";
+    case T::MINUS_OP: return "subq";
+    case T::MUL_OP:   return "imulq";
+    default: fputs("Operation not supported.", stdout);
+  }
+  return "";
+}
+
+// emit `op right, dst` where dst already holds the left operand
+// right is folded into an immediate or a memory operand when possible
+void munchBinopInto(T::BinOp op, TEMP::Temp *dst, T::Exp *right,
+  CG::ASManager &a, const F::Frame *f)
+{
+  typedef TEMP::TempList TL;
+  std::string name = binopName(op);
+  if(isConst(right)) {
+    // addq $imm, d0
+    a.emit(new AS::OperInstr(CG::get_x8664_binop_imm(name, constOf(right)),
+      new TL(dst, nullptr), new TL(dst, nullptr), nullptr));
+  } else if(right->kind == T::Exp::MEM) {
+    // addq disp(s1, s2, scale), d0
+    CG::MemOperand m = CG::munchAddr(((T::MemExp *)right)->exp, a, f);
+    a.emit(new AS::OperInstr(CG::get_x8664_binop_mem(name, m),
+      new TL(dst, nullptr), new TL(dst, m.temps(nullptr)), nullptr));
+  } else {
+    // addq s0, d0
+    TEMP::Temp *right_temp = CG::munchExp(right, a, f);
+    a.emit(new AS::OperInstr(name + " `s0, `d0",
+      new TL(dst, nullptr), new TL(right_temp, new TL(dst, nullptr)), nullptr));
+  }
+}
+
+} // namespace
+
+// match an address expression into disp(base, index, scale)
+MemOperand munchAddr(T::Exp *addr, ASManager &a, const F::Frame *f)
+{
+  MemOperand m;
+  int offset = 0;
+  bool fp_based = false;
+  // peel off constant displacement
+  if(addr->kind == T::Exp::BINOP) {
+    T::BinopExp *b = (T::BinopExp *)addr;
+    if(b->op == T::PLUS_OP && isConst(b->right)) {
+      offset = constOf(b->right);
+      addr = b->left;
+    } else if(b->op == T::PLUS_OP && isConst(b->left)) {
+      offset = constOf(b->left);
+      addr = b->right;
+    } else if(b->op == T::MINUS_OP && isConst(b->right)) {
+      offset = -constOf(b->right);
+      addr = b->left;
+    }
+  }
+  // the rest is base, or base + index * scale
+  T::Exp *base = addr, *index = nullptr;
+  if(addr->kind == T::Exp::BINOP && ((T::BinopExp *)addr)->op == T::PLUS_OP) {
+    T::BinopExp *b = (T::BinopExp *)addr;
+    if(isScaledIndex(b->right, &index, &m.scale))
+      base = b->left;
+    else if(isScaledIndex(b->left, &index, &m.scale))
+      base = b->right;
+    else {
+      base = b->left;
+      index = b->right;
+    }
+    // fp can't be used as index
+    if(isFramePointer(index, f) && m.scale == 1)
+      std::swap(base, index);
+  }
+  // fp = sp + framesize
+  if(isFramePointer(base, f)) {
+    fp_based = true;
+    m.base = f->getStackPointer();
+  } else
+    m.base = munchExp(base, a, f);
+  if(index)
+    m.index = munchExp(index, a, f);
+
+  std::ostringstream ss;
+  if(fp_based)
+    ss << '(' << offset << '+' << get_framesize(f) << ')';
+  else if(offset != 0)
+    ss << offset;
+  m.disp = ss.str();
+  return m;
+}
+
+// evaluate simple expressions directly into dst
+// return false if exp is not simple enough
+bool munchExpTo(T::Exp *exp, TEMP::Temp *dst, ASManager &a, const F::Frame *f)
+{
+  switch(exp->kind)
+  {
+    case T::Exp::CONST:
+      a.emit(new AS::OperInstr(get_x8664_movq_imm_temp(constOf(exp)),
+        new TL(dst, nullptr), nullptr, nullptr));
+      return true;
+    case T::Exp::NAME:
+      a.emit(new AS::OperInstr(
+        get_x8664_movq_imm_temp(((T::NameExp *)exp)->name->Name()),
+        new TL(dst, nullptr), nullptr, nullptr));
+      return true;
+    case T::Exp::TEMP:
+      if(!isFramePointer(exp, f))
+        return false;
+      a.emit(new AS::OperInstr(get_x8664_fp(f),
+        new TL(dst, nullptr), new TL(f->getStackPointer(), nullptr), nullptr));
+      return true;
+    case T::Exp::MEM:
+    {
+      // movq disp(s0, s1, scale), d0
+      MemOperand m = munchAddr(((T::MemExp *)exp)->exp, a, f);
+      a.emit(new AS::OperInstr("movq " + m.format(0) + ", `d0",
+        new TL(dst, nullptr), m.temps(nullptr), nullptr));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
 void munchStm(T::Stm *stm, ASManager &a, const F::Frame *f)
 {
   switch(stm->kind)
@@ -114,65 +335,45 @@ void munchStm(T::Stm *stm, ASManager &a, const F::Frame *f)
       T::Exp *src = move_stm->src;
       if(dst->kind == T::Exp::MEM) {
         T::MemExp *mem_dst = (T::MemExp *)dst;
-        T::Exp *addr = mem_dst->exp;
-        // deal with binop here
-        if(addr->kind == T::Exp::Kind::BINOP
-          && ((T::BinopExp *)addr)->op == T::BinOp::PLUS_OP
-          && (((T::BinopExp *)addr)->left->kind == T::Exp::CONST
-            || ((T::BinopExp *)addr)->right->kind == T::Exp::CONST)) {
-          T::BinopExp *baddr = (T::BinopExp *)addr;
-          bool is_left_const = baddr->left->kind == T::Exp::CONST;
-          T::ConstExp *c = (T::ConstExp *)(is_left_const ? baddr->left : baddr->right);
-          T::Exp *other = is_left_const ? baddr->right : baddr->left;
-          if(other->kind == T::Exp::TEMP && ((T::TempExp *)other)->temp == f->getFramePointer())
-          {
-            // deal with frame pointer
-            // movq s0, (offset+framesize)(%rsp)
-            a.emit(
-              new AS::OperInstr(get_x8664_movq_mem_offset_fp(c->consti, f),
-                nullptr,
-                new TL(munchExp(src, a, f),
-                  new TL(f->getStackPointer(), nullptr)),
-                nullptr));
-          } else {
-            // regular stuff
-            // movq s0, offset(s1)
-            a.emit(new AS::OperInstr(
-              get_x8664_movq_mem_const_offset(c->consti),
-              nullptr,
-              new TL(munchExp(src, a, f),
-                new TL(munchExp(other, a, f), nullptr)),
-              nullptr));
-          }
-        } else if(src->kind == T::Exp::CONST) {
-          // movq $xxx, (s0)
-          a.emit(new AS::OperInstr(
-            get_x8664_movq_imm_mem(((T::ConstExp *)src)->consti),
-            nullptr, new TL(munchExp(mem_dst->exp, a, f), nullptr), nullptr));
-        }
-        else
-        {
-          // movq s0, (s1) or whatever
-          // since fp needs special care, just throw in a temp register
-          a.emit(new AS::OperInstr(
-            get_x8664_movq_mem(),
-            nullptr,
-            new TL(munchExp(src, a, f),
-              new TL(munchExp(mem_dst->exp, a, f), nullptr)),
-            nullptr
-          ));
+        if(isConst(src)) {
+          // movq $xxx, disp(s0, s1, scale)
+          MemOperand m = munchAddr(mem_dst->exp, a, f);
+          std::ostringstream ss;
+          ss << "movq $" << constOf(src) << ", " << m.format(0);
+          a.emit(new AS::OperInstr(ss.str(), nullptr, m.temps(nullptr), nullptr));
+        } else {
+          // movq s0, disp(s1, s2, scale)
+          TEMP::Temp *src_temp = munchExp(src, a, f);
+          MemOperand m = munchAddr(mem_dst->exp, a, f);
+          a.emit(new AS::OperInstr("movq `s0, " + m.format(1),
+            nullptr, new TL(src_temp, m.temps(nullptr)), nullptr));
         }
       }
       else
       {
-        // movq s0, d0
         assert(dst->kind == T::Exp::TEMP);
-        T::TempExp *temp_dst = (T::TempExp *)dst;
-        a.emit(new AS::MoveInstr(
-          get_x8664_movq_temp(),
-          new TL(temp_dst->temp, nullptr),
-          new TL(munchExp(src, a, f), nullptr)
-        ));
+        TEMP::Temp *temp_dst = ((T::TempExp *)dst)->temp;
+        T::BinopExp *bin_src = src->kind == T::Exp::BINOP ? (T::BinopExp *)src : nullptr;
+        if(munchExpTo(src, temp_dst, a, f))
+          break;
+        if(bin_src && bin_src->op != T::DIV_OP
+          && bin_src->left->kind == T::Exp::TEMP
+          && ((T::TempExp *)bin_src->left)->temp == temp_dst) {
+          // t = t op s0  =>  op s0, t
+          munchBinopInto(bin_src->op, temp_dst, bin_src->right, a, f);
+        } else if(bin_src && (bin_src->op == T::PLUS_OP || bin_src->op == T::MUL_OP)
+          && bin_src->right->kind == T::Exp::TEMP
+          && ((T::TempExp *)bin_src->right)->temp == temp_dst) {
+          // commutative, t = s0 op t  =>  op s0, t
+          munchBinopInto(bin_src->op, temp_dst, bin_src->left, a, f);
+        } else {
+          // movq s0, d0
+          a.emit(new AS::MoveInstr(
+            get_x8664_movq_temp(),
+            new TL(temp_dst, nullptr),
+            new TL(munchExp(src, a, f), nullptr)
+          ));
+        }
       }
       break;
     }
@@ -198,13 +399,35 @@ void munchStm(T::Stm *stm, ASManager &a, const F::Frame *f)
     case T::Stm::CJUMP:
     {
       T::CjumpStm *cjump_stm = (T::CjumpStm *)stm;
-      TEMP::Temp *left = munchExp(cjump_stm->left, a, f),
-        *right = munchExp(cjump_stm->right, a, f);
-      a.emit(new AS::OperInstr(get_x8664_cmp(),
-        // watch out for the order here, bro
-        nullptr, new TL(right, new TL(left, nullptr)), nullptr));
+      T::RelOp op = cjump_stm->op;
+      T::Exp *left = cjump_stm->left, *right = cjump_stm->right;
+      // keep the constant on the right hand side
+      if(isConst(left) && !isConst(right)) {
+        std::swap(left, right);
+        op = T::commute(op);
+      }
+      TEMP::Temp *left_temp = munchExp(left, a, f);
+      if(isConst(right) && constOf(right) == 0) {
+        // testq s0, s0
+        a.emit(new AS::OperInstr(get_x8664_testq(),
+          nullptr, new TL(left_temp, nullptr), nullptr));
+      } else if(isConst(right)) {
+        // cmpq $imm, s0
+        a.emit(new AS::OperInstr(get_x8664_cmp_imm(constOf(right)),
+          nullptr, new TL(left_temp, nullptr), nullptr));
+      } else if(right->kind == T::Exp::MEM) {
+        // cmpq disp(s1, s2, scale), s0
+        MemOperand m = munchAddr(((T::MemExp *)right)->exp, a, f);
+        a.emit(new AS::OperInstr(get_x8664_cmp_mem(m),
+          nullptr, new TL(left_temp, m.temps(nullptr)), nullptr));
+      } else {
+        TEMP::Temp *right_temp = munchExp(right, a, f);
+        a.emit(new AS::OperInstr(get_x8664_cmp(),
+          // watch out for the order here, bro
+          nullptr, new TL(right_temp, new TL(left_temp, nullptr)), nullptr));
+      }
       a.emit(new AS::OperInstr(
-        get_x8664_cjump(cjump_stm->op),
+        get_x8664_cjump(op),
         nullptr, nullptr,
         new AS::Targets(new TEMP::LabelList(cjump_stm->true_label, nullptr))
       ));
@@ -231,170 +454,79 @@ TEMP::Temp *munchExp(T::Exp *exp, ASManager &a, const F::Frame *f)
   switch(exp->kind)
   {
     case T::Exp::MEM:
-    {
-      T::MemExp *mem_exp = (T::MemExp *)exp;
-      T::Exp *addr = mem_exp->exp;
-      if(addr->kind == T::Exp::BINOP)
-      {
-        T::BinopExp *baddr = (T::BinopExp *)addr;
-        T::Exp *left = baddr->left, *right = baddr->right;
-        // deal with frame pointer, make fp=sp+framesize
-        // we assume that fp can only appear on lhs of BinopExp
-        // and fp can only appear with a ConstExp in BinopExp
-        assert(!(baddr->right->kind == T::Exp::TEMP
-          && (((T::TempExp *)baddr->right)->temp == f->getFramePointer())));
-        
-        if((left->kind == T::Exp::TEMP &&
-          ((T::TempExp *)left)->temp == f->getFramePointer()))
-        {
-          // movq $xxx(%rbp), %rt
-          // evaluate as movq ($xxx+framesize)(%rsp), rt
-          T::TempExp *fp_exp = (T::TempExp *)left;
-          T::ConstExp *const_exp = (T::ConstExp *)right;
-          assert(const_exp->kind == T::Exp::CONST);
-          a.emit(new AS::OperInstr(
-            get_x8664_movq_temp_offset_fp(const_exp->consti, f),
-            new TL(r, nullptr),
-            new TL(f->getStackPointer(), nullptr),
-            nullptr
-          ));
-        }
-        else if(left->kind == T::Exp::CONST || right->kind == T::Exp::CONST)
-        {
-          // movq xxx(%s0), %rt
-          bool is_left_const = left->kind == T::Exp::CONST;
-          T::ConstExp *const_exp = (T::ConstExp *)( is_left_const ? left : right);
-          T::TempExp *temp_exp = (T::TempExp *)(is_left_const ? right : left);
-          a.emit(new AS::OperInstr(
-            get_x8664_movq_temp_const_offset(const_exp->consti),
-            new TL(r, nullptr),
-            new TL(munchExp(temp_exp, a, f), nullptr),
-            nullptr
-          ));
-        }
-        else
-        {
-          // movq %s0(%s1), %rt
-          // munch them all
-          TEMP::Temp *addr_base_temp = munchExp(baddr->left, a, f);
-          TEMP::Temp *addr_offset_temp = munchExp(baddr->right, a, f);
-          a.emit(new AS::OperInstr(
-            get_x8664_movq_temp_offset(),
-            new TL(r, nullptr),
-            new TL(addr_base_temp, new TL(addr_offset_temp, nullptr)),
-            nullptr
-          ));
-        }
-      }
-      else
-      {
-        // addr.kind != BINOP
-        // movq (%s0), %rt
-        TEMP::Temp *addr_temp = munchExp(addr, a, f);
-        a.emit(new AS::OperInstr(
-          get_x8664_movq_temp_mem(),
-          new TL(r, nullptr),
-          new TL(addr_temp, nullptr),
-          nullptr
-        ));
-      }
+    case T::Exp::CONST:
+    case T::Exp::NAME:
+      // movq disp(s0, s1, scale), rt
+      // movq $xxx, rt
+      // leaq NAME(%rip), rt
+      munchExpTo(exp, r, a, f);
       break;
-    }
     case T::Exp::BINOP:
     {
       T::BinopExp *bin_exp = (T::BinopExp *)exp;
-      // deal with fp
-      assert(!(bin_exp->right->kind == T::Exp::TEMP
-        && ((T::TempExp *)bin_exp)->temp == f->getFramePointer()));
-      
-      if((bin_exp->op == T::BinOp::PLUS_OP || bin_exp->op == T::BinOp::MINUS_OP)
-        && (bin_exp->right->kind == T::Exp::CONST || bin_exp->left->kind == T::Exp::CONST))
+      T::BinOp op = bin_exp->op;
+      T::Exp *left = bin_exp->left, *right = bin_exp->right;
+      // keep the constant on the right hand side
+      if((op == T::PLUS_OP || op == T::MUL_OP) && isConst(left)) {
+        std::swap(left, right);
+      }
+      T::Exp *index;
+      int scale;
+      // a sum of two temps too, leaving both of them alone
+      if(((op == T::PLUS_OP || op == T::MINUS_OP) && isConst(right))
+        || (op == T::PLUS_OP && (isScaledIndex(left, &index, &scale)
+          || isScaledIndex(right, &index, &scale)
+          || (left->kind == T::Exp::TEMP && right->kind == T::Exp::TEMP))))
       {
-        // leaq offset(s0), rt
-        bool is_left_const = bin_exp->left->kind == T::Exp::CONST;
-        T::ConstExp *const_exp = (T::ConstExp *)(is_left_const ? bin_exp->left : bin_exp->right);
-        T::Exp *base_exp = (T::TempExp *)(is_left_const ? bin_exp->right : bin_exp->left);
-        int offset = const_exp->consti;
-        if(bin_exp->op == T::BinOp::MINUS_OP) offset = -offset;
-        a.emit(new AS::OperInstr(
-          get_x8664_leaq(offset),
-          new TL(r, nullptr),
-          new TL(munchExp(base_exp, a, f), nullptr),
-          nullptr
-        ));
+        // leaq disp(s0, s1, scale), rt
+        MemOperand m = munchAddr(exp, a, f);
+        a.emit(new AS::OperInstr("leaq " + m.format(0) + ", `d0",
+          new TL(r, nullptr), m.temps(nullptr), nullptr));
       }
-      else
+      else if(op == T::MUL_OP && isConst(right))
+      {
+        // imulq $xxx, s0, rt
+        a.emit(new AS::OperInstr(get_x8664_imulq_imm(constOf(right)),
+          new TL(r, nullptr), new TL(munchExp(left, a, f), nullptr), nullptr));
+      }
+      else if(op != T::DIV_OP)
       {
         // movq s0, rt
-        // addq/subq/imulq/idivq s1, rt
-        TEMP::Temp *left_temp = munchExp(bin_exp->left, a, f);
-        TEMP::Temp *right_temp = munchExp(bin_exp->right, a, f);
-        
-        std::string assem;
-        switch(bin_exp->op)
-        {
-          case T::BinOp::PLUS_OP:   assem = get_x8664_addq(); break;
-          case T::BinOp::MINUS_OP:  assem = get_x8664_subq(); break;
-          case T::BinOp::MUL_OP:    assem = get_x8664_imulq(); break;
-          case T::BinOp::DIV_OP:    assem = get_x8664_idivq(); break;
-          default: fputs("Operation not supported.", stdout); 
-        }
-        // division should be treated differently in x86-64
-        if(bin_exp->op != T::BinOp::DIV_OP)
-        {
+        // addq/subq/imulq s1, rt
+        if(!munchExpTo(left, r, a, f))
           a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
-            new TL(r, nullptr), new TL(left_temp, nullptr)));
-          a.emit(new AS::OperInstr(assem,
-            new TL(r, nullptr), new TL(right_temp, nullptr), nullptr));
-        }
-        else
-        {
-          // division
-          // movq %s0 %rax
-          // cltd
-          // idivq %s1
-          // movq %rax %rt
-          F::X64Frame *fr = (F::X64Frame *)f;
-          a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
-            new TL(fr->rax, nullptr), new TL(left_temp, nullptr)));
-          a.emit(new AS::OperInstr("cltd",
-            new TL(fr->rax, new TL(fr->rdx, nullptr)),
-            new TL(fr->rax, nullptr), nullptr));
-          a.emit(new AS::OperInstr(get_x8664_idivq(),
-            new TL(fr->rax, new TL(fr->rdx, nullptr)),
-            new TL(right_temp, new TL(fr->rax, new TL(fr->rdx, nullptr))),
-            nullptr));
-          a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
-            new TL(r, nullptr), new TL(fr->rax, nullptr)));
-        }
+            new TL(r, nullptr), new TL(munchExp(left, a, f), nullptr)));
+        munchBinopInto(op, r, right, a, f);
       }
-      break;
-    }
-    case T::Exp::TEMP:
-    {
-      // only fp needs our attention.
-      T::TempExp *temp_exp = (T::TempExp *)exp;
-      if(temp_exp->temp == f->getFramePointer())
+      else
       {
-        a.emit(new AS::OperInstr(get_x8664_fp(f),
-          new TL(r, nullptr), new TL(f->getStackPointer(), nullptr), nullptr));
+        // division
+        // movq %s0 %rax
+        // cltd
+        // idivq %s1
+        // movq %rax %rt
+        F::X64Frame *fr = (F::X64Frame *)f;
+        TEMP::Temp *left_temp = munchExp(left, a, f);
+        TEMP::Temp *right_temp = munchExp(right, a, f);
+        a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
+          new TL(fr->rax, nullptr), new TL(left_temp, nullptr)));
+        a.emit(new AS::OperInstr("cltd",
+          new TL(fr->rax, new TL(fr->rdx, nullptr)),
+          new TL(fr->rax, nullptr), nullptr));
+        a.emit(new AS::OperInstr(get_x8664_idivq(),
+          new TL(fr->rax, new TL(fr->rdx, nullptr)),
+          new TL(right_temp, new TL(fr->rax, new TL(fr->rdx, nullptr))),
+          nullptr));
+        a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
+          new TL(r, nullptr), new TL(fr->rax, nullptr)));
       }
-      else r = temp_exp->temp;
       break;
     }
-    case T::Exp::CONST:
-    {
-      a.emit(new AS::OperInstr(
-        get_x8664_movq_imm_temp(((T::ConstExp *)exp)->consti),
-        new TL(r, nullptr), nullptr, nullptr));
-      break;
-    }
-    case T::Exp::NAME:
+    case T::Exp::TEMP:
     {
-      // movq NAME %rt
-      a.emit(new AS::OperInstr(
-        get_x8664_movq_imm_temp(((T::NameExp *)exp)->name->Name()),
-        new TL(r, nullptr), nullptr, nullptr));
+      // only fp needs our attention.
+      if(!munchExpTo(exp, r, a, f))
+        r = ((T::TempExp *)exp)->temp;
       break;
     }
     case T::Exp::CALL:
@@ -403,8 +535,19 @@ TEMP::Temp *munchExp(T::Exp *exp, ASManager &a, const F::Frame *f)
       assert(call_exp->fun->kind == T::Exp::NAME);
       T::NameExp *fun_exp = (T::NameExp *)(call_exp->fun);
       TEMP::TempList *args = munchArgs(call_exp->args, a, f);
+      if(call_exp->tail) {
+        // jmp to a function, nothing after it in this one, the epilogue
+        // goes in front of it once the frame size is known and reads the
+        // frame as the one at the end does
+        a.emit(new AS::OperInstr(get_x8664_tail_jump(fun_exp->name->Name()),
+          F::X64Frame::clobbersOf(fun_exp->name),
+          new TL(f->getFramePointer(), args), new AS::Targets(nullptr)));
+        break;
+      }
+      // arguments passed in registers are used by the call, functions
+      // compiled already only clobber the registers they write to
       a.emit(new AS::OperInstr(get_x8664_callq(fun_exp->name->Name()),
-        ((F::X64Frame *)f)->caller_saved, nullptr, nullptr));
+        F::X64Frame::clobbersOf(fun_exp->name), args, nullptr));
       unMunchArgs(call_exp->args, a, f);
       a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
         new TL(r, nullptr), new TL(((F::X64Frame *)f)->rax, nullptr)));
@@ -425,17 +568,32 @@ TEMP::TempList *munchArgs(T::ExpList *args, ASManager &a, const F::Frame *f)
   F::X64Frame *fr = (F::X64Frame *)f;
   TEMP::TempList *prehead = new TEMP::TempList(nullptr, nullptr);
   TEMP::TempList *tail = prehead;
+  // evaluate complex arguments into temps first, so that
+  // nothing can clobber the parameter registers afterwards
+  std::vector<TEMP::Temp *> arg_temps;
+  for(T::ExpList *l = args; l; l = l->tail) {
+    T::Exp *arg = l->head;
+    bool simple = isConst(arg) || arg->kind == T::Exp::NAME || isFramePointer(arg, f);
+    arg_temps.push_back(simple ? nullptr : munchExp(arg, a, f));
+  }
   while(args)
   {
-    TEMP::Temp *arg = munchExp(args->head, a, f);
+    TEMP::Temp *arg = arg_temps[i];
     if(i < fr->param_reg_count) {
-      a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
-        new TL(fr->param_regs[i], nullptr), new TL(arg, nullptr)));
+      // simple ones are materialized in parameter registers directly
+      if(arg == nullptr)
+        munchExpTo(args->head, fr->param_regs[i], a, f);
+      else
+        a.emit(new AS::MoveInstr(get_x8664_movq_temp(),
+          new TL(fr->param_regs[i], nullptr), new TL(arg, nullptr)));
       tail = tail->tail = new TEMP::TempList(fr->param_regs[i], nullptr);
     }
-    else
+    else {
+      if(arg == nullptr)
+        arg = munchExp(args->head, a, f);
       a.emit(new AS::OperInstr(get_x8664_pushq(),
         nullptr, new TL(arg, nullptr), nullptr));
+    }
     i++;
     args = args->tail;
   }
@@ -457,11 +615,10 @@ void unMunchArgs(T::ExpList *args, ASManager &a, const F::Frame *f)
 
 AS::InstrList *Codegen(F::Frame* f, T::StmList* stmList) {
   ASManager a;
-  f->onEnter(a);
   for(; stmList; stmList = stmList->tail)
     munchStm(stmList->head, a, f);
-  f->onReturn(a);
-  return a.getHead();
+  // keep the return value alive until the end of the function
+  return f->doProcEntryExit2(a.getHead());
 }
 
-}  // namespace CG
\ No newline at end of file
+}  // namespace CG
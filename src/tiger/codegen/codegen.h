@@ -22,6 +22,22 @@ class StmList;
 
 namespace CG {
 
+// x86-64 memory operand, disp(base, index, scale)
+// base is always present, index may be null
+class MemOperand
+{
+public:
+  std::string disp;
+  TEMP::Temp *base, *index;
+  int scale;
+
+  MemOperand() : base(nullptr), index(nullptr), scale(1) {}
+  // render the operand, base & index are referred as `s<first>, `s<first+1>
+  std::string format(int first) const;
+  // put base & index in front of tail
+  TEMP::TempList *temps(TEMP::TempList *tail) const;
+};
+
 class ASManager
 {
 private:
@@ -46,18 +62,31 @@ std::string get_x8664_movq_temp_const_offset(const int offset);
 std::string get_x8664_movq_temp_offset();
 std::string get_x8664_movq_temp_offset_fp(const int offset, const F::Frame *f);
 std::string get_x8664_cmp();
+std::string get_x8664_cmp_imm(int imm);
+std::string get_x8664_cmp_mem(const MemOperand &m);
+std::string get_x8664_testq();
 std::string get_x8664_fp(const F::Frame *f);
 std::string get_x8664_cjump(T::RelOp oper);
 std::string get_x8664_jump();
 std::string get_x8664_addq();
 std::string get_x8664_subq();
 std::string get_x8664_imulq();
+std::string get_x8664_imulq_imm(int imm);
+std::string get_x8664_binop_imm(std::string op, int imm);
+std::string get_x8664_binop_mem(std::string op, const MemOperand &m);
 std::string get_x8664_idivq();
 std::string get_x8664_leaq(int offset);
 std::string get_x8664_callq(std::string label);
+std::string get_x8664_tail_jump(std::string label);
+
+// whether instr computes its only dst out of constants & %rsp alone,
+// so that it can be recomputed anywhere instead of being spilled
+bool isRematerializable(AS::Instr *instr);
 
 void munchStm(T::Stm *, ASManager &, const F::Frame *);
 TEMP::Temp *munchExp(T::Exp *, ASManager &, const F::Frame *);
+MemOperand munchAddr(T::Exp *, ASManager &, const F::Frame *);
+bool munchExpTo(T::Exp *, TEMP::Temp *, ASManager &, const F::Frame *);
 
 TEMP::TempList *munchArgs(T::ExpList *, ASManager &, const F::Frame *);
 void unMunchArgs(T::ExpList *, ASManager &, const F::Frame *);
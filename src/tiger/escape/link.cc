@@ -0,0 +1,229 @@
+#include "tiger/escape/link.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <vector>
+
+/*
+ * Static link analysis
+ * Traverse the tree, find the outermost frame every function has to
+ * reach, and clear "static_link" in the FunDecs that reach none
+ */
+
+namespace {
+
+// a name in scope, declared at depth, the function declared under it or
+// nullptr for a variable
+class LinkEntry {
+ public:
+  int depth;
+  A::FunDec *fun;
+
+  LinkEntry(int depth, A::FunDec *fun) : depth(depth), fun(fun) {}
+};
+
+using LEnv = S::Table<LinkEntry>;
+
+// depth of the body, the outermost frame it reaches, its own depth if none
+class FunLinks {
+ public:
+  int depth;
+  int reach;
+  A::FunDec *parent;
+  std::vector<A::FunDec *> callees;
+
+  FunLinks(int depth, A::FunDec *parent) : depth(depth), reach(depth), parent(parent) {}
+};
+
+std::map<A::FunDec *, FunLinks *> links;
+
+void traverseExp(LEnv *env, A::FunDec *fun, int depth, A::Exp *e);
+void traverseDec(LEnv *env, A::FunDec *fun, int depth, A::Dec *d);
+void traverseVar(LEnv *env, A::FunDec *fun, int depth, A::Var *v);
+
+void traverseExp(LEnv *env, A::FunDec *fun, int depth, A::Exp *e)
+{
+  switch (e->kind) {
+  case A::Exp::VAR:
+    traverseVar(env, fun, depth, ((A::VarExp *)e)->var);
+    break;
+  case A::Exp::CALL: {
+    LinkEntry *entry = env->Look(((A::CallExp *)e)->func);
+    // the runtime's functions aren't in the table, they take no link
+    if (fun != nullptr && entry != nullptr && entry->fun != nullptr)
+      links[fun]->callees.push_back(entry->fun);
+    A::ExpList *exp_list = ((A::CallExp *)e)->args;
+    for (; exp_list; exp_list = exp_list->tail)
+      traverseExp(env, fun, depth, exp_list->head);
+    break;
+  }
+  case A::Exp::OP:
+    traverseExp(env, fun, depth, ((A::OpExp *)e)->left);
+    traverseExp(env, fun, depth, ((A::OpExp *)e)->right);
+    break;
+  case A::Exp::RECORD: {
+    A::EFieldList *field_list = ((A::RecordExp *)e)->fields;
+    for (; field_list; field_list = field_list->tail)
+      traverseExp(env, fun, depth, field_list->head->exp);
+    break;
+  }
+  case A::Exp::SEQ: {
+    A::ExpList *exp_list = ((A::SeqExp *)e)->seq;
+    for (; exp_list; exp_list = exp_list->tail)
+      traverseExp(env, fun, depth, exp_list->head);
+    break;
+  }
+  case A::Exp::ASSIGN:
+    traverseVar(env, fun, depth, ((A::AssignExp *)e)->var);
+    traverseExp(env, fun, depth, ((A::AssignExp *)e)->exp);
+    break;
+  case A::Exp::IF:
+    traverseExp(env, fun, depth, ((A::IfExp *)e)->test);
+    traverseExp(env, fun, depth, ((A::IfExp *)e)->then);
+    if (((A::IfExp *)e)->elsee)
+      traverseExp(env, fun, depth, ((A::IfExp *)e)->elsee);
+    break;
+  case A::Exp::WHILE:
+    traverseExp(env, fun, depth, ((A::WhileExp *)e)->test);
+    traverseExp(env, fun, depth, ((A::WhileExp *)e)->body);
+    break;
+  case A::Exp::FOR:
+    traverseExp(env, fun, depth, ((A::ForExp *)e)->lo);
+    traverseExp(env, fun, depth, ((A::ForExp *)e)->hi);
+    env->BeginScope();
+    env->Enter(((A::ForExp *)e)->var, new LinkEntry(depth, nullptr));
+    traverseExp(env, fun, depth, ((A::ForExp *)e)->body);
+    env->EndScope();
+    break;
+  case A::Exp::LET: {
+    env->BeginScope();
+    A::DecList *dec_list = ((A::LetExp *)e)->decs;
+    for (; dec_list; dec_list = dec_list->tail)
+      traverseDec(env, fun, depth, dec_list->head);
+    traverseExp(env, fun, depth, ((A::LetExp *)e)->body);
+    env->EndScope();
+    break;
+  }
+  case A::Exp::ARRAY:
+    traverseExp(env, fun, depth, ((A::ArrayExp *)e)->size);
+    traverseExp(env, fun, depth, ((A::ArrayExp *)e)->init);
+    break;
+  case A::Exp::NIL:
+  case A::Exp::INT:
+  case A::Exp::STRING:
+  case A::Exp::BREAK:
+  case A::Exp::VOID:
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void traverseDec(LEnv *env, A::FunDec *fun, int depth, A::Dec *d)
+{
+  switch (d->kind) {
+  case A::Dec::VAR:
+    // the initializer doesn't see the variable yet
+    traverseExp(env, fun, depth, ((A::VarDec *)d)->init);
+    env->Enter(((A::VarDec *)d)->var, new LinkEntry(depth, nullptr));
+    break;
+  case A::Dec::FUNCTION: {
+    // the functions of a group see each other
+    A::FunDecList *fundec_list = ((A::FunctionDec *)d)->functions;
+    for (; fundec_list; fundec_list = fundec_list->tail) {
+      env->Enter(fundec_list->head->name, new LinkEntry(depth + 1, fundec_list->head));
+      links[fundec_list->head] = new FunLinks(depth + 1, fun);
+    }
+    for (fundec_list = ((A::FunctionDec *)d)->functions; fundec_list;
+         fundec_list = fundec_list->tail) {
+      A::FunDec *dec = fundec_list->head;
+      env->BeginScope();
+      for (A::FieldList *field_list = dec->params; field_list;
+           field_list = field_list->tail)
+        env->Enter(field_list->head->name, new LinkEntry(depth + 1, nullptr));
+      traverseExp(env, dec, depth + 1, dec->body);
+      env->EndScope();
+    }
+    break;
+  }
+  case A::Dec::TYPE:
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void traverseVar(LEnv *env, A::FunDec *fun, int depth, A::Var *v)
+{
+  switch (v->kind) {
+  case A::Var::SIMPLE: {
+    LinkEntry *entry = env->Look(((A::SimpleVar *)v)->sym);
+    if (fun != nullptr && entry != nullptr && entry->depth < depth)
+      links[fun]->reach = std::min(links[fun]->reach, entry->depth);
+    break;
+  }
+  case A::Var::FIELD:
+    traverseVar(env, fun, depth, ((A::FieldVar *)v)->var);
+    break;
+  case A::Var::SUBSCRIPT:
+    traverseVar(env, fun, depth, ((A::SubscriptVar *)v)->var);
+    traverseExp(env, fun, depth, ((A::SubscriptVar *)v)->subscript);
+    break;
+  default:
+    assert(0);
+  }
+}
+
+bool needsLink(FunLinks *f)
+{
+  return f->reach < f->depth;
+}
+
+}  // namespace
+
+namespace ESC {
+
+void FindStaticLinks(A::Exp *exp)
+{
+  LEnv *env = new LEnv();
+  traverseExp(env, nullptr, 1, exp);
+
+  // a call passes the callee's link, the frame it reaches, so the caller
+  // reaches it too, and an inlined copy of the callee reaches what it does
+  // frames further out than the parent are reached through the parent's
+  // own link
+  bool changed;
+  do {
+    changed = false;
+    for (auto &entry : links) {
+      FunLinks *f = entry.second;
+      int reach = f->reach;
+      for (A::FunDec *callee : f->callees)
+        if (needsLink(links[callee]))
+          reach = std::min(reach, links[callee]->reach);
+      if (reach < f->reach) {
+        f->reach = reach;
+        changed = true;
+      }
+      if (f->reach < f->depth - 1) {
+        FunLinks *parent = links[f->parent];
+        if (f->reach < parent->reach) {
+          parent->reach = f->reach;
+          changed = true;
+        }
+      }
+    }
+  } while (changed);
+
+  int lifted = 0;
+  for (auto &entry : links) {
+    entry.first->static_link = needsLink(entry.second);
+    lifted += !entry.first->static_link;
+  }
+  std::cout << "Static links: " << lifted << " of " << links.size()
+            << " functions lifted" << std::endl;
+}
+
+}  // namespace ESC
@@ -0,0 +1,17 @@
+#ifndef TIGER_ESCAPE_LINK_H_
+#define TIGER_ESCAPE_LINK_H_
+
+#include "tiger/absyn/absyn.h"
+
+namespace ESC {
+
+// which functions need a static link, set in FunDec's "static_link" field
+// a function needs one if its body uses a variable of an enclosing
+// function, calls a function whose link is a frame further out than its
+// own, or has a nested function reaching past it; the others are lifted to
+// the top, taking no link & keeping no slot for it
+void FindStaticLinks(A::Exp *exp);
+
+}  // namespace ESC
+
+#endif  // TIGER_ESCAPE_LINK_H_
@@ -15,10 +15,6 @@ class Proc;
 class InstrList;
 }
 
-namespace CG {
-class ASManager;
-}
-
 namespace F {
 
 class Frame;
@@ -47,12 +43,18 @@ class Frame {
   // Base class
 public:
   TEMP::Label *label;
+  // the formal the static link comes in, nullptr for a function taking none
+  Access *static_link = nullptr;
 
   Frame(TEMP::Label *name):label(name) {}
   virtual ~Frame() {}
 
   // default to allocate a word
   virtual Access *allocSpace(unsigned byte_count, bool in_frame=true) = 0;
+  // locals allocated between BeginScope & EndScope are dead afterwards,
+  // their slots may be handed out again to locals of a later scope
+  virtual void BeginScope() = 0;
+  virtual void EndScope() = 0;
   // frame pointer
   virtual T::Exp *getFramePointerExp() const = 0;
   virtual TEMP::Temp *getFramePointer() const = 0;
@@ -70,15 +72,13 @@ public:
   // 1st phase in ir translation
   // only translate return value
   // others will be done during following phases
-  virtual void doProcEntryExit1(T::Exp *body) = 0;
+  // a procedure returns nothing, its body is only run for its effects
+  virtual void doProcEntryExit1(T::Exp *body, bool returns_value) = 0;
   virtual AS::InstrList *doProcEntryExit2(AS::InstrList *instr) = 0;
-  virtual AS::Proc *doProcEntryExit3(AS::InstrList *instr) = 0;
+  virtual AS::Proc *doProcEntryExit3(AS::InstrList *instr, TEMP::Map *coloring) = 0;
   virtual T::CallExp *externalCall(std::string, T::ExpList *) = 0;
   virtual unsigned getSize() = 0;
   virtual AccessList *getFormals() = 0;
-
-  virtual void onEnter(CG::ASManager &) const = 0;
-  virtual void onReturn(CG::ASManager &) const = 0;
 };
 
 // default frame allocator
@@ -143,7 +143,7 @@ public:
 };
 
 // proc entry exit 3 - done after register allocation
-AS::Proc *F_procEntryExit3(Frame *frame, AS::InstrList *alloc);
+AS::Proc *F_procEntryExit3(Frame *frame, AS::InstrList *alloc, TEMP::Map *coloring);
 
 }  // namespace F
 
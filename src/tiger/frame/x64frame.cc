@@ -33,16 +33,6 @@ TEMP::Temp *const X64Frame::r15 = TEMP::Temp::NewTemp();
 
 
 
-// for onEnter & onExit only
-TEMP::Temp *X64Frame::srbx,
-  *X64Frame::srbp,
-  *X64Frame::srdi,
-  *X64Frame::srsi,
-  *X64Frame::sr12,
-  *X64Frame::sr13,
-  *X64Frame::sr14,
-  *X64Frame::sr15;
-
 // for passing parameters
 const std::set<TEMP::Temp *> X64Frame::all_regs = 
 {
@@ -67,6 +57,175 @@ typedef TEMP::TempList TL;
 TL *const X64Frame::caller_saved =
   new TL(rax, new TL(rcx, new TL(rdx, new TL(rdi, new TL(rsi, 
       new TL(r8, new TL(r9, new TL(r10, new TL(r11, nullptr)))))))));
+TL *const X64Frame::callee_saved =
+  new TL(rbx, new TL(r12, new TL(r13, new TL(r14, new TL(r15, nullptr)))));
+
+std::map<TEMP::Label *, TL *> X64Frame::clobbers;
+
+TL *X64Frame::clobbersOf(TEMP::Label *label)
+{
+  auto it = clobbers.find(label);
+  return it == clobbers.end() ? caller_saved : it->second;
+}
+
+namespace {
+
+class Helper {
+ public:
+  std::string name;
+  TL *clobbers;
+  std::string body;
+};
+
+// hand-written versions of the hot runtime functions
+// arguments & results are the same as in runtime.c, the allocating ones
+// save the caller saved registers around the call into C themselves
+const std::vector<Helper> &helpers()
+{
+  static const std::vector<Helper> h = {
+    {"stringEqual", new TL(X64Frame::rax, new TL(X64Frame::rcx, new TL(X64Frame::rdx, nullptr))),
+      "movl $1, %eax\n"
+      "cmpq %rdi, %rsi\n"
+      "je 2f\n"
+      "movl (%rdi), %ecx\n"
+      "cmpl (%rsi), %ecx\n"
+      "jne 1f\n"
+      "0:\n"
+      "testl %ecx, %ecx\n"
+      "je 2f\n"
+      "decl %ecx\n"
+      "movzbl 4(%rdi,%rcx), %edx\n"
+      "cmpb 4(%rsi,%rcx), %dl\n"
+      "je 0b\n"
+      "1:\n"
+      "xorl %eax, %eax\n"
+      "2:\n"
+      "ret\n"},
+    {"ord", new TL(X64Frame::rax, nullptr),
+      "movq $-1, %rax\n"
+      "cmpl $0, (%rdi)\n"
+      "je 1f\n"
+      "movzbl 4(%rdi), %eax\n"
+      "1:\n"
+      "ret\n"},
+    {"size", new TL(X64Frame::rax, nullptr),
+      "movslq (%rdi), %rax\n"
+      "ret\n"},
+    {"not", new TL(X64Frame::rax, nullptr),
+      "xorl %eax, %eax\n"
+      "testq %rdi, %rdi\n"
+      "sete %al\n"
+      "ret\n"},
+    // single character strings are in consts, 8 bytes each, out of range
+    // ones go to the C version for the error
+    {"chr", new TL(X64Frame::rax, nullptr),
+      "cmpq $255, %rdi\n"
+      "ja 1f\n"
+      "leaq consts(%rip), %rax\n"
+      "leaq (%rax,%rdi,8), %rax\n"
+      "ret\n"
+      "1:\n"
+      "jmp chr\n"},
+    // called by failed bounds checks, never returns
+    {"outOfBounds", new TL(X64Frame::rax, nullptr),
+      "andq $-16, %rsp\n"
+      "callq outOfBounds\n"},
+    {"allocRecord", new TL(X64Frame::rax, nullptr),
+      "pushq %rbp\n"
+      "movq %rsp, %rbp\n"
+      "andq $-16, %rsp\n"
+      "pushq %rcx\n"
+      "pushq %rdx\n"
+      "pushq %rsi\n"
+      "pushq %rdi\n"
+      "pushq %r8\n"
+      "pushq %r9\n"
+      "pushq %r10\n"
+      "pushq %r11\n"
+      "callq allocRecord\n"
+      "popq %r11\n"
+      "popq %r10\n"
+      "popq %r9\n"
+      "popq %r8\n"
+      "popq %rdi\n"
+      "popq %rsi\n"
+      "popq %rdx\n"
+      "popq %rcx\n"
+      "movq %rbp, %rsp\n"
+      "popq %rbp\n"
+      "ret\n"},
+    {"initArray", new TL(X64Frame::rax, nullptr),
+      "pushq %rbp\n"
+      "movq %rsp, %rbp\n"
+      "andq $-16, %rsp\n"
+      "pushq %rcx\n"
+      "pushq %rdx\n"
+      "pushq %rsi\n"
+      "pushq %rdi\n"
+      "pushq %r8\n"
+      "pushq %r9\n"
+      "pushq %r10\n"
+      "pushq %r11\n"
+      "callq initArray\n"
+      "popq %r11\n"
+      "popq %r10\n"
+      "popq %r9\n"
+      "popq %r8\n"
+      "popq %rdi\n"
+      "popq %rsi\n"
+      "popq %rdx\n"
+      "popq %rcx\n"
+      "movq %rbp, %rsp\n"
+      "popq %rbp\n"
+      "ret\n"},
+  };
+  return h;
+}
+
+std::set<std::string> used_helpers;
+
+// tiger identifiers never start with an underscore
+inline std::string helperName(const std::string &name) { return "__tiger_" + name; }
+
+}  // namespace
+
+TEMP::Label *X64Frame::runtimeLabel(std::string name)
+{
+  for (const Helper &h : helpers()) {
+    if (h.name != name)
+      continue;
+    TEMP::Label *label = TEMP::NamedLabel(helperName(name));
+    clobbers[label] = h.clobbers;
+    used_helpers.insert(name);
+    return label;
+  }
+  return TEMP::NamedLabel(name);
+}
+
+bool X64Frame::isPure(TEMP::Label *label)
+{
+  static const char *pure[] = {"stringEqual", "ord", "size", "not"};
+  for (const char *name : pure)
+    if (label->Name() == helperName(name))
+      return true;
+  return false;
+}
+
+bool X64Frame::isNoReturn(TEMP::Label *label)
+{
+  return label->Name() == helperName("outOfBounds");
+}
+
+void X64Frame::emitHelpers(FILE *out)
+{
+  for (const Helper &h : helpers()) {
+    if (used_helpers.find(h.name) == used_helpers.end())
+      continue;
+    std::string name = helperName(h.name);
+    fprintf(out, ".type %s, @function\n", name.c_str());
+    fprintf(out, "%s:\n%s\n", name.c_str(), h.body.c_str());
+  }
+}
 
 // temp map
 TEMP::Map *X64Frame::getTempMap()
@@ -167,8 +326,42 @@ X64Frame::X64Frame(TEMP::Label *name, U::BoolList *formals)
   this->view_shift = view_shift_prehead->tail;
 }
 
+Access *X64Frame::allocSpace(unsigned byte_count, bool in_frame)
+{
+  if(!in_frame)
+    return new InRegAccess(TEMP::Temp::NewTemp());
+  // only reuse slots while translating, spill slots & register saves
+  // allocated afterwards must not alias any local
+  if(byte_count == TR::word_size && !scope_marks.empty()) {
+    int offset;
+    if(free_slots.empty()) {
+      size += byte_count;
+      offset = -size;
+    } else {
+      offset = free_slots.back();
+      free_slots.pop_back();
+    }
+    scope_slots.push_back(offset);
+    return new InFrameAccess(offset);
+  }
+  size += byte_count;
+  return new InFrameAccess(-size);
+}
+
+void X64Frame::BeginScope()
+{
+  scope_marks.push_back(scope_slots.size());
+}
 
-void X64Frame::doProcEntryExit1(T::Exp *body) {
+void X64Frame::EndScope()
+{
+  size_t mark = scope_marks.back();
+  scope_marks.pop_back();
+  free_slots.insert(free_slots.end(), scope_slots.begin() + mark, scope_slots.end());
+  scope_slots.resize(mark);
+}
+
+void X64Frame::doProcEntryExit1(T::Exp *body, bool returns_value) {
   // this phase is done during IR translation
   // save every passed in parameter to their desired location
   // already constructed, so just concat it
@@ -182,12 +375,22 @@ void X64Frame::doProcEntryExit1(T::Exp *body) {
     t = static_cast<T::SeqStm *>(t->right);
     f = f->tail;
   }
-  // save return value in %rax
-  T::Stm *ret_stm = new T::MoveStm(getReturnValueExp(), body);
+  // save return value in %rax, nobody reads it after a procedure
+  T::Stm *ret_stm = returns_value
+    ? (T::Stm *)new T::MoveStm(getReturnValueExp(), body)
+    : new T::ExpStm(body);
   t->right = ret_stm;
   F::FragAllocator::appendFrag(new ProcFrag(prehead->right, this));
 }
 
+int X64Frame::viewShiftLength() const
+{
+  int length = 0;
+  for (T::StmList *s = view_shift; s; s = s->tail)
+    length++;
+  return length;
+}
+
 AS::InstrList *X64Frame::doProcEntryExit2(AS::InstrList *instr)
 {
   // this phase is right after codegen to prepare for liveness analysis
@@ -201,57 +404,79 @@ AS::InstrList *X64Frame::doProcEntryExit2(AS::InstrList *instr)
       new AS::OperInstr("", nullptr, return_sink, nullptr), nullptr));
 }
 
-AS::Proc *X64Frame::doProcEntryExit3(AS::InstrList *instr)
+AS::Proc *X64Frame::doProcEntryExit3(AS::InstrList *instr, TEMP::Map *coloring)
 {
   // this phase is after register allocation
   // at this time the frame size is determined
-  // add code to expand/shrink frame here
+  // save the callee-saved registers that are actually written to
+  // (in frame slots), then add code to expand/shrink frame here
+  std::set<std::string> written;
+  for (AS::InstrList *il = instr; il; il = il->tail) {
+    TEMP::TempList *dst = nullptr;
+    if (il->head->kind == AS::Instr::OPER)
+      dst = ((AS::OperInstr *)il->head)->dst;
+    else if (il->head->kind == AS::Instr::MOVE)
+      dst = ((AS::MoveInstr *)il->head)->dst;
+    for (; dst; dst = dst->tail) {
+      std::string *s = coloring->Look(dst->head);
+      if (s)
+        written.insert(*s);
+    }
+  }
+
+  // rax is always in, the caller reads it after the call even if this
+  // function doesn't return anything
+  TL *clobbered = nullptr;
+  for (TL *r = caller_saved; r; r = r->tail)
+    if (r->head == rax || written.find(*getTempMap()->Look(r->head)) != written.end())
+      clobbered = new TL(r->head, clobbered);
+  clobbers[this->label] = clobbered;
+
+  std::ostringstream save_ss, restore_ss;
+  for (TEMP::TempList *r = callee_saved; r; r = r->tail) {
+    const std::string &name = *getTempMap()->Look(r->head);
+    if (written.find(name) == written.end())
+      continue;
+    int offset = ((InFrameAccess *)allocSpace(TR::word_size))->offset;
+    std::ostringstream slot;
+    slot << '(' << offset << '+' << CG::get_framesize(this) << ")(%rsp)";
+    save_ss << "movq " << name << ", " << slot.str() << std::endl;
+    restore_ss << "movq " << slot.str() << ", " << name << std::endl;
+  }
+
+  // tail calls leave by a jump, after what the epilogue does but the ret
+  for (AS::InstrList *il = instr; il; il = il->tail) {
+    AS::OperInstr *oper = (AS::OperInstr *)il->head;
+    if (oper->kind != AS::Instr::OPER || !oper->jumps || oper->jumps->labels)
+      continue;
+    std::ostringstream tail_ss;
+    tail_ss << restore_ss.str();
+    if (this->size)
+      tail_ss << "addq $" << this->size << ", %rsp" << std::endl;
+    oper->assem = tail_ss.str() + oper->assem;
+  }
+
   std::ostringstream pro_ss, epi_ss;
   pro_ss << ".set " << CG::get_framesize(this) << ", " << this->size << std::endl;
   pro_ss << this->label->Name() << ':' << std::endl;
-  pro_ss << "subq $" << this->size << ", %rsp" << std::endl;
-  epi_ss << "addq $" << this->size << ", %rsp" << std::endl;
+  if (this->size)
+    pro_ss << "subq $" << this->size << ", %rsp" << std::endl;
+  pro_ss << save_ss.str();
+  epi_ss << restore_ss.str();
+  if (this->size)
+    epi_ss << "addq $" << this->size << ", %rsp" << std::endl;
   epi_ss << "ret" << std::endl << std::endl;
   return new AS::Proc(pro_ss.str(), instr, epi_ss.str());
 }
 
-void X64Frame::onEnter(CG::ASManager &a) const
-{
-  // explicitly save callee-save register here
-  // this impl is a little hacky, but it gets the job done
-  srbx = TEMP::Temp::NewTemp();
-  // srbp = TEMP::Temp::NewTemp();
-  sr12 = TEMP::Temp::NewTemp();
-  sr13 = TEMP::Temp::NewTemp();
-  sr14 = TEMP::Temp::NewTemp();
-  sr15 = TEMP::Temp::NewTemp();
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(srbx, nullptr),new TEMP::TempList(rbx, nullptr)));
-  // a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(srbp, nullptr),new TEMP::TempList(rbp, nullptr)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(sr12, nullptr),new TEMP::TempList(r12, nullptr)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(sr13, nullptr),new TEMP::TempList(r13, nullptr)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(sr14, nullptr),new TEMP::TempList(r14, nullptr)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(sr15, nullptr),new TEMP::TempList(r15, nullptr)));
-}
-
-void X64Frame::onReturn(CG::ASManager &a) const
-{
-  // restore explicitly saved registers
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(rbx,NULL), new TEMP::TempList(srbx,NULL)));
-  // a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(rbp,NULL), new TEMP::TempList(srbp,NULL)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(r12,NULL), new TEMP::TempList(sr12,NULL)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(r13,NULL), new TEMP::TempList(sr13,NULL)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(r14,NULL), new TEMP::TempList(sr14,NULL)));
-  a.emit(new AS::MoveInstr("movq `s0, `d0", new TEMP::TempList(r15,NULL), new TEMP::TempList(sr15,NULL)));
-};
-
 Frame *NewFrame(TEMP::Label *name, U::BoolList *formals)
 {
   return new X64Frame(name, formals);
 }
 
-AS::Proc *F_procEntryExit3(Frame *frame, AS::InstrList *alloc)
+AS::Proc *F_procEntryExit3(Frame *frame, AS::InstrList *alloc, TEMP::Map *coloring)
 {
-  return frame->doProcEntryExit3(alloc);
+  return frame->doProcEntryExit3(alloc, coloring);
 }
 
 }  // namespace F
\ No newline at end of file
@@ -5,8 +5,10 @@
 #include "tiger/translate/translate.h"
 #include "tiger/codegen/assem.h"
 #include "tiger/frame/frame.h"
+#include <map>
 #include <string>
 #include <set>
+#include <vector>
 
 namespace F {
 
@@ -43,7 +45,12 @@ class X64Frame : public Frame {
 private:
   int size = 0;
   AccessList *formals = nullptr;
-  T::StmList *view_shift;
+  T::StmList *view_shift = nullptr;
+  // escaped locals of the open scopes, scope_marks indexes into scope_slots
+  std::vector<int> scope_slots;
+  std::vector<size_t> scope_marks;
+  // slots of locals whose scope has ended
+  std::vector<int> free_slots;
 public:
   static const int param_reg_count;
   // registers for function calling
@@ -69,9 +76,15 @@ public:
 
   // caller saved registers
   static TEMP::TempList *const caller_saved;
+  // callee saved registers, saved in prologue only if used
+  static TEMP::TempList *const callee_saved;
 
-  // for register saving
-  static TEMP::Temp *srbx, *srbp, *srdi, *srsi, *sr12, *sr13, *sr14, *sr15;
+  // caller saved registers each function compiled so far writes to,
+  // including through its own calls
+  static std::map<TEMP::Label *, TEMP::TempList *> clobbers;
+  // registers a call to label writes to, all caller saved ones unless the
+  // callee is compiled already
+  static TEMP::TempList *clobbersOf(TEMP::Label *label);
 
   // for register naming
   static TEMP::Map *getTempMap();
@@ -84,13 +97,9 @@ public:
   X64Frame(TEMP::Label *name): Frame(name) {}
   X64Frame(TEMP::Label *name, U::BoolList *formals);
   ~X64Frame() {}
-  Access *allocSpace(unsigned byte_count, bool in_frame=true) override {
-    if(in_frame) {
-      size += byte_count;
-      return new InFrameAccess(-size);
-    } else 
-      return new InRegAccess(TEMP::Temp::NewTemp());
-  }
+  Access *allocSpace(unsigned byte_count, bool in_frame=true) override;
+  void BeginScope() override;
+  void EndScope() override;
   
   T::Exp *getFramePointerExp() const override { return new T::TempExp(rbp); }
   TEMP::Temp *getFramePointer() const override { return rbp; }
@@ -107,15 +116,27 @@ public:
   
   T::CallExp *externalCall(std::string name, T::ExpList *args) override {
     return new T::CallExp(
-      new T::NameExp(TEMP::NamedLabel(name)), args);
+      new T::NameExp(runtimeLabel(name)), args);
   }
 
-  void doProcEntryExit1(T::Exp *body) override;
+  // runtime functions with a hand-written version get a label of their own,
+  // calls to it only clobber the registers the helper writes to
+  static TEMP::Label *runtimeLabel(std::string name);
+  // emit the helpers used by the program
+  static void emitHelpers(FILE *out);
+  // whether a runtime function only reads its arguments & the strings they
+  // point to, so that calls to it can be moved
+  static bool isPure(TEMP::Label *label);
+  // whether a call to a runtime function never comes back
+  static bool isNoReturn(TEMP::Label *label);
+
+  void doProcEntryExit1(T::Exp *body, bool returns_value) override;
   AS::InstrList *doProcEntryExit2(AS::InstrList *instr) override;
-  AS::Proc *doProcEntryExit3(AS::InstrList *instr) override;
+  AS::Proc *doProcEntryExit3(AS::InstrList *instr, TEMP::Map *coloring) override;
 
-  void onEnter(CG::ASManager &) const override;
-  void onReturn(CG::ASManager &) const override;
+  // statements doProcEntryExit1 puts before the body, moving the formals
+  // to where the body finds them
+  int viewShiftLength() const;
 
   unsigned getSize() { return (unsigned)size; }
   AccessList *getFormals() { return formals; }
@@ -0,0 +1,256 @@
+#include "tiger/inline/inline.h"
+
+#include <cassert>
+#include <map>
+
+/*
+ * Inlining analysis
+ * Traverse the tree before translation, size up every function,
+ * and find which calls which. The expansion itself is done by
+ * CallExp::Translate, in the scope of the caller.
+ */
+
+namespace {
+
+// what a name in scope is bound to, the function declared under it or
+// nullptr for a variable, and the function whose body declares it
+class Binding {
+ public:
+  A::FunDec *fun;
+  A::FunDec *owner;
+
+  Binding(A::FunDec *fun, A::FunDec *owner) : fun(fun), owner(owner) {}
+};
+
+using BEnv = S::Table<Binding>;
+
+std::map<A::FunDec *, INL::FunInfo *> infos;
+std::map<A::FunDec *, std::set<A::FunDec *>> calls;
+
+// a call costs about as much as this many nodes of body would, the static
+// link and arguments moved into place, registers saved around it
+const int call_cost = 12;
+// every argument is a move the copy won't need, and a constant one may fold
+// into whatever the body does with it, unless the body passes it on to a
+// call on its own cycle, which the copy still makes
+const int arg_bonus = 2;
+const int constant_bonus = 4;
+// a leaf keeps values in caller-saved registers across its body
+const int leaf_bonus = 8;
+
+void traverseExp(BEnv *env, A::FunDec *fun, A::Exp *e);
+void traverseDec(BEnv *env, A::FunDec *fun, A::Dec *d);
+void traverseVar(BEnv *env, A::FunDec *fun, A::Var *v);
+
+// name is used in the body of fun, free unless fun declares it
+void use(BEnv *env, A::FunDec *fun, S::Symbol *name)
+{
+  if (fun == nullptr)
+    return;
+  Binding *binding = env->Look(name);
+  if (binding == nullptr || binding->owner != fun)
+    infos[fun]->free_names.insert(name);
+}
+
+void useType(A::FunDec *fun, S::Symbol *name)
+{
+  // functions declaring no types take them all from outside
+  if (fun != nullptr)
+    infos[fun]->free_types.insert(name);
+}
+
+void traverseExp(BEnv *env, A::FunDec *fun, A::Exp *e)
+{
+  if (fun != nullptr)
+    infos[fun]->size++;
+  switch (e->kind) {
+  case A::Exp::VAR:
+    traverseVar(env, fun, ((A::VarExp *)e)->var);
+    break;
+  case A::Exp::CALL: {
+    A::CallExp *call = (A::CallExp *)e;
+    use(env, fun, call->func);
+    Binding *binding = env->Look(call->func);
+    if (fun != nullptr && binding != nullptr && binding->fun != nullptr) {
+      calls[fun].insert(binding->fun);
+      infos[fun]->leaf = false;
+    }
+    for (A::ExpList *exp_list = call->args; exp_list; exp_list = exp_list->tail)
+      traverseExp(env, fun, exp_list->head);
+    break;
+  }
+  case A::Exp::OP:
+    traverseExp(env, fun, ((A::OpExp *)e)->left);
+    traverseExp(env, fun, ((A::OpExp *)e)->right);
+    break;
+  case A::Exp::RECORD: {
+    useType(fun, ((A::RecordExp *)e)->typ);
+    A::EFieldList *field_list = ((A::RecordExp *)e)->fields;
+    for (; field_list; field_list = field_list->tail)
+      traverseExp(env, fun, field_list->head->exp);
+    break;
+  }
+  case A::Exp::SEQ: {
+    A::ExpList *exp_list = ((A::SeqExp *)e)->seq;
+    for (; exp_list; exp_list = exp_list->tail)
+      traverseExp(env, fun, exp_list->head);
+    break;
+  }
+  case A::Exp::ASSIGN:
+    traverseVar(env, fun, ((A::AssignExp *)e)->var);
+    traverseExp(env, fun, ((A::AssignExp *)e)->exp);
+    break;
+  case A::Exp::IF:
+    traverseExp(env, fun, ((A::IfExp *)e)->test);
+    traverseExp(env, fun, ((A::IfExp *)e)->then);
+    if (((A::IfExp *)e)->elsee)
+      traverseExp(env, fun, ((A::IfExp *)e)->elsee);
+    break;
+  case A::Exp::WHILE:
+    traverseExp(env, fun, ((A::WhileExp *)e)->test);
+    traverseExp(env, fun, ((A::WhileExp *)e)->body);
+    break;
+  case A::Exp::FOR:
+    traverseExp(env, fun, ((A::ForExp *)e)->lo);
+    traverseExp(env, fun, ((A::ForExp *)e)->hi);
+    env->BeginScope();
+    env->Enter(((A::ForExp *)e)->var, new Binding(nullptr, fun));
+    traverseExp(env, fun, ((A::ForExp *)e)->body);
+    env->EndScope();
+    break;
+  case A::Exp::LET: {
+    env->BeginScope();
+    A::DecList *dec_list = ((A::LetExp *)e)->decs;
+    for (; dec_list; dec_list = dec_list->tail)
+      traverseDec(env, fun, dec_list->head);
+    traverseExp(env, fun, ((A::LetExp *)e)->body);
+    env->EndScope();
+    break;
+  }
+  case A::Exp::ARRAY:
+    useType(fun, ((A::ArrayExp *)e)->typ);
+    traverseExp(env, fun, ((A::ArrayExp *)e)->size);
+    traverseExp(env, fun, ((A::ArrayExp *)e)->init);
+    break;
+  case A::Exp::NIL:
+  case A::Exp::INT:
+  case A::Exp::STRING:
+  case A::Exp::BREAK:
+  case A::Exp::VOID:
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void traverseDec(BEnv *env, A::FunDec *fun, A::Dec *d)
+{
+  switch (d->kind) {
+  case A::Dec::VAR:
+    // the initializer doesn't see the variable yet
+    if (fun != nullptr)
+      infos[fun]->size++;
+    if (((A::VarDec *)d)->typ)
+      useType(fun, ((A::VarDec *)d)->typ);
+    traverseExp(env, fun, ((A::VarDec *)d)->init);
+    env->Enter(((A::VarDec *)d)->var, new Binding(nullptr, fun));
+    break;
+  case A::Dec::FUNCTION: {
+    if (fun != nullptr)
+      infos[fun]->inlinable = false;
+    // the functions of a group see each other
+    A::FunDecList *fundec_list = ((A::FunctionDec *)d)->functions;
+    for (; fundec_list; fundec_list = fundec_list->tail) {
+      env->Enter(fundec_list->head->name, new Binding(fundec_list->head, fun));
+      infos[fundec_list->head] = new INL::FunInfo();
+    }
+    for (fundec_list = ((A::FunctionDec *)d)->functions; fundec_list;
+         fundec_list = fundec_list->tail) {
+      A::FunDec *dec = fundec_list->head;
+      env->BeginScope();
+      for (A::FieldList *field_list = dec->params; field_list;
+           field_list = field_list->tail) {
+        useType(dec, field_list->head->typ);
+        env->Enter(field_list->head->name, new Binding(nullptr, dec));
+      }
+      if (dec->result)
+        useType(dec, dec->result);
+      traverseExp(env, dec, dec->body);
+      env->EndScope();
+    }
+    break;
+  }
+  case A::Dec::TYPE:
+    if (fun != nullptr)
+      infos[fun]->inlinable = false;
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void traverseVar(BEnv *env, A::FunDec *fun, A::Var *v)
+{
+  if (fun != nullptr)
+    infos[fun]->size++;
+  switch (v->kind) {
+  case A::Var::SIMPLE:
+    use(env, fun, ((A::SimpleVar *)v)->sym);
+    break;
+  case A::Var::FIELD:
+    traverseVar(env, fun, ((A::FieldVar *)v)->var);
+    break;
+  case A::Var::SUBSCRIPT:
+    traverseVar(env, fun, ((A::SubscriptVar *)v)->var);
+    traverseExp(env, fun, ((A::SubscriptVar *)v)->subscript);
+    break;
+  default:
+    assert(0);
+  }
+}
+
+// whether target is reachable from fun in the call graph
+bool reaches(A::FunDec *fun, A::FunDec *target, std::set<A::FunDec *> &visited)
+{
+  for (A::FunDec *callee : calls[fun]) {
+    if (callee == target)
+      return true;
+    if (visited.insert(callee).second && reaches(callee, target, visited))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+namespace INL {
+
+void Analyze(A::Exp *exp)
+{
+  BEnv *env = new BEnv();
+  traverseExp(env, nullptr, exp);
+  for (auto &entry : infos) {
+    std::set<A::FunDec *> visited;
+    entry.second->recursive = reaches(entry.first, entry.first, visited);
+  }
+}
+
+FunInfo *Info(A::FunDec *func)
+{
+  auto it = infos.find(func);
+  return it == infos.end() ? nullptr : it->second;
+}
+
+bool Worth(FunInfo *info, int args, int constant_args)
+{
+  if (!info->inlinable)
+    return false;
+  int budget = call_cost + args * arg_bonus;
+  if (!info->recursive)
+    budget += constant_args * constant_bonus;
+  if (info->leaf)
+    budget += leaf_bonus;
+  return info->size <= budget;
+}
+
+}  // namespace INL
@@ -0,0 +1,42 @@
+#ifndef TIGER_INLINE_INLINE_H_
+#define TIGER_INLINE_INLINE_H_
+
+#include <set>
+
+#include "tiger/absyn/absyn.h"
+
+namespace INL {
+
+// what's known of a function before it's translated
+class FunInfo {
+ public:
+  int size;         // nodes in the body
+  bool leaf;        // calls no function declared in the program
+  bool recursive;   // on a cycle of the call graph
+  bool inlinable;   // declares no functions or types of its own
+  // names the body takes from the scopes around the function, variables &
+  // functions, and types, a call may only be inlined where they mean the same
+  std::set<S::Symbol *> free_names;
+  std::set<S::Symbol *> free_types;
+
+  FunInfo() : size(0), leaf(true), recursive(false), inlinable(true) {}
+};
+
+// times a function may be expanded within its own expansion, and how deep
+// expansions may nest at all
+const int recursion_limit = 1;
+const int depth_limit = 4;
+
+// build the call graph of the program and size up its functions
+void Analyze(A::Exp *exp);
+
+// what Analyze found of func, nullptr if it hasn't seen it
+FunInfo *Info(A::FunDec *func);
+
+// the cost model, whether a call with args arguments, constant_args of them
+// constants, is better off as a copy of the callee's body
+bool Worth(FunInfo *info, int args, int constant_args);
+
+}  // namespace INL
+
+#endif  // TIGER_INLINE_INLINE_H_
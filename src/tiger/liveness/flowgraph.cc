@@ -1,4 +1,5 @@
 #include "tiger/liveness/flowgraph.h"
+#include <algorithm>
 #include <iostream>
 
 namespace FG {
@@ -79,4 +80,137 @@ FlowGraph* AssemFlowGraph(AS::InstrList* il, F::Frame* f)
   return g;
 }
 
+// immediate dominators, with the iterative algorithm of Cooper et al.
+std::vector<int> Dominators(FlowGraph* flow_graph)
+{
+  int n = flow_graph->nodecount;
+  std::vector<int> idom(n, -1);
+  if (n == 0)
+    return idom;
+  std::vector<InstrNode*> node(n);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail)
+    node[nl->head->Key()] = nl->head;
+
+  // reverse post order from the entry
+  std::vector<int> rpo, rpo_index(n, -1);
+  std::vector<bool> visited(n, false);
+  std::vector<std::pair<InstrNode*, G::NodeList<AS::Instr>*>> stack;
+  stack.push_back({node[0], node[0]->Succ()});
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    if (top.second) {
+      InstrNode* succ = top.second->head;
+      top.second = top.second->tail;
+      if (!visited[succ->Key()]) {
+        visited[succ->Key()] = true;
+        stack.push_back({succ, succ->Succ()});
+      }
+    } else {
+      rpo.push_back(top.first->Key());
+      stack.pop_back();
+    }
+  }
+  std::reverse(rpo.begin(), rpo.end());
+  for (int i = 0; i < (int)rpo.size(); i++)
+    rpo_index[rpo[i]] = i;
+
+  idom[rpo[0]] = rpo[0];
+  bool changed;
+  do {
+    changed = false;
+    for (int i = 1; i < (int)rpo.size(); i++) {
+      int b = rpo[i], new_idom = -1;
+      for (auto pred = node[b]->Pred(); pred; pred = pred->tail) {
+        int p = pred->head->Key();
+        if (idom[p] == -1)
+          continue;
+        if (new_idom == -1) {
+          new_idom = p;
+          continue;
+        }
+        // intersect
+        int x = p, y = new_idom;
+        while (x != y) {
+          while (rpo_index[x] > rpo_index[y]) x = idom[x];
+          while (rpo_index[y] > rpo_index[x]) y = idom[y];
+        }
+        new_idom = x;
+      }
+      if (idom[b] != new_idom) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  } while (changed);
+  return idom;
+}
+
+// find natural loops by their back edges (n -> h where h dominates n)
+std::vector<Loop> Loops(FlowGraph* flow_graph)
+{
+  int n = flow_graph->nodecount;
+  std::vector<Loop> loops;
+  if (n == 0)
+    return loops;
+  std::vector<InstrNode*> node(n);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail)
+    node[nl->head->Key()] = nl->head;
+  std::vector<int> idom = Dominators(flow_graph);
+
+  auto dominates = [&](int h, int b) {
+    while (true) {
+      if (b == h)
+        return true;
+      if (idom[b] == b)
+        return false;
+      b = idom[b];
+    }
+  };
+
+  // collect the body of every loop, loops sharing a header are merged
+  std::vector<int> loop_of(n, -1);
+  for (int b = 0; b < n; b++) {
+    if (idom[b] == -1)
+      continue;
+    for (auto succ = node[b]->Succ(); succ; succ = succ->tail) {
+      int h = succ->head->Key();
+      if (!dominates(h, b))
+        continue;
+      if (loop_of[h] == -1) {
+        loop_of[h] = loops.size();
+        loops.push_back(Loop{h, std::vector<bool>(n, false)});
+        loops.back().body[h] = true;
+      }
+      std::vector<bool>& body = loops[loop_of[h]].body;
+      std::vector<int> work;
+      if (!body[b]) {
+        body[b] = true;
+        work.push_back(b);
+      }
+      while (!work.empty()) {
+        int x = work.back();
+        work.pop_back();
+        for (auto pred = node[x]->Pred(); pred; pred = pred->tail) {
+          int p = pred->head->Key();
+          if (idom[p] != -1 && !body[p]) {
+            body[p] = true;
+            work.push_back(p);
+          }
+        }
+      }
+    }
+  }
+  return loops;
+}
+
+std::vector<int> LoopDepth(FlowGraph* flow_graph)
+{
+  std::vector<int> depth(flow_graph->nodecount, 0);
+  for (auto& loop : Loops(flow_graph))
+    for (int i = 0; i < flow_graph->nodecount; i++)
+      depth[i] += loop.body[i];
+  return depth;
+}
+
 } // namespace FG
@@ -22,6 +22,23 @@ bool IsMove(InstrNode* n);
 
 FlowGraph* AssemFlowGraph(AS::InstrList* il, F::Frame* f);
 
+// immediate dominator of each instruction, indexed by Key()
+// the entry is its own, unreachable instructions get -1
+std::vector<int> Dominators(FlowGraph* flow_graph);
+
+// a natural loop, nodes are referred by Key()
+// loops sharing the same header are merged into one
+class Loop {
+ public:
+  int header;
+  std::vector<bool> body;
+};
+
+std::vector<Loop> Loops(FlowGraph* flow_graph);
+
+// number of natural loops each instruction is nested in, indexed by Key()
+std::vector<int> LoopDepth(FlowGraph* flow_graph);
+
 }  // namespace FG
 
 #endif
\ No newline at end of file
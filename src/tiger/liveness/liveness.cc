@@ -1,6 +1,7 @@
 #include "tiger/liveness/liveness.h"
 #include "tiger/frame/x64frame.h"
 #include <map>
+#include <vector>
 #include <iostream>
 
 namespace LIVE {
@@ -41,22 +42,31 @@ inline bool inDst(FG::InstrNode* src, TEMP::Temp* target)
 
 // do liveness analysis on flow graph
 // generate conflict graph and move relationship list
-LiveGraph Liveness(G::Graph<AS::Instr>* flowgraph)
+LiveGraph Liveness(G::Graph<AS::Instr>* flowgraph, LiveOutCache* cache)
 {
   LiveTable live_table;
   LiveGraph lg;
 
-  // prep: put all instrs into live table
+  // prep: put all instrs into live table, starting from cached sets
+  std::vector<FG::InstrNode*> nodes;
   for (auto nl = flowgraph->Nodes(); nl; nl = nl->tail) {
     FG::InstrNode* in = nl->head;
-    live_table.Enter(in, new LiveList());
+    LiveList* ll = new LiveList();
+    if (cache) {
+      auto it = cache->find(in->NodeInfo());
+      if (it != cache->end())
+        ll->seedOut(it->second);
+    }
+    live_table.Enter(in, ll);
+    nodes.push_back(in);
   }
 
   // calculate in & out sets for each instruction
+  // backwards, as liveness flows against the instruction order
   do {
     LiveList::reset(); // reset change flag
-    for (auto nl = flowgraph->Nodes(); nl; nl = nl->tail) {
-      FG::InstrNode* in = nl->head;
+    for (auto it = nodes.rbegin(); it != nodes.rend(); it++) {
+      FG::InstrNode* in = *it;
       LiveList* ll = live_table.Look(in);
       /*
        * in[n] = use[n] \cup (out[n] - def[n])
@@ -78,6 +88,9 @@ LiveGraph Liveness(G::Graph<AS::Instr>* flowgraph)
       }
     }
   } while (LiveList::changed());
+  if (cache)
+    for (FG::InstrNode* in : nodes)
+      (*cache)[in->NodeInfo()] = live_table.Look(in)->getOut();
 
   // construct interference graph
   auto graph = new G::Graph<TEMP::Temp>();
@@ -7,6 +7,7 @@
 #include "tiger/liveness/flowgraph.h"
 #include "tiger/util/graph.h"
 #include "tiger/util/table.h"
+#include <map>
 #include <set>
 
 namespace LIVE {
@@ -24,8 +25,9 @@ public:
   inline bool inOut(TEMP::Temp *t) { return out.find(t) != out.end(); }
   inline void insertIn(TEMP::Temp *t) { if(in.insert(t).second) flag = true; }
   inline void insertOut(TEMP::Temp *t) { if(out.insert(t).second) flag = true; }
-  inline const std::set<TEMP::Temp *> getIn() { return in; }
-  inline const std::set<TEMP::Temp *> getOut() { return out; }
+  inline void seedOut(const std::set<TEMP::Temp *> &s) { out = s; }
+  inline const std::set<TEMP::Temp *> &getIn() { return in; }
+  inline const std::set<TEMP::Temp *> &getOut() { return out; }
 };
 
 // log in/out set for each instruction
@@ -48,7 +50,12 @@ class LiveGraph {
   MoveList* moves;
 };
 
-LiveGraph Liveness(G::Graph<AS::Instr>* flowgraph);
+// live-out sets kept across analyses of the same function, by instruction
+// sets that are still valid let the next analysis start from them instead
+// of from scratch, it's updated with the new result
+typedef std::map<AS::Instr *, std::set<TEMP::Temp *>> LiveOutCache;
+
+LiveGraph Liveness(G::Graph<AS::Instr>* flowgraph, LiveOutCache *cache = nullptr);
 
 }  // namespace LIVE
 
@@ -1,6 +1,9 @@
 #include <cstdio>
 #include <fstream>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "tiger/absyn/absyn.h"
 #include "tiger/canon/canon.h"
@@ -8,9 +11,20 @@
 #include "tiger/codegen/codegen.h"
 #include "tiger/errormsg/errormsg.h"
 #include "tiger/escape/escape.h"
+#include "tiger/escape/link.h"
 #include "tiger/frame/frame.h"
+#include "tiger/inline/inline.h"
 #include "tiger/parse/parser.h"
+#include "tiger/peephole/peephole.h"
 #include "tiger/regalloc/regalloc.h"
+#include "tiger/ssa/bounds.h"
+#include "tiger/ssa/dce.h"
+#include "tiger/ssa/gvn.h"
+#include "tiger/ssa/iv.h"
+#include "tiger/ssa/licm.h"
+#include "tiger/ssa/sccp.h"
+#include "tiger/ssa/ssa.h"
+#include "tiger/ssa/tail.h"
 #include "tiger/translate/tree.h"
 #include "tiger/frame/x64frame.h"
 
@@ -23,18 +37,67 @@ namespace {
 
 TEMP::Map* temp_map;
 
-void do_proc(FILE* out, F::ProcFrag* procFrag) {
-  temp_map = TEMP::Map::Empty();
-  // Init temp_map
-
-  printf("doProc for function %s:\n", procFrag->frame->label->Name().c_str());
+T::StmList* linearize(F::ProcFrag* procFrag) {
+  printf("Linearize function %s:\n", procFrag->frame->label->Name().c_str());
   (new T::StmList(procFrag->body, nullptr))->Print(stdout);
   printf("-------====IR tree=====-----\n");
 
   T::StmList* stmList = C::Linearize(procFrag->body);
   stmList->Print(stdout);
   printf("-------====Linearlized=====-----\n");  /* 8 */
+  return stmList;
+}
+
+// functions called in a linearized body
+// calls are either the source of a MOVE or the expression of an EXP there
+std::set<TEMP::Label*> callees(T::StmList* stmList) {
+  std::set<TEMP::Label*> ret;
+  for (; stmList; stmList = stmList->tail) {
+    T::Exp* exp = nullptr;
+    if (stmList->head->kind == T::Stm::MOVE)
+      exp = ((T::MoveStm*)stmList->head)->src;
+    else if (stmList->head->kind == T::Stm::EXP)
+      exp = ((T::ExpStm*)stmList->head)->exp;
+    if (exp && exp->kind == T::Exp::CALL
+        && ((T::CallExp*)exp)->fun->kind == T::Exp::NAME)
+      ret.insert(((T::NameExp*)((T::CallExp*)exp)->fun)->name);
+  }
+  return ret;
+}
+
+// procs in post order of the call graph, callees come before their callers
+// except on cycles
+void callGraphOrder(int i, std::vector<std::set<int>>& calls,
+                    std::vector<bool>& visited, std::vector<int>& order) {
+  visited[i] = true;
+  for (int j : calls[i])
+    if (!visited[j])
+      callGraphOrder(j, calls, visited, order);
+  order.push_back(i);
+}
+
+void do_proc(FILE* out, F::ProcFrag* procFrag, T::StmList* stmList) {
+  temp_map = TEMP::Map::Empty();
+  // Init temp_map
+
+  printf("doProc for function %s:\n", procFrag->frame->label->Name().c_str());
   struct C::Block blo = C::BasicBlocks(stmList);
+  blo = SSA::EliminateTailCalls(blo, procFrag->frame);
+  // round trip through SSA form, the optimizations on the tree IR work on it
+  SSA::Function* fn = SSA::Build(blo);
+  SSA::PropagateConstants(fn);
+  int eliminated = SSA::NumberValues(fn);
+  printf("GVN: %d operations eliminated in %s\n", eliminated,
+         procFrag->frame->label->Name().c_str());
+  SSA::HoistLoopInvariants(fn, procFrag->frame);
+  SSA::EliminateBoundsChecks(fn);
+  SSA::ReduceStrength(fn);
+  SSA::EliminateDeadCode(fn);
+  SSA::Print(stdout, fn);
+  printf("-------====SSA=====-----\n");
+  bool valid = SSA::Verify(fn);
+  assert(valid);
+  blo = SSA::Destruct(fn);
   //  C::StmListList* stmLists = blo.stmLists;
   //  for (; stmLists; stmLists = stmLists->tail) {
   //  	stmLists->head->Print(stdout);
@@ -52,8 +115,9 @@ void do_proc(FILE* out, F::ProcFrag* procFrag) {
   RA::Result allocation = RA::RegAlloc(procFrag->frame, iList); /* 11 */
   allocation.il->Print(stdout, allocation.coloring);
   printf("----======after RA=======-----\n");
+  allocation.il = PH::Optimize(allocation.il, allocation.coloring);
 
-  AS::Proc* proc = F::F_procEntryExit3(procFrag->frame, allocation.il);
+  AS::Proc* proc = F::F_procEntryExit3(procFrag->frame, allocation.il, allocation.coloring);
 
   std::string procName = procFrag->frame->label->Name();
   fprintf(out, ".globl %s\n", procName.c_str());
@@ -96,9 +160,19 @@ int main(int argc, char** argv) {
   char outfile[100];
   FILE* out = stdout;
   if (argc < 2) {
-    fprintf(stderr, "usage: tiger-compiler file.tig\n");
+    fprintf(stderr, "usage: tiger-compiler file.tig [-linear-scan | -chordal] [-check-bounds] [-cache-links]\n");
     exit(1);
   }
+  for (int i = 2; i < argc; i++) {
+    if (std::string(argv[i]) == "-linear-scan")
+      RA::allocator = RA::LINEAR_SCAN;
+    else if (std::string(argv[i]) == "-chordal")
+      RA::allocator = RA::CHORDAL;
+    else if (std::string(argv[i]) == "-check-bounds")
+      TR::check_bounds = true;
+    else if (std::string(argv[i]) == "-cache-links")
+      TR::nonlocal_access = TR::CACHED_LINKS;
+  }
 
   errormsg.Reset(argv[1], infile);
   Parser parser(infile, std::cerr);
@@ -109,6 +183,10 @@ int main(int argc, char** argv) {
   // Lab 6: escape analysis
   // If you have implemented escape analysis, uncomment this
   ESC::FindEscape(absyn_root); /* set varDec's escape field */
+  ESC::FindStaticLinks(absyn_root); /* set funDec's static_link field */
+
+  // call graph & sizes of functions, for inlining them in translation
+  INL::Analyze(absyn_root);
 
   // Lab5: translate IR tree
   frags = TR::TranslateProgram(absyn_root);
@@ -118,11 +196,33 @@ int main(int argc, char** argv) {
   sprintf(outfile, "%s.s", argv[1]);
   out = fopen(outfile, "w");
 
-  fprintf(out, ".text\n");
+  // compile callees first, calls to them then only clobber the registers
+  // they really write to
+  std::vector<F::ProcFrag*> procs;
+  std::vector<T::StmList*> bodies;
+  std::map<TEMP::Label*, int> proc_index;
   for (F::FragList* fragList = frags; fragList; fragList = fragList->tail)
     if (fragList->head->kind == F::Frag::Kind::PROC) {
-      do_proc(out, static_cast<F::ProcFrag*>(fragList->head));
+      F::ProcFrag* procFrag = static_cast<F::ProcFrag*>(fragList->head);
+      proc_index[procFrag->frame->label] = procs.size();
+      procs.push_back(procFrag);
+      bodies.push_back(linearize(procFrag));
     }
+  std::vector<std::set<int>> calls(procs.size());
+  for (size_t i = 0; i < procs.size(); i++)
+    for (TEMP::Label* callee : callees(bodies[i]))
+      if (proc_index.find(callee) != proc_index.end())
+        calls[i].insert(proc_index[callee]);
+  std::vector<bool> visited(procs.size(), false);
+  std::vector<int> order;
+  for (size_t i = 0; i < procs.size(); i++)
+    if (!visited[i])
+      callGraphOrder(i, calls, visited, order);
+
+  fprintf(out, ".text\n");
+  for (int i : order)
+    do_proc(out, procs[i], bodies[i]);
+  F::X64Frame::emitHelpers(out);
 
   fprintf(out, ".section .rodata\n");
   for (F::FragList* fragList = frags; fragList; fragList = fragList->tail)
@@ -131,5 +231,6 @@ int main(int argc, char** argv) {
     }
 
   fclose(out);
+  PH::ShowStats(stdout);
   return 0;
 }
\ No newline at end of file
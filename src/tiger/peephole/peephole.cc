@@ -0,0 +1,252 @@
+#include "tiger/peephole/peephole.h"
+
+namespace PH {
+
+Decoded::Decoded(AS::Instr *instr, TEMP::Map *coloring)
+{
+  std::string text = instr->kind == AS::Instr::LABEL ? "" : instr->Format(coloring);
+  std::size_t pos = text.find(' ');
+  op = text.substr(0, pos);
+  if (pos == std::string::npos)
+    return;
+  // split operands on top-level commas only, "8(%rbx,%rcx,8)" is one operand
+  std::string arg;
+  int depth = 0;
+  for (std::size_t i = pos + 1; i < text.size(); i++) {
+    char ch = text[i];
+    if (ch == '(') depth++;
+    if (ch == ')') depth--;
+    if (ch == ',' && depth == 0) {
+      args.push_back(arg);
+      arg.clear();
+    } else if (ch != ' ')
+      arg += ch;
+  }
+  if (!arg.empty())
+    args.push_back(arg);
+}
+
+namespace {
+
+inline AS::Instr *nth(AS::InstrList *pre, int i)
+{
+  for (AS::InstrList *il = pre->tail; il; il = il->tail, i--)
+    if (i == 0)
+      return il->head;
+  return nullptr;
+}
+
+inline void removeNext(AS::InstrList *pre) { pre->tail = pre->tail->tail; }
+
+inline bool isJump(AS::Instr *instr)
+{
+  return instr->kind == AS::Instr::OPER
+    && ((AS::OperInstr *)instr)->jumps
+    && ((AS::OperInstr *)instr)->assem.compare(0, 3, "jmp") == 0;
+}
+
+// find the temp in list that is allocated to register reg
+TEMP::Temp *tempOf(TEMP::TempList *list, const std::string &reg, TEMP::Map *coloring)
+{
+  for (; list; list = list->tail) {
+    std::string *s = coloring->Look(list->head);
+    if (s && *s == reg)
+      return list->head;
+  }
+  return nullptr;
+}
+
+inline TEMP::TempList *srcOf(AS::Instr *instr)
+{
+  switch (instr->kind) {
+    case AS::Instr::OPER: return ((AS::OperInstr *)instr)->src;
+    case AS::Instr::MOVE: return ((AS::MoveInstr *)instr)->src;
+    default: return nullptr;
+  }
+}
+
+inline TEMP::TempList *dstOf(AS::Instr *instr)
+{
+  switch (instr->kind) {
+    case AS::Instr::OPER: return ((AS::OperInstr *)instr)->dst;
+    case AS::Instr::MOVE: return ((AS::MoveInstr *)instr)->dst;
+    default: return nullptr;
+  }
+}
+
+// jmp L; [other labels;] L:  =>  [other labels;] L:
+class JumpToNext : public Rule {
+ public:
+  JumpToNext() : Rule("jump-to-next", 2) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    AS::Instr *instr = pre->tail->head;
+    // tail calls jump out of the function
+    if (!isJump(instr) || !((AS::OperInstr *)instr)->jumps->labels)
+      return false;
+    TEMP::Label *target = ((AS::OperInstr *)instr)->jumps->labels->head;
+    for (AS::InstrList *il = pre->tail->tail;
+         il && il->head->kind == AS::Instr::LABEL; il = il->tail)
+      if (((AS::LabelInstr *)il->head)->label == target) {
+        removeNext(pre);
+        return true;
+      }
+    return false;
+  }
+};
+
+// jmp L; <instr without label>  =>  jmp L
+class DeadAfterJump : public Rule {
+ public:
+  DeadAfterJump() : Rule("dead-after-jump", 2) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    AS::InstrList *jmp = pre->tail;
+    if (!isJump(jmp->head) || jmp->tail->head->kind == AS::Instr::LABEL)
+      return false;
+    removeNext(jmp);
+    return true;
+  }
+};
+
+// movq %r, M; movq M, %r  =>  movq %r, M
+// movq %r, M; movq M, %s  =>  movq %r, M; movq %r, %s
+class StoreLoad : public Rule {
+ public:
+  StoreLoad() : Rule("store-load", 2) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    AS::Instr *store = nth(pre, 0), *load = nth(pre, 1);
+    Decoded s(store, coloring), l(load, coloring);
+    if (!s.isMove() || !l.isMove() || !isReg(s.args[0]) || !isMem(s.args[1])
+        || s.args[1] != l.args[0] || !isReg(l.args[1]))
+      return false;
+    AS::InstrList *next = pre->tail->tail;
+    if (s.args[0] == l.args[1]) {
+      removeNext(pre->tail);
+      return true;
+    }
+    TEMP::Temp *from = tempOf(srcOf(store), s.args[0], coloring);
+    TEMP::Temp *to = tempOf(dstOf(load), l.args[1], coloring);
+    if (!from || !to)
+      return false;
+    next->head = new AS::MoveInstr("movq `s0, `d0",
+      new TEMP::TempList(to, nullptr), new TEMP::TempList(from, nullptr));
+    return true;
+  }
+};
+
+// movq M, %r; movq %r, M  =>  movq M, %r
+// movq M, %r; movq M, %r  =>  movq M, %r
+// unless the address of M depends on %r
+class LoadStore : public Rule {
+ public:
+  LoadStore() : Rule("load-store", 2) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    Decoded l(nth(pre, 0), coloring), n(nth(pre, 1), coloring);
+    if (!l.isMove() || !n.isMove() || !isMem(l.args[0]) || !isReg(l.args[1])
+        || usesReg(l.args[0], l.args[1]))
+      return false;
+    bool store_back = n.args[0] == l.args[1] && n.args[1] == l.args[0];
+    bool reload = n.args == l.args;
+    if (!store_back && !reload)
+      return false;
+    removeNext(pre->tail);
+    return true;
+  }
+};
+
+// movq %r, %r  =>  (nothing)
+// leaq 0(%r), %r  =>  (nothing)
+class SelfMove : public Rule {
+ public:
+  SelfMove() : Rule("self-move", 1) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    Decoded d(pre->tail->head, coloring);
+    if (d.args.size() != 2 || !isReg(d.args[1]))
+      return false;
+    if ((d.op == "movq" && d.args[0] == d.args[1])
+        || (d.op == "leaq" && (d.args[0] == "(" + d.args[1] + ")"
+                               || d.args[0] == "0(" + d.args[1] + ")"))) {
+      removeNext(pre);
+      return true;
+    }
+    return false;
+  }
+};
+
+// movq %a, %b; movq %b, %a  =>  movq %a, %b
+class MoveBack : public Rule {
+ public:
+  MoveBack() : Rule("move-back", 2) {}
+  bool Apply(AS::InstrList *pre, TEMP::Map *coloring) override
+  {
+    Decoded m(nth(pre, 0), coloring), n(nth(pre, 1), coloring);
+    if (!m.isMove() || !n.isMove() || !isReg(m.args[0]) || !isReg(m.args[1])
+        || m.args[0] != n.args[1] || m.args[1] != n.args[0])
+      return false;
+    removeNext(pre->tail);
+    return true;
+  }
+};
+
+std::vector<Rule *> &rules()
+{
+  static std::vector<Rule *> rules = {
+    new JumpToNext(),
+    new DeadAfterJump(),
+    new SelfMove(),
+    new MoveBack(),
+    new StoreLoad(),
+    new LoadStore(),
+  };
+  return rules;
+}
+
+// whether there are at least n instructions after pre
+inline bool fits(AS::InstrList *pre, int n)
+{
+  for (AS::InstrList *il = pre->tail; n > 0; il = il->tail, n--)
+    if (!il)
+      return false;
+  return true;
+}
+
+}  // namespace
+
+void AddRule(Rule *rule) { rules().push_back(rule); }
+
+AS::InstrList *Optimize(AS::InstrList *il, TEMP::Map *coloring)
+{
+  AS::InstrList *prehead = new AS::InstrList(nullptr, il);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    AS::InstrList *pre = prehead;
+    while (pre->tail) {
+      bool applied = false;
+      for (Rule *rule : rules()) {
+        if (fits(pre, rule->window) && rule->Apply(pre, coloring)) {
+          rule->hits++;
+          applied = changed = true;
+          break;
+        }
+      }
+      // the window may match another rule after a rewrite, stay here
+      if (!applied)
+        pre = pre->tail;
+    }
+  }
+  return prehead->tail;
+}
+
+void ShowStats(FILE *out)
+{
+  fprintf(out, "peephole statistics:\n");
+  for (Rule *rule : rules())
+    fprintf(out, "  %-16s %d\n", rule->name.c_str(), rule->hits);
+}
+
+}  // namespace PH
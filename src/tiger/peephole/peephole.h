@@ -0,0 +1,58 @@
+#ifndef TIGER_PEEPHOLE_PEEPHOLE_H_
+#define TIGER_PEEPHOLE_PEEPHOLE_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "tiger/codegen/assem.h"
+#include "tiger/frame/temp.h"
+
+namespace PH {
+
+// an instruction split into its opcode and (register-allocated) operands,
+// e.g. "movq 8(%rbx,%rcx,8), %rax" => "movq", {"8(%rbx,%rcx,8)", "%rax"}
+class Decoded {
+ public:
+  std::string op;
+  std::vector<std::string> args;
+
+  Decoded(AS::Instr *instr, TEMP::Map *coloring);
+  bool isMove() const { return op == "movq" && args.size() == 2; }
+};
+
+inline bool isReg(const std::string &arg) { return arg[0] == '%'; }
+inline bool isMem(const std::string &arg) { return arg.find('(') != std::string::npos; }
+// whether the address of a memory operand depends on register reg
+inline bool usesReg(const std::string &mem, const std::string &reg)
+{
+  return mem.find(reg) != std::string::npos;
+}
+
+// a peephole rule looks at a window of `window` consecutive instructions
+// and rewrites them in place when its pattern matches
+class Rule {
+ public:
+  std::string name;
+  int window;
+  int hits;
+
+  Rule(std::string name, int window) : name(name), window(window), hits(0) {}
+
+  // the window starts at pre->tail; pre is passed so that the first
+  // instruction of the window can be removed as well.
+  // returns true if the list has been changed
+  virtual bool Apply(AS::InstrList *pre, TEMP::Map *coloring) = 0;
+};
+
+// rules are tried in the order they are added
+void AddRule(Rule *rule);
+
+// run all rules over il until nothing changes anymore
+AS::InstrList *Optimize(AS::InstrList *il, TEMP::Map *coloring);
+
+void ShowStats(FILE *out);
+
+}  // namespace PH
+
+#endif
@@ -0,0 +1,509 @@
+#include "tiger/regalloc/chordal.h"
+#include "tiger/frame/x64frame.h"
+#include "tiger/liveness/flowgraph.h"
+#include "tiger/regalloc/color.h"
+#include "tiger/regalloc/split.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace CH {
+
+namespace {
+
+typedef TEMP::TempList TL;
+typedef std::set<TEMP::Temp*> TempSet;
+
+inline bool isVirtual(TEMP::Temp* t)
+{
+  return F::X64Frame::getTempMap()->Look(t) == nullptr;
+}
+
+// temps that take a register: virtual ones & general purpose registers
+inline bool isAllocated(TEMP::Temp* t)
+{
+  return isVirtual(t) || F::X64Frame::gp_regs.find(t) != F::X64Frame::gp_regs.end();
+}
+
+inline bool inList(TL* list, TEMP::Temp* t)
+{
+  for (; list; list = list->tail)
+    if (list->head == t)
+      return true;
+  return false;
+}
+
+std::vector<FG::InstrNode*> nodesOf(FG::FlowGraph* flow_graph)
+{
+  std::vector<FG::InstrNode*> node(flow_graph->nodecount);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail)
+    node[nl->head->Key()] = nl->head;
+  return node;
+}
+
+// a phi node at the start of an instruction, one source per predecessor
+class Phi {
+ public:
+  TEMP::Temp* var;
+  TEMP::Temp* dst;
+  std::map<int, TEMP::Temp*> src;
+};
+
+// live-in & out sets of allocated temps, indexed by Key()
+// phi destinations are defined at the start of their instruction, phi
+// sources are used at the end of the predecessor they come from
+void liveness(std::vector<FG::InstrNode*>& node, std::vector<TL*>& use,
+    std::vector<TL*>& def, std::vector<std::vector<Phi>>& phis,
+    std::vector<TempSet>& in, std::vector<TempSet>& out)
+{
+  int n = node.size();
+  std::vector<TempSet> phi_dst(n);
+  for (int p = 0; p < n; p++)
+    for (Phi& phi : phis[p])
+      phi_dst[p].insert(phi.dst);
+  in.assign(n, TempSet());
+  out.assign(n, TempSet());
+  bool changed;
+  do {
+    changed = false;
+    for (int p = n - 1; p >= 0; p--) {
+      TempSet o;
+      for (auto succ = node[p]->Succ(); succ; succ = succ->tail) {
+        int s = succ->head->Key();
+        for (TEMP::Temp* t : in[s])
+          if (phi_dst[s].find(t) == phi_dst[s].end())
+            o.insert(t);
+        for (Phi& phi : phis[s]) {
+          auto it = phi.src.find(p);
+          if (it != phi.src.end() && it->second)
+            o.insert(it->second);
+        }
+      }
+      TempSet i = o;
+      for (TL* d = def[p]; d; d = d->tail)
+        i.erase(d->head);
+      for (TL* u = use[p]; u; u = u->tail)
+        if (isAllocated(u->head))
+          i.insert(u->head);
+      if (i != in[p] || o != out[p]) {
+        in[p].swap(i);
+        out[p].swap(o);
+        changed = true;
+      }
+    }
+  } while (changed);
+}
+
+// turn the parallel copies dst <- src into a sequence of moves
+// a copy goes once no other one still reads its destination register, the
+// cycles that remain are broken up by swapping registers
+std::vector<AS::Instr*> sequentialize(std::vector<std::pair<TEMP::Temp*, TEMP::Temp*>> moves,
+    std::map<TEMP::Temp*, TEMP::Temp*>& color)
+{
+  std::vector<AS::Instr*> ret;
+  while (!moves.empty()) {
+    bool emitted = false;
+    for (size_t i = 0; i < moves.size() && !emitted; i++) {
+      bool read = false;
+      for (size_t j = 0; j < moves.size(); j++)
+        read |= j != i && color[moves[j].second] == color[moves[i].first];
+      if (read)
+        continue;
+      ret.push_back(new AS::MoveInstr(CG::get_x8664_movq_temp(),
+          new TL(moves[i].first, nullptr), new TL(moves[i].second, nullptr)));
+      moves.erase(moves.begin() + i);
+      emitted = true;
+    }
+    if (emitted)
+      continue;
+    std::pair<TEMP::Temp*, TEMP::Temp*> m = moves.back();
+    moves.pop_back();
+    ret.push_back(new AS::OperInstr("xchgq `s0, `d0",
+        new TL(m.first, new TL(m.second, nullptr)),
+        new TL(m.second, new TL(m.first, nullptr)), nullptr));
+    // what was in the destination register is in the source one now
+    for (auto& o : moves)
+      if (color[o.second] == color[m.first])
+        o.second = m.second;
+  }
+  return ret;
+}
+
+}  // namespace
+
+TEMP::TempList* Spills(F::Frame* f, AS::InstrList* il)
+{
+  FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
+  std::vector<FG::InstrNode*> node = nodesOf(flow_graph);
+  int n = node.size();
+  std::vector<TL*> use(n), def(n);
+  for (int p = 0; p < n; p++) {
+    use[p] = FG::Use(node[p]);
+    def[p] = FG::Def(node[p]);
+  }
+  std::vector<std::vector<Phi>> phis(n);
+  std::vector<TempSet> in, out;
+  liveness(node, use, def, phis, in, out);
+
+  std::map<TEMP::Temp*, COL::SpillCost> cost = COL::spillCosts(flow_graph);
+  auto cheaper = [&cost](TEMP::Temp* a, TEMP::Temp* b) {
+    const COL::SpillCost &x = cost[a], &y = cost[b];
+    return x.depth < y.depth || (x.depth == y.depth && x.weight < y.weight);
+  };
+
+  // values in registers right before & right after each instruction
+  // a spilled temp still takes one where it's used or defined, for the
+  // short temp the spill code loads it into or stores it from
+  int k = F::X64Frame::gp_regs_count;
+  TempSet spilled;
+  TL* prehead = new TL(nullptr, nullptr);
+  TL* tail = prehead;
+  for (int p = 0; p < n; p++) {
+    for (int after = 0; after < 2; after++) {
+      TempSet live;
+      if (!after) {
+        for (TEMP::Temp* t : in[p])
+          if (spilled.find(t) == spilled.end() || inList(use[p], t))
+            live.insert(t);
+      } else {
+        for (TEMP::Temp* t : out[p])
+          if (spilled.find(t) == spilled.end())
+            live.insert(t);
+        for (TL* d = def[p]; d; d = d->tail)
+          if (isAllocated(d->head))
+            live.insert(d->head);
+      }
+      if ((int)live.size() <= k)
+        continue;
+      std::vector<TEMP::Temp*> candidates;
+      for (TEMP::Temp* t : live)
+        if (isVirtual(t) && !inList(def[p], t) && (after || !inList(use[p], t)))
+          candidates.push_back(t);
+      std::sort(candidates.begin(), candidates.end(), cheaper);
+      for (TEMP::Temp* t : candidates) {
+        if ((int)live.size() <= k)
+          break;
+        live.erase(t);
+        spilled.insert(t);
+        tail = tail->tail = new TL(t, nullptr);
+        std::cout << "Chordal spills t" << t->Int() << std::endl;
+      }
+    }
+  }
+  return prehead->tail;
+}
+
+AS::InstrList* Allocate(F::Frame* f, AS::InstrList* il, TEMP::Map* coloring)
+{
+  FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
+  std::vector<FG::InstrNode*> node = nodesOf(flow_graph);
+  int n = node.size();
+  if (n == 0 || node[0]->Pred())
+    return nullptr;
+  std::vector<int> idom = FG::Dominators(flow_graph);
+  std::vector<std::vector<int>> children(n);
+  for (int p = 1; p < n; p++)
+    if (idom[p] != -1)
+      children[idom[p]].push_back(p);
+  std::vector<int> preorder;
+  std::vector<int> work{0};
+  while (!work.empty()) {
+    int p = work.back();
+    work.pop_back();
+    preorder.push_back(p);
+    for (auto c = children[p].rbegin(); c != children[p].rend(); c++)
+      work.push_back(*c);
+  }
+
+  std::vector<TL*> use(n, nullptr), def(n, nullptr);
+  for (int p : preorder) {
+    use[p] = FG::Use(node[p]);
+    def[p] = FG::Def(node[p]);
+  }
+  std::vector<std::vector<Phi>> phis(n);
+  std::vector<TempSet> in, out;
+  liveness(node, use, def, phis, in, out);
+  for (TEMP::Temp* t : in[0])
+    if (isVirtual(t))
+      return nullptr;
+
+  // dominance frontiers
+  std::vector<std::set<int>> df(n);
+  for (int b : preorder) {
+    int preds = 0;
+    for (auto pred = node[b]->Pred(); pred; pred = pred->tail)
+      preds += idom[pred->head->Key()] != -1;
+    if (preds < 2)
+      continue;
+    for (auto pred = node[b]->Pred(); pred; pred = pred->tail) {
+      int runner = pred->head->Key();
+      if (idom[runner] == -1)
+        continue;
+      while (runner != idom[b]) {
+        df[runner].insert(b);
+        runner = idom[runner];
+      }
+    }
+  }
+
+  // pruned phi nodes for temps defined more than once, only where live
+  std::map<TEMP::Temp*, std::vector<int>> defs;
+  for (int p : preorder)
+    for (TL* d = def[p]; d; d = d->tail)
+      if (isVirtual(d->head))
+        defs[d->head].push_back(p);
+  std::set<TEMP::Temp*> renamed;
+  for (auto& it : defs) {
+    if (it.second.size() < 2)
+      continue;
+    TEMP::Temp* v = it.first;
+    renamed.insert(v);
+    std::vector<bool> has_phi(n, false), queued(n, false);
+    std::vector<int> work = it.second;
+    for (int p : work)
+      queued[p] = true;
+    while (!work.empty()) {
+      int x = work.back();
+      work.pop_back();
+      for (int b : df[x]) {
+        if (has_phi[b] || in[b].find(v) == in[b].end())
+          continue;
+        has_phi[b] = true;
+        phis[b].push_back(Phi{v, nullptr, {}});
+        if (!queued[b]) {
+          queued[b] = true;
+          work.push_back(b);
+        }
+      }
+    }
+  }
+
+  // rename along the dominator tree
+  // an instruction that also reads the temp it writes, like the two-address
+  // ones, keeps the current name, the value stays in the same register
+  std::map<TEMP::Temp*, std::vector<TEMP::Temp*>> names;
+  std::vector<std::vector<TEMP::Temp*>> pushed(n);
+  auto current = [&](TEMP::Temp* v) -> TEMP::Temp* {
+    if (renamed.find(v) == renamed.end())
+      return v;
+    std::vector<TEMP::Temp*>& s = names[v];
+    return s.empty() ? nullptr : s.back();
+  };
+  bool ok = true;
+  std::vector<std::pair<int, bool>> walk{{0, false}};
+  while (!walk.empty() && ok) {
+    int p = walk.back().first;
+    bool leaving = walk.back().second;
+    walk.pop_back();
+    if (leaving) {
+      for (TEMP::Temp* v : pushed[p])
+        names[v].pop_back();
+      continue;
+    }
+    walk.push_back({p, true});
+    for (Phi& phi : phis[p]) {
+      phi.dst = TEMP::Temp::NewTemp();
+      names[phi.var].push_back(phi.dst);
+      pushed[p].push_back(phi.var);
+    }
+    TL* uses = use[p];
+    TL* prehead = new TL(nullptr, nullptr);
+    TL* tail = prehead;
+    for (TL* u = uses; u; u = u->tail) {
+      TEMP::Temp* t = current(u->head);
+      ok &= t != nullptr;
+      tail = tail->tail = new TL(t, nullptr);
+    }
+    use[p] = prehead->tail;
+    tail = prehead;
+    prehead->tail = nullptr;
+    for (TL* d = def[p]; d; d = d->tail) {
+      TEMP::Temp* t = d->head;
+      if (renamed.find(t) != renamed.end()) {
+        if (inList(uses, t)) {
+          t = current(t);
+          ok &= t != nullptr;
+        } else {
+          names[t].push_back(TEMP::Temp::NewTemp());
+          pushed[p].push_back(t);
+          t = names[t].back();
+        }
+      }
+      tail = tail->tail = new TL(t, nullptr);
+    }
+    def[p] = prehead->tail;
+    for (auto succ = node[p]->Succ(); succ; succ = succ->tail)
+      for (Phi& phi : phis[succ->head->Key()])
+        phi.src[p] = current(phi.var);
+    for (auto c = children[p].rbegin(); c != children[p].rend(); c++)
+      walk.push_back({*c, false});
+  }
+  if (!ok)
+    return nullptr;
+  liveness(node, use, def, phis, in, out);
+
+  // hard registers that are live somewhere a temp is defined, or the other
+  // way round, the temp can't have those
+  std::map<TEMP::Temp*, TempSet> forbid;
+  for (int p : preorder) {
+    for (TL* d = def[p]; d; d = d->tail) {
+      if (!isAllocated(d->head))
+        continue;
+      for (TEMP::Temp* t : out[p]) {
+        if (t == d->head)
+          continue;
+        if (isVirtual(d->head) && !isVirtual(t))
+          forbid[d->head].insert(t);
+        else if (!isVirtual(d->head) && isVirtual(t))
+          forbid[t].insert(d->head);
+      }
+      if (isVirtual(d->head))
+        for (TL* d2 = def[p]; d2; d2 = d2->tail)
+          if (!isVirtual(d2->head) && isAllocated(d2->head))
+            forbid[d->head].insert(d2->head);
+    }
+    for (Phi& phi : phis[p])
+      for (TEMP::Temp* t : in[p])
+        if (!isVirtual(t))
+          forbid[phi.dst].insert(t);
+  }
+  // move partners, to take the same register if possible
+  std::map<TEMP::Temp*, std::vector<TEMP::Temp*>> partners;
+  for (int p : preorder) {
+    if (FG::IsMove(node[p]) && use[p] && def[p]) {
+      partners[use[p]->head].push_back(def[p]->head);
+      partners[def[p]->head].push_back(use[p]->head);
+    }
+    for (Phi& phi : phis[p])
+      for (auto& it : phi.src)
+        if (it.second) {
+          partners[phi.dst].push_back(it.second);
+          partners[it.second].push_back(phi.dst);
+        }
+  }
+
+  // color in dominator tree order, every value live at a definition is
+  // defined further up the tree and colored already, so a free register
+  // exists as long as the pressure is within gp_regs_count
+  std::map<TEMP::Temp*, TEMP::Temp*> color;
+  auto colorOf = [&color](TEMP::Temp* t) -> TEMP::Temp* {
+    if (!isVirtual(t))
+      return t;
+    auto it = color.find(t);
+    return it == color.end() ? nullptr : it->second;
+  };
+  // caller-saved registers first, callee-saved ones have to be saved in the
+  // prologue once used
+  std::vector<TEMP::Temp*> order;
+  for (auto r = F::X64Frame::caller_saved; r; r = r->tail)
+    order.push_back(r->head);
+  for (auto r = F::X64Frame::callee_saved; r; r = r->tail)
+    order.push_back(r->head);
+  auto pick = [&](TEMP::Temp* t, TempSet& occupied, TEMP::Temp* hint) -> TEMP::Temp* {
+    TempSet& no = forbid[t];
+    auto allowed = [&](TEMP::Temp* r) {
+      return r && F::X64Frame::gp_regs.find(r) != F::X64Frame::gp_regs.end()
+        && occupied.find(r) == occupied.end() && no.find(r) == no.end();
+    };
+    if (allowed(hint))
+      return hint;
+    for (TEMP::Temp* partner : partners[t])
+      if (allowed(colorOf(partner)))
+        return colorOf(partner);
+    for (TEMP::Temp* r : order)
+      if (allowed(r))
+        return r;
+    return nullptr;
+  };
+  int phi_count = 0;
+  for (int p : preorder) {
+    if (!phis[p].empty()) {
+      TempSet occupied;
+      for (TEMP::Temp* t : in[p]) {
+        if (color.find(t) == color.end() && isVirtual(t))
+          continue;  // a phi destination
+        occupied.insert(colorOf(t));
+      }
+      for (Phi& phi : phis[p]) {
+        TEMP::Temp* r = pick(phi.dst, occupied, nullptr);
+        if (!r)
+          return nullptr;
+        color[phi.dst] = r;
+        occupied.insert(r);
+        phi_count++;
+      }
+    }
+    TempSet occupied;
+    for (TEMP::Temp* t : out[p]) {
+      if (inList(def[p], t))
+        continue;
+      if (!colorOf(t))
+        return nullptr;
+      occupied.insert(colorOf(t));
+    }
+    for (TL* d = def[p]; d; d = d->tail)
+      if (isAllocated(d->head) && colorOf(d->head))
+        occupied.insert(colorOf(d->head));
+    TEMP::Temp* hint = FG::IsMove(node[p]) && use[p] ? colorOf(use[p]->head) : nullptr;
+    for (TL* d = def[p]; d; d = d->tail) {
+      if (!isVirtual(d->head) || color.find(d->head) != color.end())
+        continue;
+      TEMP::Temp* r = pick(d->head, occupied, hint);
+      if (!r)
+        return nullptr;
+      color[d->head] = r;
+      occupied.insert(r);
+    }
+  }
+
+  // out of SSA: the renamed operands go into the instructions, unreachable
+  // ones are dropped, phi nodes become copies on their incoming edges
+  TEMP::Map* hard_regs = F::X64Frame::getTempMap();
+  for (auto& it : color)
+    coloring->Enter(it.first, hard_regs->Look(it.second));
+  AS::InstrList* prehead = new AS::InstrList(nullptr, nullptr);
+  AS::InstrList* tail = prehead;
+  int p = 0;
+  for (AS::InstrList* l = il; l; l = l->tail, p++) {
+    if (idom[p] == -1)
+      continue;
+    AS::Instr* instr = l->head;
+    if (instr->kind == AS::Instr::OPER) {
+      ((AS::OperInstr*)instr)->src = use[p];
+      ((AS::OperInstr*)instr)->dst = def[p];
+    } else if (instr->kind == AS::Instr::MOVE) {
+      ((AS::MoveInstr*)instr)->src = use[p];
+      ((AS::MoveInstr*)instr)->dst = def[p];
+    }
+    tail = tail->tail = new AS::InstrList(instr, nullptr);
+  }
+  il = prehead->tail;
+  int copy_count = 0;
+  for (int s : preorder) {
+    if (phis[s].empty())
+      continue;
+    for (auto pred = node[s]->Pred(); pred; pred = pred->tail) {
+      int from = pred->head->Key();
+      if (idom[from] == -1)
+        continue;
+      std::vector<std::pair<TEMP::Temp*, TEMP::Temp*>> moves;
+      for (Phi& phi : phis[s]) {
+        TEMP::Temp* src = phi.src[from];
+        if (src && color[src] != color[phi.dst])
+          moves.push_back({phi.dst, src});
+      }
+      if (moves.empty())
+        continue;
+      std::vector<AS::Instr*> copies = sequentialize(moves, color);
+      copy_count += copies.size();
+      RA::insertOnEdge(il, node[from]->NodeInfo(), node[s]->NodeInfo(), copies);
+    }
+  }
+  std::cout << "Chordal coloring: " << color.size() << " values, " << phi_count
+    << " phis, " << copy_count << " copies" << std::endl;
+  return il;
+}
+
+}  // namespace CH
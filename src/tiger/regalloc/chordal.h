@@ -0,0 +1,26 @@
+#ifndef TIGER_REGALLOC_CHORDAL_H_
+#define TIGER_REGALLOC_CHORDAL_H_
+
+#include "tiger/codegen/assem.h"
+#include "tiger/frame/frame.h"
+#include "tiger/frame/temp.h"
+
+namespace CH {
+
+// temps to spill so that no more than gp_regs_count values are live at
+// any point, counting the short temps the spill code itself introduces
+TEMP::TempList *Spills(F::Frame *f, AS::InstrList *il);
+
+// SSA-based allocation
+// temps are renamed into SSA form, the interference graph of which is
+// chordal, and colored in dominator tree order, phi nodes become parallel
+// copies on the incoming edges
+// register pressure has to be within gp_regs_count already, the coloring
+// is entered into coloring & the new instruction list returned
+// returns nullptr, leaving il untouched, if precolored registers get in the
+// way of the coloring
+AS::InstrList *Allocate(F::Frame *f, AS::InstrList *il, TEMP::Map *coloring);
+
+}  // namespace CH
+
+#endif
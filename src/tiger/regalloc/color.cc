@@ -1,4 +1,6 @@
 #include "tiger/regalloc/color.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <map>
 #include <set>
@@ -10,26 +12,6 @@ namespace COL {
 std::map<LIVE::TNode*, LIVE::TNode*> temp_aliases;
 std::stack<LIVE::TNode*> spill;
 
-// determine whether one temp is in def
-inline bool inDef(FG::InstrNode* src, TEMP::Temp* target)
-{
-  for (auto defs = FG::Def(src); defs; defs = defs->tail) {
-    if (defs->head == target)
-      return true;
-  }
-  return false;
-}
-
-// determine whether one temp is in use
-inline bool inUse(FG::InstrNode* src, TEMP::Temp* target)
-{
-  for (auto uses = FG::Use(src); uses; uses = uses->tail) {
-    if (uses->head == target)
-      return true;
-  }
-  return false;
-}
-
 void removeTNode(G::Graph<TEMP::Temp>* graph, LIVE::TNode* tnode)
 {
   G::NodeList<TEMP::Temp>*succ, *pred;
@@ -138,10 +120,19 @@ inline LIVE::TNode* findTNode(G::NodeList<TEMP::Temp>* list, TEMP::Temp* target)
   return nullptr;
 }
 
+// find the representative of a coalesced node
+inline LIVE::TNode* getAlias(LIVE::TNode* t)
+{
+  while (temp_aliases.find(t) != temp_aliases.end())
+    t = temp_aliases[t];
+  return t;
+}
+
 inline bool cannotMove(LIVE::MoveList* ml, LIVE::TNode* t)
 {
+  // moves still refer to the original nodes, resolve them first
   for (; ml; ml = ml->tail)
-    if (ml->valid && !ml->frozen && (ml->dst == t || ml->src == t))
+    if (ml->valid && !ml->frozen && (getAlias(ml->dst) == t || getAlias(ml->src) == t))
       return false;
   return true;
 }
@@ -262,23 +253,45 @@ bool freeze(LIVE::LiveGraph& graph)
   }
 }
 
-bool potentialSpill(LIVE::LiveGraph graph, FG::FlowGraph* flow_graph)
+std::map<TEMP::Temp*, SpillCost> spillCosts(FG::FlowGraph* flow_graph)
+{
+  std::map<TEMP::Temp*, SpillCost> cost;
+  std::vector<int> depth = FG::LoopDepth(flow_graph);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail) {
+    int d = depth[nl->head->Key()];
+    double w = std::pow(10.0, d);
+    // a rematerializable def costs nothing to spill, there's no store
+    bool remat = CG::isRematerializable(nl->head->NodeInfo());
+    for (auto defs = FG::Def(nl->head); defs; defs = defs->tail) {
+      SpillCost& c = cost[defs->head];
+      if (remat)
+        continue;
+      c.depth = std::max(c.depth, d);
+      c.weight += w;
+    }
+    for (auto uses = FG::Use(nl->head); uses; uses = uses->tail) {
+      SpillCost& c = cost[uses->head];
+      c.depth = std::max(c.depth, d);
+      c.weight += w;
+    }
+  }
+  return cost;
+}
+
+bool potentialSpill(LIVE::LiveGraph graph, std::map<TEMP::Temp*, SpillCost>& cost)
 {
   std::cout << "Begin potential spill" << std::endl;
   LIVE::TNode* target = nullptr;
+  int depth = 0;
   float prio = 1e10; // random big number
   for (auto nl = graph.graph->Nodes(); nl; nl = nl->tail) {
     if (F::X64Frame::getTempMap()->Look(nl->head->NodeInfo()) == nullptr && nl->head->Degree() > 0 && cannotMove(graph.moves, nl->head)) {
       // calculate its priority
-      // I'm too lazy to determine which one is loop, so just count def+use count
-      int acc = 0;
-      for (auto bb_node = flow_graph->Nodes(); bb_node; bb_node = bb_node->tail) {
-        acc += inDef(bb_node->head, nl->head->NodeInfo());
-        acc += inUse(bb_node->head, nl->head->NodeInfo());
-      }
-      float cur_prio = float(acc) / nl->head->Degree();
-      std::cout << "Node " << nl->head->NodeInfo()->Int() << " priority " << cur_prio << std::endl;
-      if (cur_prio < prio) {
+      const SpillCost& c = cost[nl->head->NodeInfo()];
+      float cur_prio = float(c.weight) / nl->head->Degree();
+      std::cout << "Node " << nl->head->NodeInfo()->Int() << " depth " << c.depth << " priority " << cur_prio << std::endl;
+      if (target == nullptr || c.depth < depth || (c.depth == depth && cur_prio < prio)) {
+        depth = c.depth;
         prio = cur_prio;
         target = nl->head;
       }
@@ -292,6 +305,60 @@ bool potentialSpill(LIVE::LiveGraph graph, FG::FlowGraph* flow_graph)
   return true;
 }
 
+// pick a color for t out of avail, biased towards its move partners
+// - a register a partner already has, or a partner's precolored register
+// - otherwise one that is still free for the uncolored partners, so they
+//   can follow t later
+// both are scored by the number of moves that would go away, ties go to
+// caller-saved registers, as callee-saved ones have to be saved in the
+// prologue once used; lookahead alone never picks a callee-saved one
+template <class Rep>
+TEMP::Temp* biasedColor(TEMP::Temp* t, const std::set<TEMP::Temp*>& avail,
+    const std::vector<TEMP::Temp*>& partners, Rep rep,
+    std::map<TEMP::Temp*, LIVE::TNode*>& tnode)
+{
+  TEMP::Map* hard_temp_map = F::X64Frame::getTempMap();
+  std::map<TEMP::Temp*, int> bias, lookahead;
+  for (TEMP::Temp* p : partners) {
+    TEMP::Temp* r = rep(p);
+    if (r == t)
+      continue;
+    if (hard_temp_map->Look(r)) {
+      if (avail.find(r) != avail.end())
+        bias[r]++;
+      continue;
+    }
+    auto n = tnode.find(r);
+    if (n == tnode.end())
+      continue;
+    std::set<TEMP::Temp*> free = avail;
+    for (auto a = n->second->Adj(); a; a = a->tail)
+      free.erase(rep(a->head->NodeInfo()));
+    for (TEMP::Temp* f : free)
+      lookahead[f]++;
+  }
+
+  std::vector<TEMP::Temp*> order;
+  for (auto r = F::X64Frame::caller_saved; r; r = r->tail)
+    if (avail.find(r->head) != avail.end())
+      order.push_back(r->head);
+  int caller_saved = order.size();
+  for (TEMP::Temp* r : avail)
+    if (std::find(order.begin(), order.end(), r) == order.end())
+      order.push_back(r);
+  TEMP::Temp* reg = order.front();
+  for (TEMP::Temp* r : order)
+    if (bias[r] > bias[reg])
+      reg = r;
+  if (bias[reg] > 0)
+    return reg;
+  int n = caller_saved > 0 ? caller_saved : order.size();
+  for (int i = 0; i < n; i++)
+    if (lookahead[order[i]] > lookahead[reg])
+      reg = order[i];
+  return reg;
+}
+
 void selectColor(LIVE::LiveGraph graph_copy, Result& result)
 {
   G::Graph<TEMP::Temp>* graph = graph_copy.graph;
@@ -319,6 +386,22 @@ void selectColor(LIVE::LiveGraph graph_copy, Result& result)
   }
   // showInterference(stdout, graph_copy);
 
+  // move partners of each node, coalesced ones count for their representative
+  std::map<TEMP::Temp*, LIVE::TNode*> tnode;
+  for (auto m = nodes; m; m = m->tail)
+    tnode[m->head->NodeInfo()] = m->head;
+  std::map<TEMP::Temp*, std::vector<TEMP::Temp*>> partners;
+  auto rep = [&](TEMP::Temp* t) {
+    while (!hard_temp_map->Look(t) && color.find(t) != color.end())
+      t = color[t];
+    return t;
+  };
+  for (auto m = move_list; m; m = m->tail) {
+    TEMP::Temp *src = m->src->NodeInfo(), *dst = m->dst->NodeInfo();
+    partners[rep(src)].push_back(dst);
+    partners[rep(dst)].push_back(src);
+  }
+
   // pop the stack
   std::cout << "Stack have " << spill.size() << " nodes." << std::endl;
   while (!spill.empty()) {
@@ -354,9 +437,9 @@ void selectColor(LIVE::LiveGraph graph_copy, Result& result)
       actual_spill_tail = actual_spill_tail->tail = new TEMP::TempList(n->NodeInfo(), nullptr);
       removeTNode(graph, n);
     } else {
-      // assign color
-      std::cout << "assigned " << (*avail.begin())->Int();
-      color[t] = *avail.begin();
+      TEMP::Temp* reg = biasedColor(t, avail, partners[t], rep, tnode);
+      std::cout << "assigned " << reg->Int();
+      color[t] = reg;
     }
     std::cout << std::endl;
   }
@@ -396,7 +479,7 @@ void selectColor(LIVE::LiveGraph graph_copy, Result& result)
   return;
 }
 
-Result Color(FG::FlowGraph* flow_graph)
+Result Color(FG::FlowGraph* flow_graph, LIVE::LiveOutCache* cache)
 {
   Result result;
   result.coloring = TEMP::Map::Empty();
@@ -407,9 +490,14 @@ Result Color(FG::FlowGraph* flow_graph)
   bool flag = false;
   // showFlowGraph(stdout, flow_graph);
   LIVE::LiveGraph graph, graph_copy;
-  graph_copy = LIVE::Liveness(flow_graph);
-  graph = LIVE::Liveness(flow_graph);
+  // the second analysis starts from the result of the first one
+  LIVE::LiveOutCache local_cache;
+  if (cache == nullptr)
+    cache = &local_cache;
+  graph_copy = LIVE::Liveness(flow_graph, cache);
+  graph = LIVE::Liveness(flow_graph, cache);
   std::cout << "completed liveness analysis" << std::endl;
+  std::map<TEMP::Temp*, SpillCost> cost = spillCosts(flow_graph);
   // showInterference(stdout, graph);
   std::cout << "coloring phase begin" << std::endl;
   do {
@@ -418,7 +506,7 @@ Result Color(FG::FlowGraph* flow_graph)
         simplify(graph);
       while (coalesce(graph, result));
     } while (freeze(graph));
-  } while (potentialSpill(graph, flow_graph));
+  } while (potentialSpill(graph, cost));
   showInterference(stdout, graph);
   selectColor(graph_copy, result);
   return result;
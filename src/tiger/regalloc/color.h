@@ -6,6 +6,7 @@
 #include "tiger/util/graph.h"
 #include "tiger/frame/x64frame.h"
 #include "tiger/util/table.h"
+#include <map>
 
 namespace COL {
 
@@ -15,7 +16,18 @@ class Result {
   TEMP::TempList *spills;
 };
 
-Result Color(FG::FlowGraph *flow_graph);
+// spill cost of a temp: its defs & uses weighted by 10^loop-depth
+// depth is the deepest loop it's referenced in, it's compared first so that
+// temps referenced in loops are never spilled ahead of ones outside loops
+class SpillCost {
+ public:
+  int depth = 0;
+  double weight = 0;
+};
+
+std::map<TEMP::Temp *, SpillCost> spillCosts(FG::FlowGraph *flow_graph);
+
+Result Color(FG::FlowGraph *flow_graph, LIVE::LiveOutCache *cache = nullptr);
 
 }  // namespace COL
 
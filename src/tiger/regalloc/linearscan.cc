@@ -0,0 +1,231 @@
+#include "tiger/regalloc/linearscan.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace LS {
+
+namespace {
+
+typedef std::vector<uint64_t> Bits;
+
+inline void set(Bits &b, int i) { b[i >> 6] |= uint64_t(1) << (i & 63); }
+
+// instruction p uses its operands at position 2p and defines at 2p+1,
+// so a temp dying at p and one born at p may share a register
+// an interval is a sorted list of disjoint [from, to] ranges, the holes
+// between them (e.g. dead definitions on other paths) may be reused
+class Interval {
+ public:
+  TEMP::Temp *temp;
+  std::vector<std::pair<int, int>> ranges;
+  int start, end;
+  TEMP::Temp *reg;
+  // register of the move source, if the temp is defined by a move
+  TEMP::Temp *hint;
+
+  Interval(TEMP::Temp *temp, std::vector<int> &pos)
+    : temp(temp), reg(nullptr), hint(nullptr)
+  {
+    std::sort(pos.begin(), pos.end());
+    for (int p : pos) {
+      if (!ranges.empty() && p <= ranges.back().second + 1)
+        ranges.back().second = std::max(ranges.back().second, p);
+      else
+        ranges.push_back({p, p});
+    }
+    start = ranges.front().first;
+    end = ranges.back().second;
+  }
+
+  bool intersects(const Interval *other) const
+  {
+    if (other->end < start || end < other->start)
+      return false;
+    auto a = ranges.begin(), b = other->ranges.begin();
+    while (a != ranges.end() && b != other->ranges.end()) {
+      if (a->second < b->first)
+        a++;
+      else if (b->second < a->first)
+        b++;
+      else
+        return true;
+    }
+    return false;
+  }
+};
+
+}  // namespace
+
+COL::Result Allocate(FG::FlowGraph *flow_graph)
+{
+  TEMP::Map *hard_regs = F::X64Frame::getTempMap();
+  const std::set<TEMP::Temp *> &gp_regs = F::X64Frame::gp_regs;
+  int n = flow_graph->nodecount;
+  std::vector<FG::InstrNode *> node(n);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail)
+    node[nl->head->Key()] = nl->head;
+
+  // number the temps, %rsp & the frame pointer never get allocated
+  std::map<TEMP::Temp *, int> index;
+  std::vector<TEMP::Temp *> temps;
+  std::vector<std::vector<int>> use(n), def(n);
+  auto number = [&](TEMP::Temp *t) {
+    if (hard_regs->Look(t) && gp_regs.find(t) == gp_regs.end())
+      return -1;
+    auto it = index.find(t);
+    if (it != index.end())
+      return it->second;
+    temps.push_back(t);
+    return index[t] = temps.size() - 1;
+  };
+  for (int p = 0; p < n; p++) {
+    for (auto t = FG::Use(node[p]); t; t = t->tail) {
+      int i = number(t->head);
+      if (i >= 0)
+        use[p].push_back(i);
+    }
+    for (auto t = FG::Def(node[p]); t; t = t->tail) {
+      int i = number(t->head);
+      if (i >= 0)
+        def[p].push_back(i);
+    }
+  }
+
+  // liveness over bitsets, backwards until nothing changes
+  int words = (temps.size() + 63) / 64;
+  std::vector<Bits> live_in(n, Bits(words, 0)), live_out(n, Bits(words, 0));
+  bool changed;
+  do {
+    changed = false;
+    for (int p = n - 1; p >= 0; p--) {
+      Bits out(words, 0);
+      for (auto succ = node[p]->Succ(); succ; succ = succ->tail) {
+        const Bits &in = live_in[succ->head->Key()];
+        for (int w = 0; w < words; w++)
+          out[w] |= in[w];
+      }
+      Bits in = out;
+      for (int i : def[p])
+        in[i >> 6] &= ~(uint64_t(1) << (i & 63));
+      for (int i : use[p])
+        set(in, i);
+      if (in != live_in[p] || out != live_out[p]) {
+        live_in[p].swap(in);
+        live_out[p].swap(out);
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  // every temp gets an interval, those of hard registers are fixed
+  std::vector<std::vector<int>> pos(temps.size());
+  std::vector<TEMP::Temp *> move_src(temps.size(), nullptr);
+  for (int p = 0; p < n; p++) {
+    for (int w = 0; w < words; w++) {
+      for (uint64_t b = live_in[p][w]; b; b &= b - 1)
+        pos[w * 64 + __builtin_ctzll(b)].push_back(2 * p);
+      for (uint64_t b = live_out[p][w]; b; b &= b - 1)
+        pos[w * 64 + __builtin_ctzll(b)].push_back(2 * p + 1);
+    }
+    for (int i : use[p])
+      pos[i].push_back(2 * p);
+    for (int i : def[p])
+      pos[i].push_back(2 * p + 1);
+    if (FG::IsMove(node[p]) && use[p].size() == 1 && def[p].size() == 1)
+      move_src[def[p][0]] = temps[use[p][0]];
+  }
+  std::vector<Interval *> interval(temps.size(), nullptr);
+  std::map<TEMP::Temp *, Interval *> fixed;
+  std::vector<Interval *> order;
+  for (int i = 0; i < (int)temps.size(); i++) {
+    if (pos[i].empty())
+      continue;
+    interval[i] = new Interval(temps[i], pos[i]);
+    if (hard_regs->Look(temps[i]))
+      fixed[temps[i]] = interval[i];
+    else {
+      interval[i]->hint = move_src[i];
+      order.push_back(interval[i]);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [](Interval *a, Interval *b) { return a->start < b->start; });
+
+  // intervals assigned to each register that may still intersect later ones
+  std::map<TEMP::Temp *, std::vector<Interval *>> assigned;
+  auto blockers = [&](TEMP::Temp *reg, Interval *cur) {
+    std::vector<Interval *> &list = assigned[reg];
+    list.erase(std::remove_if(list.begin(), list.end(),
+        [cur](Interval *a) { return a->end < cur->start; }), list.end());
+    std::vector<Interval *> ret;
+    for (Interval *a : list)
+      if (a->intersects(cur))
+        ret.push_back(a);
+    return ret;
+  };
+  auto fixedConflict = [&](TEMP::Temp *reg, Interval *cur) {
+    auto it = fixed.find(reg);
+    return it != fixed.end() && it->second->intersects(cur);
+  };
+
+  // try the move source first, then caller-saved, then callee-saved ones
+  std::vector<TEMP::Temp *> preference;
+  for (auto r = F::X64Frame::caller_saved; r; r = r->tail)
+    preference.push_back(r->head);
+  for (auto r = F::X64Frame::callee_saved; r; r = r->tail)
+    preference.push_back(r->head);
+
+  COL::Result result;
+  result.coloring = TEMP::Map::Empty();
+  TEMP::TempList *spill_prehead = new TEMP::TempList(nullptr, nullptr);
+  TEMP::TempList *spill_tail = spill_prehead;
+  for (Interval *cur : order) {
+    TEMP::Temp *hint = cur->hint;
+    if (hint && !hard_regs->Look(hint))
+      hint = interval[index[hint]]->reg;
+    std::vector<TEMP::Temp *> candidates;
+    if (hint)
+      candidates.push_back(hint);
+    candidates.insert(candidates.end(), preference.begin(), preference.end());
+
+    // the register with a single blocker that lives the longest, if cur
+    // gets no free register either it or cur is spilled
+    Interval *victim = cur;
+    for (TEMP::Temp *reg : candidates) {
+      if (fixedConflict(reg, cur))
+        continue;
+      std::vector<Interval *> b = blockers(reg, cur);
+      if (b.empty()) {
+        cur->reg = reg;
+        break;
+      }
+      if (b.size() == 1 && b[0]->end > victim->end)
+        victim = b[0];
+    }
+
+    if (!cur->reg) {
+      if (victim != cur) {
+        cur->reg = victim->reg;
+        std::vector<Interval *> &list = assigned[victim->reg];
+        list.erase(std::find(list.begin(), list.end(), victim));
+        victim->reg = nullptr;
+      }
+      std::cout << "Linear scan spills t" << victim->temp->Int() << std::endl;
+      spill_tail = spill_tail->tail = new TEMP::TempList(victim->temp, nullptr);
+    }
+    if (cur->reg)
+      assigned[cur->reg].push_back(cur);
+  }
+
+  for (Interval *i : order)
+    if (i->reg)
+      result.coloring->Enter(i->temp, hard_regs->Look(i->reg));
+  result.spills = spill_prehead->tail;
+  std::cout << "Linear scan: " << order.size() << " intervals" << std::endl;
+  return result;
+}
+
+}  // namespace LS
@@ -0,0 +1,17 @@
+#ifndef TIGER_REGALLOC_LINEARSCAN_H_
+#define TIGER_REGALLOC_LINEARSCAN_H_
+
+#include "tiger/frame/temp.h"
+#include "tiger/liveness/flowgraph.h"
+#include "tiger/regalloc/color.h"
+
+namespace LS {
+
+// linear scan over live intervals, in the order of the instruction list
+// same result as COL::Color, spilled temps are rewritten by the caller,
+// which splits them into short intervals around every use & def
+COL::Result Allocate(FG::FlowGraph *flow_graph);
+
+}  // namespace LS
+
+#endif
@@ -1,19 +1,16 @@
 #include "tiger/regalloc/regalloc.h"
+#include "tiger/regalloc/chordal.h"
+#include "tiger/regalloc/split.h"
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <unordered_set>
 
 namespace RA {
 
 typedef TEMP::TempList TL;
 TEMP::Map* result;
-
-inline bool inTempList(TEMP::TempList* head, TEMP::Temp* target)
-{
-  for (; head; head = head->tail)
-    if (head->head == target)
-      return true;
-  return false;
-}
+Allocator allocator = GRAPH_COLORING;
 
 // clear unnecessary move operations
 AS::InstrList* sweepMove(AS::InstrList* il, TEMP::Map* temp_map)
@@ -35,86 +32,337 @@ AS::InstrList* sweepMove(AS::InstrList* il, TEMP::Map* temp_map)
   return pre_head->tail;
 }
 
+inline int countMoves(AS::InstrList* il)
+{
+  int n = 0;
+  for (; il; il = il->tail)
+    n += il->head->kind == AS::Instr::MOVE;
+  return n;
+}
+
+// spill slots are only numbered while rewriting, they get their frame
+// offset in packSpillSlots once allocation is done, so that slots whose
+// live ranges never overlap can share the same offset
+class SlotRef {
+ public:
+  int slot;
+  bool store;
+};
+
+std::map<AS::OperInstr*, SlotRef> slot_refs;
+int slot_count;
+
+// replace temps in list by their fresh temps
+// the list is copied since temp lists may be shared between instructions
+TL* renameTemps(TL* list, std::map<TEMP::Temp*, TEMP::Temp*>& fresh)
+{
+  TL* prehead = new TL(nullptr, nullptr);
+  TL* tail = prehead;
+  for (; list; list = list->tail) {
+    auto it = fresh.find(list->head);
+    tail = tail->tail = new TL(it == fresh.end() ? list->head : it->second, nullptr);
+  }
+  return prehead->tail;
+}
+
 AS::InstrList* rewriteProgram(F::Frame* f, AS::InstrList* il,
     TEMP::TempList* spilled)
 {
   F::X64Frame* fr = (F::X64Frame*)f;
   AS::InstrList* prehead = new AS::InstrList(nullptr, il);
   AS::InstrList* pre = prehead;
-  std::map<TEMP::Temp*, F::InFrameAccess*> acc;
+  std::unordered_set<TEMP::Temp*> spilled_set;
+  for (TL* t = spilled; t; t = t->tail)
+    spilled_set.insert(t->head);
+  // spilled temps with a single rematerializable definition are
+  // recomputed at every use, they need neither a slot nor a store
+  std::map<TEMP::Temp*, AS::Instr*> def;
+  std::map<TEMP::Temp*, int> def_count;
+  for (AS::InstrList* l = il; l; l = l->tail) {
+    TL* d = nullptr;
+    if (l->head->kind == AS::Instr::OPER)
+      d = ((AS::OperInstr*)l->head)->dst;
+    else if (l->head->kind == AS::Instr::MOVE)
+      d = ((AS::MoveInstr*)l->head)->dst;
+    for (; d; d = d->tail) {
+      def[d->head] = l->head;
+      def_count[d->head]++;
+    }
+  }
+  std::map<TEMP::Temp*, AS::OperInstr*> remat;
+  std::map<TEMP::Temp*, int> slot;
+  for (TL* t = spilled; t; t = t->tail) {
+    if (def_count[t->head] == 1 && CG::isRematerializable(def[t->head]))
+      remat[t->head] = (AS::OperInstr*)def[t->head];
+    else
+      slot[t->head] = slot_count++;
+  }
   while (il) {
     AS::Instr* instr = il->head;
-    TL *dst = nullptr, *src = nullptr;
+    TL **dst = nullptr, **src = nullptr;
     switch (instr->kind) {
     case AS::Instr::LABEL:
       break;
     case AS::Instr::MOVE:
-      dst = ((AS::MoveInstr*)instr)->dst;
-      src = ((AS::MoveInstr*)instr)->src;
+      dst = &((AS::MoveInstr*)instr)->dst;
+      src = &((AS::MoveInstr*)instr)->src;
       break;
     case AS::Instr::OPER:
-      dst = ((AS::OperInstr*)instr)->dst;
-      src = ((AS::OperInstr*)instr)->src;
+      dst = &((AS::OperInstr*)instr)->dst;
+      src = &((AS::OperInstr*)instr)->src;
       break;
     }
-    for (; src; src = src->tail) {
-      if (inTempList(spilled, src->head)) {
-        // spill it
-        int offset = 0;
-        if (acc.find(src->head) == acc.end())
-          acc[src->head] = (F::InFrameAccess*)(f->allocSpace(TR::word_size));
-        offset = acc[src->head]->offset;
-        // add move inst before
-        AS::Instr* nins = new AS::OperInstr(
-            CG::get_x8664_movq_temp_offset_fp(offset, f),
-            new TL(src->head, nullptr),
-            new TL(fr->getStackPointer(), nullptr), nullptr);
-        pre = pre->tail = new AS::InstrList(nins, il);
-      }
+    if (instr->kind == AS::Instr::LABEL) {
+      pre = il;
+      il = il->tail;
+      continue;
+    }
+    if (*dst && remat.find((*dst)->head) != remat.end()) {
+      // drop the definition, it's recomputed at each use
+      pre->tail = il = il->tail;
+      continue;
     }
-    for (; dst; dst = dst->tail) {
-      if (inTempList(spilled, dst->head)) {
-        // spill it
-        int offset = 0;
-        if (acc.find(dst->head) == acc.end())
-          acc[dst->head] = (F::InFrameAccess*)(f->allocSpace(TR::word_size));
-        offset = acc[dst->head]->offset;
-        // add move inst after
-        AS::Instr* nins = new AS::OperInstr(
-            CG::get_x8664_movq_mem_offset_fp(offset, f),
-            nullptr,
-            new TL(dst->head,
-                new TL(fr->getStackPointer(), nullptr)),
-            nullptr);
-        il = il->tail = new AS::InstrList(nins, il->tail);
+    // every instruction gets its own short-lived temps for spilled ones,
+    // a two-address instruction uses the same temp for its use & def
+    std::map<TEMP::Temp*, TEMP::Temp*> fresh;
+    for (TL* s = *src; s; s = s->tail) {
+      TEMP::Temp* t = s->head;
+      if (spilled_set.find(t) == spilled_set.end() || fresh.find(t) != fresh.end())
+        continue;
+      TEMP::Temp* n = fresh[t] = TEMP::Temp::NewTemp();
+      if (remat.find(t) != remat.end()) {
+        AS::OperInstr* def = remat[t];
+        pre = pre->tail = new AS::InstrList(
+            new AS::OperInstr(def->assem, new TL(n, nullptr), def->src, nullptr), il);
+        continue;
       }
+      // add move inst before, offset is filled in by packSpillSlots
+      AS::OperInstr* nins = new AS::OperInstr(
+          CG::get_x8664_movq_temp_offset_fp(0, f),
+          new TL(n, nullptr),
+          new TL(fr->getStackPointer(), nullptr), nullptr);
+      slot_refs[nins] = SlotRef{slot[t], false};
+      pre = pre->tail = new AS::InstrList(nins, il);
+    }
+    *src = renameTemps(*src, fresh);
+    std::unordered_set<TEMP::Temp*> stored;
+    for (TL* d = *dst; d; d = d->tail) {
+      TEMP::Temp* t = d->head;
+      if (spilled_set.find(t) == spilled_set.end() || !stored.insert(t).second)
+        continue;
+      if (fresh.find(t) == fresh.end())
+        fresh[t] = TEMP::Temp::NewTemp();
+      // add move inst after
+      AS::OperInstr* nins = new AS::OperInstr(
+          CG::get_x8664_movq_mem_offset_fp(0, f),
+          nullptr,
+          new TL(fresh[t],
+              new TL(fr->getStackPointer(), nullptr)),
+          nullptr);
+      slot_refs[nins] = SlotRef{slot[t], true};
+      il = il->tail = new AS::InstrList(nins, il->tail);
     }
+    *dst = renameTemps(*dst, fresh);
     pre = il;
     il = il->tail;
   }
   return prehead->tail;
 }
 
+// drop reloads of a spill slot into a register that still holds its value,
+// from a load or store earlier in the same basic block
+AS::InstrList* sweepReload(AS::InstrList* il, TEMP::Map* temp_map)
+{
+  AS::InstrList* pre_head = new AS::InstrList(nullptr, il);
+  AS::InstrList* pre = pre_head;
+  // register -> slot whose value it holds
+  std::map<const std::string*, int> holds;
+  int swept = 0;
+  for (; il; il = il->tail) {
+    AS::Instr* instr = il->head;
+    auto ref = slot_refs.find((AS::OperInstr*)instr);
+    if (instr->kind == AS::Instr::OPER && ref != slot_refs.end()) {
+      AS::OperInstr* oper = (AS::OperInstr*)instr;
+      int slot = ref->second.slot;
+      if (ref->second.store) {
+        for (auto it = holds.begin(); it != holds.end();)
+          it = it->second == slot ? holds.erase(it) : std::next(it);
+        holds[temp_map->Look(oper->src->head)] = slot;
+      } else {
+        const std::string* reg = temp_map->Look(oper->dst->head);
+        auto it = holds.find(reg);
+        if (it != holds.end() && it->second == slot) {
+          pre->tail = il->tail;
+          swept++;
+          continue;
+        }
+        holds[reg] = slot;
+      }
+    } else if (instr->kind == AS::Instr::LABEL
+        || (instr->kind == AS::Instr::OPER && (((AS::OperInstr*)instr)->jumps
+            || ((AS::OperInstr*)instr)->assem.compare(0, 5, "callq") == 0))) {
+      holds.clear();
+    } else {
+      TL* defs = instr->kind == AS::Instr::OPER
+        ? ((AS::OperInstr*)instr)->dst : ((AS::MoveInstr*)instr)->dst;
+      for (; defs; defs = defs->tail)
+        holds.erase(temp_map->Look(defs->head));
+    }
+    pre = il;
+  }
+  if (swept)
+    std::cout << "Swept " << swept << " redundant reloads" << std::endl;
+  return pre_head->tail;
+}
+
+// give every spill slot a frame offset
+// slots that are never live at the same time share one offset
+void packSpillSlots(F::Frame* f, AS::InstrList* il)
+{
+  if (slot_count == 0)
+    return;
+
+  // liveness of slots: a store defines it, a load uses it
+  FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
+  std::map<FG::InstrNode*, std::set<int>> live_in, live_out;
+  bool changed;
+  do {
+    changed = false;
+    for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail) {
+      FG::InstrNode* n = nl->head;
+      std::set<int> out;
+      for (auto succ = n->Succ(); succ; succ = succ->tail)
+        out.insert(live_in[succ->head].begin(), live_in[succ->head].end());
+      std::set<int> in = out;
+      auto ref = slot_refs.find((AS::OperInstr*)n->NodeInfo());
+      if (ref != slot_refs.end()) {
+        if (ref->second.store)
+          in.erase(ref->second.slot);
+        else
+          in.insert(ref->second.slot);
+      }
+      if (in != live_in[n] || out != live_out[n]) {
+        live_in[n] = in;
+        live_out[n] = out;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  // a slot interferes with everything live after a store to it
+  std::vector<std::set<int>> adj(slot_count);
+  std::vector<int> weight(slot_count, 0);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail) {
+    auto ref = slot_refs.find((AS::OperInstr*)nl->head->NodeInfo());
+    if (ref == slot_refs.end())
+      continue;
+    int s = ref->second.slot;
+    weight[s]++;
+    if (ref->second.store)
+      for (int t : live_out[nl->head])
+        if (t != s) {
+          adj[s].insert(t);
+          adj[t].insert(s);
+        }
+  }
+
+  // color greedily, most referenced slots first
+  std::vector<int> order;
+  for (int s = 0; s < slot_count; s++)
+    order.push_back(s);
+  std::stable_sort(order.begin(), order.end(),
+      [&weight](int a, int b) { return weight[a] > weight[b]; });
+  std::vector<int> color(slot_count, -1);
+  int color_count = 0;
+  for (int s : order) {
+    std::set<int> used;
+    for (int t : adj[s])
+      used.insert(color[t]);
+    int c = 0;
+    while (used.find(c) != used.end())
+      c++;
+    color[s] = c;
+    color_count = std::max(color_count, c + 1);
+  }
+
+  // low colors hold the hot slots, allocate them last so that they end up
+  // closest to %rsp and get the shortest displacements
+  std::vector<int> offset(color_count);
+  for (int c = color_count - 1; c >= 0; c--)
+    offset[c] = ((F::InFrameAccess*)f->allocSpace(TR::word_size))->offset;
+  std::cout << "Packed " << slot_count << " spill slots into " << color_count << std::endl;
+
+  for (auto& it : slot_refs) {
+    int o = offset[color[it.second.slot]];
+    it.first->assem = it.second.store
+      ? CG::get_x8664_movq_mem_offset_fp(o, f)
+      : CG::get_x8664_movq_temp_offset_fp(o, f);
+  }
+}
+
+// clean up after a successful coloring
+Result finish(F::Frame* f, AS::InstrList* il, TEMP::Map* coloring, int iterations)
+{
+  // layer the colormap
+  TEMP::Map* result_map = TEMP::Map::LayerMap(coloring, F::X64Frame::getTempMap());
+  // remove all unnecessary move insts
+  int moves = countMoves(il);
+  il = sweepMove(il, result_map);
+  std::cout << "Residual moves in " << f->label->Name() << ": "
+    << countMoves(il) << " of " << moves << std::endl;
+  il = sweepReload(il, result_map);
+  packSpillSlots(f, il);
+  std::cout << "RegAlloc iterations for " << f->label->Name() << ": " << iterations << std::endl;
+  return Result(result_map, il);
+}
+
 Result RegAlloc(F::Frame* f, AS::InstrList* il)
 {
   // lab6: real stuff
+  slot_refs.clear();
+  slot_count = 0;
+  bool split = false;
+  int iterations = 0;
+  if (allocator == CHORDAL) {
+    // spill everything at once, the rest is colored without another round
+    TL* spills = CH::Spills(f, il);
+    if (spills)
+      il = rewriteProgram(f, il, spills);
+    TEMP::Map* coloring = TEMP::Map::Empty();
+    AS::InstrList* ssa_il = CH::Allocate(f, il, coloring);
+    if (ssa_il)
+      return finish(f, ssa_il, coloring, 1);
+    std::cout << "Chordal coloring failed for " << f->label->Name()
+      << ", falling back to graph coloring" << std::endl;
+    iterations++;
+  }
+  // liveness carried over between rounds, spilling only removes the
+  // spilled temps and adds temps that are local to the new loads & stores
+  LIVE::LiveOutCache live_out;
   do {
+    iterations++;
     // do actual color assignment
     FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
     // showInterference(stdout, live_result);
-    COL::Result col_result = COL::Color(flow_graph);
-    if (col_result.spills != nullptr) {
+    COL::Result col_result = allocator == LINEAR_SCAN
+      ? LS::Allocate(flow_graph) : COL::Color(flow_graph, &live_out);
+    if (col_result.spills != nullptr && !split && allocator != LINEAR_SCAN) {
+      // split live ranges first, then spill whatever still doesn't fit
+      // linear scan has no coalescing to drop the copies again
+      il = splitLiveRanges(f, il);
+      split = true;
+      live_out.clear();
+    }
+    else if (col_result.spills != nullptr) {
+      for (auto& it : live_out)
+        for (TL* t = col_result.spills; t; t = t->tail)
+          it.second.erase(t->head);
       il = rewriteProgram(f, il, col_result.spills);
       std::cout << "Rewritten program:" << std::endl;
       il->Print(stdout, F::X64Frame::getTempMap());
     }
-    else {
-      // layer the colormap
-      TEMP::Map* result_map = TEMP::Map::LayerMap(col_result.coloring, F::X64Frame::getTempMap());
-      // remove all unnecessary move insts
-      il = sweepMove(il, result_map);
-      return Result(result_map, il);
-    }
+    else
+      return finish(f, il, col_result.coloring, iterations);
   } while (1);
 }
 
@@ -7,6 +7,7 @@
 #include "tiger/liveness/flowgraph.h"
 #include "tiger/liveness/liveness.h"
 #include "tiger/regalloc/color.h"
+#include "tiger/regalloc/linearscan.h"
 #include "tiger/util/graph.h"
 #include "tiger/frame/x64frame.h"
 #include <set>
@@ -21,9 +22,13 @@ class Result {
     :coloring(c), il(i) {}
 };
 
+// which allocator RegAlloc uses, graph coloring unless told otherwise
+enum Allocator { GRAPH_COLORING, LINEAR_SCAN, CHORDAL };
+extern Allocator allocator;
+
 std::set<TEMP::Temp *> *getSpilledTemps(AS::InstrList *);
 
-AS::InstrList *rewriteProgram(F::Frame *, AS::InstrList *, std::set<TEMP::Temp *> *);
+AS::InstrList *rewriteProgram(F::Frame *, AS::InstrList *, TEMP::TempList *);
 
 Result RegAlloc(F::Frame* f, AS::InstrList* il);
 
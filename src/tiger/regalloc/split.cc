@@ -0,0 +1,256 @@
+#include "tiger/regalloc/split.h"
+#include "tiger/frame/x64frame.h"
+#include "tiger/liveness/flowgraph.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace RA {
+
+namespace {
+
+typedef TEMP::TempList TL;
+typedef std::set<TEMP::Temp*> TempSet;
+
+inline bool isVirtual(TEMP::Temp* t)
+{
+  return F::X64Frame::getTempMap()->Look(t) == nullptr;
+}
+
+inline bool isJump(AS::Instr* instr)
+{
+  return instr->kind == AS::Instr::OPER && ((AS::OperInstr*)instr)->jumps;
+}
+
+inline bool isUncondJump(AS::Instr* instr)
+{
+  return isJump(instr) && ((AS::OperInstr*)instr)->assem.compare(0, 3, "jmp") == 0;
+}
+
+inline bool isCall(AS::Instr* instr)
+{
+  return instr->kind == AS::Instr::OPER
+    && ((AS::OperInstr*)instr)->assem.compare(0, 5, "callq") == 0;
+}
+
+inline AS::Instr* copy(TEMP::Temp* dst, TEMP::Temp* src)
+{
+  return new AS::MoveInstr(CG::get_x8664_movq_temp(), new TL(dst, nullptr), new TL(src, nullptr));
+}
+
+// live-in sets of virtual temps, indexed by Key()
+std::vector<TempSet> liveIn(std::vector<FG::InstrNode*>& node)
+{
+  int n = node.size();
+  std::vector<TempSet> in(n);
+  bool changed;
+  do {
+    changed = false;
+    for (int p = n - 1; p >= 0; p--) {
+      TempSet s;
+      for (auto succ = node[p]->Succ(); succ; succ = succ->tail)
+        s.insert(in[succ->head->Key()].begin(), in[succ->head->Key()].end());
+      for (auto t = FG::Def(node[p]); t; t = t->tail)
+        s.erase(t->head);
+      for (auto t = FG::Use(node[p]); t; t = t->tail)
+        if (isVirtual(t->head))
+          s.insert(t->head);
+      if (s != in[p]) {
+        in[p].swap(s);
+        changed = true;
+      }
+    }
+  } while (changed);
+  return in;
+}
+
+std::vector<FG::InstrNode*> nodesOf(FG::FlowGraph* flow_graph)
+{
+  std::vector<FG::InstrNode*> node(flow_graph->nodecount);
+  for (auto nl = flow_graph->Nodes(); nl; nl = nl->tail)
+    node[nl->head->Key()] = nl->head;
+  return node;
+}
+
+// deepest loop nesting each temp is referenced at
+std::map<TEMP::Temp*, int> refDepth(std::vector<FG::InstrNode*>& node, std::vector<int>& depth)
+{
+  std::map<TEMP::Temp*, int> ref_depth;
+  for (int p = 0; p < (int)node.size(); p++) {
+    for (auto t = FG::Use(node[p]); t; t = t->tail)
+      ref_depth[t->head] = std::max(ref_depth[t->head], depth[p]);
+    for (auto t = FG::Def(node[p]); t; t = t->tail)
+      ref_depth[t->head] = std::max(ref_depth[t->head], depth[p]);
+  }
+  return ref_depth;
+}
+
+}  // namespace
+
+void insertOnEdge(AS::InstrList* il, AS::Instr* from, AS::Instr* to,
+    std::vector<AS::Instr*>& copies)
+{
+  AS::InstrList* at = il;
+  while (at->head != from)
+    at = at->tail;
+  if (isJump(from) && to->kind == AS::Instr::LABEL) {
+    AS::OperInstr* jump = (AS::OperInstr*)from;
+    TEMP::Label* target = ((AS::LabelInstr*)to)->label;
+    bool redirected = false;
+    TEMP::LabelList* prehead = new TEMP::LabelList(nullptr, nullptr);
+    TEMP::LabelList* tail = prehead;
+    TEMP::Label* pad = TEMP::NewLabel();
+    for (auto l = jump->jumps->labels; l; l = l->tail) {
+      redirected |= l->head == target;
+      tail = tail->tail = new TEMP::LabelList(l->head == target ? pad : l->head, nullptr);
+    }
+    if (redirected) {
+      jump->jumps = new AS::Targets(prehead->tail);
+      // nothing falls into the code right after an unconditional jump
+      AS::InstrList* hole = at;
+      if (!isUncondJump(from)) {
+        hole = il;
+        while (hole->tail && !isUncondJump(hole->head))
+          hole = hole->tail;
+      }
+      AS::InstrList* rest = hole->tail;
+      // none in the body, the pad goes at the end with a jump around it
+      // for the code that runs off into the epilogue
+      TEMP::Label* skip = nullptr;
+      if (!isUncondJump(hole->head)) {
+        skip = TEMP::NewLabel();
+        hole = hole->tail = new AS::InstrList(new AS::OperInstr(CG::get_x8664_jump(), nullptr,
+            nullptr, new AS::Targets(new TEMP::LabelList(skip, nullptr))), nullptr);
+      }
+      hole = hole->tail = new AS::InstrList(new AS::LabelInstr(pad->Name(), pad), nullptr);
+      for (AS::Instr* c : copies)
+        hole = hole->tail = new AS::InstrList(c, nullptr);
+      hole = hole->tail = new AS::InstrList(new AS::OperInstr(CG::get_x8664_jump(), nullptr,
+          nullptr, new AS::Targets(new TEMP::LabelList(target, nullptr))), rest);
+      if (skip)
+        hole->tail = new AS::InstrList(new AS::LabelInstr(skip->Name(), skip), nullptr);
+    }
+  }
+  if (!isUncondJump(from) && at->tail && at->tail->head == to)
+    for (AS::Instr* c : copies)
+      at = at->tail = new AS::InstrList(c, at->tail);
+}
+
+namespace {
+
+// rename temps live through loops without being referenced in them
+void splitLoops(F::Frame* f, AS::InstrList* il)
+{
+  FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
+  std::vector<FG::InstrNode*> node = nodesOf(flow_graph);
+  std::vector<TempSet> live_in = liveIn(node);
+  std::vector<int> depth = FG::LoopDepth(flow_graph);
+  std::map<TEMP::Temp*, int> ref_depth = refDepth(node, depth);
+  std::map<std::pair<AS::Instr*, AS::Instr*>, std::vector<AS::Instr*>> edges;
+  TempSet renamed;
+
+  for (auto& loop : FG::Loops(flow_graph)) {
+    TempSet referenced;
+    for (int p = 0; p < (int)node.size(); p++) {
+      if (!loop.body[p])
+        continue;
+      for (auto t = FG::Use(node[p]); t; t = t->tail)
+        referenced.insert(t->head);
+      for (auto t = FG::Def(node[p]); t; t = t->tail)
+        referenced.insert(t->head);
+    }
+    // a temp is renamed in one loop at most, inner loops go first
+    // one that is only referenced in colder code is as cheap to spill whole
+    std::map<TEMP::Temp*, TEMP::Temp*> name;
+    for (TEMP::Temp* t : live_in[loop.header])
+      if (referenced.find(t) == referenced.end() && renamed.find(t) == renamed.end()
+          && ref_depth[t] >= depth[loop.header])
+        name[t] = TEMP::Temp::NewTemp();
+    if (name.empty())
+      continue;
+
+    for (auto pred = node[loop.header]->Pred(); pred; pred = pred->tail)
+      if (!loop.body[pred->head->Key()])
+        for (auto& it : name)
+          edges[{pred->head->NodeInfo(), node[loop.header]->NodeInfo()}]
+            .push_back(copy(it.second, it.first));
+    for (int p = 0; p < (int)node.size(); p++) {
+      if (!loop.body[p])
+        continue;
+      for (auto succ = node[p]->Succ(); succ; succ = succ->tail) {
+        int s = succ->head->Key();
+        if (loop.body[s])
+          continue;
+        for (auto& it : name)
+          if (live_in[s].find(it.first) != live_in[s].end())
+            edges[{node[p]->NodeInfo(), node[s]->NodeInfo()}]
+              .push_back(copy(it.first, it.second));
+      }
+    }
+    for (auto& it : name) {
+      std::cout << "Split t" << it.first->Int() << " around loop as t" << it.second->Int() << std::endl;
+      renamed.insert(it.first);
+    }
+  }
+  for (auto& e : edges)
+    insertOnEdge(il, e.first.first, e.first.second, e.second);
+}
+
+// rename temps around calls that are colder than their other references
+void splitCalls(F::Frame* f, AS::InstrList* il)
+{
+  FG::FlowGraph* flow_graph = FG::AssemFlowGraph(il, f);
+  std::vector<FG::InstrNode*> node = nodesOf(flow_graph);
+  std::vector<TempSet> live_in = liveIn(node);
+  std::vector<int> depth = FG::LoopDepth(flow_graph);
+  std::map<TEMP::Temp*, int> ref_depth = refDepth(node, depth);
+
+  for (AS::InstrList* l = il; l; l = l->tail) {
+    if (!isCall(l->head))
+      continue;
+    int p = 0;
+    while (node[p]->NodeInfo() != l->head)
+      p++;
+    // only worth it if the registers the call leaves alone can't hold
+    // them all
+    int preserved = F::X64Frame::gp_regs_count;
+    for (TL* d = ((AS::OperInstr*)l->head)->dst; d; d = d->tail)
+      preserved -= F::X64Frame::gp_regs.count(d->head);
+    TempSet live, across;
+    for (auto succ = node[p]->Succ(); succ; succ = succ->tail)
+      live.insert(live_in[succ->head->Key()].begin(), live_in[succ->head->Key()].end());
+    if ((int)live.size() <= preserved)
+      continue;
+    for (TEMP::Temp* t : live)
+      if (ref_depth[t] > depth[p])
+        across.insert(t);
+    if (across.empty())
+      continue;
+    // l->head is the call, it keeps its place
+    AS::Instr* call = l->head;
+    AS::InstrList* after = l->tail;
+    for (TEMP::Temp* t : across) {
+      TEMP::Temp* t2 = TEMP::Temp::NewTemp();
+      std::cout << "Split t" << t->Int() << " around call as t" << t2->Int() << std::endl;
+      l->head = copy(t2, t);
+      l = l->tail = new AS::InstrList(call, nullptr);
+      after = new AS::InstrList(copy(t, t2), after);
+    }
+    l->tail = after;
+    while (l->tail != after)
+      l = l->tail;
+  }
+}
+
+}  // namespace
+
+AS::InstrList* splitLiveRanges(F::Frame* f, AS::InstrList* il)
+{
+  splitLoops(f, il);
+  splitCalls(f, il);
+  return il;
+}
+
+}  // namespace RA
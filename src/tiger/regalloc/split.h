@@ -0,0 +1,28 @@
+#ifndef TIGER_REGALLOC_SPLIT_H_
+#define TIGER_REGALLOC_SPLIT_H_
+
+#include "tiger/codegen/assem.h"
+#include "tiger/frame/frame.h"
+#include <vector>
+
+namespace RA {
+
+// split live ranges by inserting copies, done once when the first
+// allocation attempt spills
+// - temps live through a loop but not referenced in it are renamed
+//   on the loop's entry & exit edges
+// - temps live across a call but referenced in a deeper loop are
+//   renamed around the call
+// so that the piece crossing the loop or call can be spilled or kept in
+// a callee-saved register alone; coalescing removes unneeded copies
+AS::InstrList *splitLiveRanges(F::Frame *f, AS::InstrList *il);
+
+// place copies on the flow edge from -> to
+// a fall-through edge gets them right after from, a jump is redirected
+// to a landing pad that does the copies and jumps on to the target
+void insertOnEdge(AS::InstrList *il, AS::Instr *from, AS::Instr *to,
+    std::vector<AS::Instr *> &copies);
+
+}  // namespace RA
+
+#endif
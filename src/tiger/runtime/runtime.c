@@ -5,13 +5,25 @@
 extern int tigermain();
 
 // bugfix: init should be long instead of int type
+// the length is kept in the word before the elements for the bounds checks
 long *initArray(int size, int init) {
   int i;
-  long *a = (long *)malloc(size * sizeof(long));
+  long *a;
+  if (size < 0) {
+    printf("array size %d is negative\n", size);
+    exit(1);
+  }
+  a = (long *)malloc((size + 1) * sizeof(long));
+  *a++ = size;
   for (i = 0; i < size; i++) a[i] = init;
   return a;
 }
 
+void outOfBounds(long i) {
+  printf("subscript %ld out of range\n", i);
+  exit(1);
+}
+
 int *allocRecord(int size) {
   int i;
   int *p, *a;
@@ -0,0 +1,673 @@
+#include "tiger/ssa/bounds.h"
+#include "tiger/frame/x64frame.h"
+#include "tiger/translate/translate.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+// sym + c, just c without a sym
+class Bound {
+ public:
+  TEMP::Temp *sym;
+  int c;
+};
+
+// a < b, what a condition says once it's taken
+class Fact {
+ public:
+  Bound a, b;
+};
+
+// a basic induction variable, the same step on every back edge
+class Induction {
+ public:
+  int pre;
+  TEMP::Temp *init;  // from the preheader
+  int step;
+  std::map<int, TEMP::Temp *> nexts;  // by the block of the back edge
+  std::vector<bool> body;  // of its loop
+  // or stepped by temps instead, the variable only goes up if they
+  // aren't negative
+  std::map<int, TEMP::Temp *> steps;
+};
+
+// a bounds check ending a block, index < length unsigned or else
+class Check {
+ public:
+  T::CjumpStm *jump;
+  Bound index, length;
+  TEMP::Temp *base;  // of the array
+};
+
+// how deep less looks for a proof
+const int depth_limit = 6;
+
+bool shift(Bound b, int k, Bound *r)
+{
+  r->sym = b.sym;
+  return T::fold(T::PLUS_OP, b.c, k, &r->c);
+}
+
+void replaceLast(T::StmList *block, T::Stm *stm)
+{
+  while (block->tail)
+    block = block->tail;
+  block->head = stm;
+}
+
+T::Stm *jumpTo(TEMP::Label *label)
+{
+  return new T::JumpStm(new T::NameExp(label), new TEMP::LabelList(label, nullptr));
+}
+
+class Eliminator {
+ public:
+  explicit Eliminator(Function *fn)
+    : fn(fn), init_array(F::X64Frame::runtimeLabel("initArray")) {}
+  void analyze();
+  int eliminate();
+  bool hoist(const Loop &loop);
+  int count();
+
+ private:
+  Function *fn;
+  TEMP::Label *init_array;
+  std::map<TEMP::Label *, int> block_of;
+  std::map<TEMP::Temp *, int> def_block;
+  std::map<TEMP::Temp *, T::Exp *> def_src;
+  std::map<TEMP::Temp *, Induction> ivs;
+  std::map<int, std::vector<Fact>> facts_at;
+  // stand-ins for the lengths of arrays, by the temp the array was
+  // allocated to & back
+  std::map<TEMP::Temp *, TEMP::Temp *> lengths, arrays;
+  std::set<TEMP::Temp *> expanding;  // inductions being bounded
+
+  bool form(T::Exp *exp, Bound *b, int depth = 0);
+  bool length(T::Exp *exp, Bound *b, TEMP::Temp **base);
+  const std::vector<Fact> &facts(int b);
+  bool less(Bound a, Bound b, int blk, int depth = depth_limit);
+  bool definedIn(TEMP::Temp *t, const std::vector<bool> &body);
+  bool check(int b, Check *c);
+  bool range(T::Exp *exp, int blk, int *lo, int *hi, int depth = depth_limit);
+  bool inRange(const Check &c, int b);
+  T::Exp *materialize(Bound b);
+};
+
+void Eliminator::analyze()
+{
+  block_of.clear();
+  def_block.clear();
+  def_src.clear();
+  ivs.clear();
+  facts_at.clear();
+  for (int b = 0; b < (int)fn->blocks.size(); b++)
+    if (fn->blocks[b])
+      block_of[LabelOf(fn->blocks[b])] = b;
+  for (int b : fn->preorder) {
+    for (Phi &phi : fn->phis[b])
+      def_block[phi.dst] = b;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (TEMP::Temp *d = Def(l->head)) {
+        def_block[d] = b;
+        def_src[d] = ((T::MoveStm *)l->head)->src;
+      }
+  }
+  for (Loop &loop : FindLoops(fn)) {
+    int pre = Preheader(fn, loop);
+    if (pre < 0)
+      continue;
+    for (Phi &phi : fn->phis[loop.header]) {
+      Induction iv{pre, nullptr, 0, {}, loop.body};
+      bool basic = true;
+      for (auto &src : phi.src) {
+        if (!loop.body[src.first]) {
+          iv.init = src.second;
+          continue;
+        }
+        // next = var + step, or var + a temp
+        auto it = def_src.find(src.second);
+        if (it == def_src.end() || it->second->kind != T::Exp::BINOP) {
+          basic = false;
+          break;
+        }
+        T::BinopExp *e = (T::BinopExp *)it->second;
+        Bound next;
+        if (iv.steps.empty() && form(e, &next) && next.sym == phi.dst && next.c != 0
+            && (iv.nexts.empty() || next.c == iv.step)) {
+          iv.step = next.c;
+          iv.nexts[src.first] = src.second;
+          continue;
+        }
+        T::Exp *var = e->left, *step = e->right;
+        if (step->kind == T::Exp::TEMP && ((T::TempExp *)step)->temp == phi.dst)
+          std::swap(var, step);
+        basic &= iv.nexts.empty() && e->op == T::PLUS_OP && var->kind == T::Exp::TEMP
+          && ((T::TempExp *)var)->temp == phi.dst && step->kind == T::Exp::TEMP;
+        if (!basic)
+          break;
+        iv.steps[src.first] = ((T::TempExp *)step)->temp;
+      }
+      if (basic && iv.init && (!iv.nexts.empty() || !iv.steps.empty()))
+        ivs[phi.dst] = iv;
+    }
+  }
+}
+
+// a temp plus or minus a constant, followed through the moves of virtual
+// temps
+// loads stay temps of their own, what's in memory may change
+bool Eliminator::form(T::Exp *exp, Bound *b, int depth)
+{
+  switch (exp->kind) {
+  case T::Exp::CONST:
+    *b = Bound{nullptr, ((T::ConstExp *)exp)->consti};
+    return true;
+  case T::Exp::TEMP: {
+    TEMP::Temp *t = ((T::TempExp *)exp)->temp;
+    if (!IsVirtual(t))
+      return false;
+    auto it = def_src.find(t);
+    if (depth < 16 && it != def_src.end() && form(it->second, b, depth + 1))
+      return true;
+    *b = Bound{t, 0};
+    return true;
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    T::Exp *var = e->left, *c = e->right;
+    if (e->op == T::PLUS_OP && var->kind == T::Exp::CONST)
+      std::swap(var, c);
+    if ((e->op != T::PLUS_OP && e->op != T::MINUS_OP) || c->kind != T::Exp::CONST)
+      return false;
+    int k = ((T::ConstExp *)c)->consti;
+    Bound v;
+    return (e->op == T::PLUS_OP || T::fold(T::MINUS_OP, 0, k, &k))
+      && form(var, &v, depth + 1) && shift(v, k, b);
+  }
+  default:
+    return false;
+  }
+}
+
+// the word before the elements of an array, compared with in the checks
+// arrays never change their length, it's the size an array was allocated
+// with if that's known
+bool Eliminator::length(T::Exp *exp, Bound *b, TEMP::Temp **base)
+{
+  if (exp->kind == T::Exp::TEMP) {
+    auto it = def_src.find(((T::TempExp *)exp)->temp);
+    if (it == def_src.end())
+      return false;
+    exp = it->second;
+  }
+  if (exp->kind != T::Exp::MEM || ((T::MemExp *)exp)->exp->kind != T::Exp::BINOP)
+    return false;
+  T::BinopExp *addr = (T::BinopExp *)((T::MemExp *)exp)->exp;
+  if (addr->op != T::PLUS_OP || addr->left->kind != T::Exp::TEMP
+      || addr->right->kind != T::Exp::CONST
+      || ((T::ConstExp *)addr->right)->consti != -(int)TR::word_size)
+    return false;
+  TEMP::Temp *array = ((T::TempExp *)addr->left)->temp;
+  if (!IsVirtual(array))
+    return false;
+  if (base)
+    *base = array;
+  for (auto it = def_src.find(array); it != def_src.end() && it->second->kind == T::Exp::TEMP
+       && IsVirtual(((T::TempExp *)it->second)->temp); it = def_src.find(array))
+    array = ((T::TempExp *)it->second)->temp;
+  auto it = def_src.find(array);
+  if (it != def_src.end() && it->second->kind == T::Exp::CALL) {
+    T::CallExp *call = (T::CallExp *)it->second;
+    if (call->fun->kind == T::Exp::NAME && ((T::NameExp *)call->fun)->name == init_array
+        && call->args && form(call->args->head, b))
+      return true;
+  }
+  TEMP::Temp *&stand_in = lengths[array];
+  if (!stand_in) {
+    stand_in = TEMP::Temp::NewTemp();
+    arrays[stand_in] = array;
+  }
+  *b = Bound{stand_in, 0};
+  return true;
+}
+
+// the conditions of the jumps into the dominators of a block
+const std::vector<Fact> &Eliminator::facts(int b)
+{
+  auto cached = facts_at.find(b);
+  if (cached != facts_at.end())
+    return cached->second;
+  std::vector<Fact> &fs = facts_at[b];
+  for (int d = b; fn->idom[d] != d; d = fn->idom[d]) {
+    if (fn->pred[d].size() != 1)
+      continue;
+    T::Stm *last = LastOf(fn->blocks[fn->pred[d][0]]);
+    if (last->kind != T::Stm::CJUMP)
+      continue;
+    T::CjumpStm *s = (T::CjumpStm *)last;
+    if (s->true_label == s->false_label)
+      continue;
+    T::RelOp op = LabelOf(fn->blocks[d]) == s->true_label ? s->op : T::notRel(s->op);
+    // lengths aren't negative, an index below one unsigned is in range
+    Bound l, r, k;
+    bool unsign = op == T::ULT_OP || op == T::UGE_OP;
+    if (!form(s->left, &l) || !(unsign ? length(s->right, &r, nullptr) : form(s->right, &r)))
+      continue;
+    switch (op) {
+    case T::LT_OP:
+      fs.push_back(Fact{l, r});
+      break;
+    case T::GT_OP:
+      fs.push_back(Fact{r, l});
+      break;
+    case T::EQ_OP:
+    case T::LE_OP:
+      if (shift(r, 1, &k))
+        fs.push_back(Fact{l, k});
+      if (op == T::LE_OP)
+        break;
+      // fall through, l == r gives r < l + 1 too
+    case T::GE_OP:
+      if (shift(l, 1, &k))
+        fs.push_back(Fact{r, k});
+      break;
+    case T::ULT_OP:
+      fs.push_back(Fact{l, r});
+      fs.push_back(Fact{Bound{nullptr, -1}, l});
+      break;
+    default:
+      break;
+    }
+  }
+  return fs;
+}
+
+// whether a < b in a block, from what's known there & about the values an
+// induction variable takes
+bool Eliminator::less(Bound a, Bound b, int blk, int depth)
+{
+  if (a.sym == b.sym)
+    return a.c < b.c;
+  if (depth == 0)
+    return false;
+  for (const Fact &f : facts(blk)) {
+    Bound m;
+    int k;
+    // a <= f.b + a.c - f.a.c - 1
+    if (f.a.sym == a.sym && T::fold(T::MINUS_OP, a.c, f.a.c, &k) && T::fold(T::MINUS_OP, k, 1, &k)
+        && shift(f.b, k, &m) && less(m, b, blk, depth - 1))
+      return true;
+    // b >= f.a + b.c - f.b.c + 1
+    if (f.b.sym == b.sym && T::fold(T::MINUS_OP, b.c, f.b.c, &k) && T::fold(T::PLUS_OP, k, 1, &k)
+        && shift(f.a, k, &m) && less(a, m, blk, depth - 1))
+      return true;
+  }
+
+  // from where it starts up to where the back edges take it when counting
+  // up, bounded by where it starts counting down
+  auto iv = ivs.find(a.sym);
+  if (iv != ivs.end() && iv->second.steps.empty() && !expanding.count(a.sym)
+      && (!b.sym || !definedIn(b.sym, iv->second.body))) {
+    Induction &v = iv->second;
+    T::TempExp start(v.init);
+    Bound init, next{a.sym, 0};
+    bool bounded = form(&start, &init) && shift(init, a.c, &init)
+      && T::fold(T::PLUS_OP, a.c, v.step, &next.c);
+    expanding.insert(a.sym);
+    bounded = bounded && less(init, b, v.pre, depth - 1);
+    if (v.step > 0)
+      for (auto &it : v.nexts)
+        bounded = bounded && less(next, b, it.first, depth - 1);
+    expanding.erase(a.sym);
+    if (bounded)
+      return true;
+  }
+  iv = ivs.find(b.sym);
+  if (iv != ivs.end() && !expanding.count(b.sym)
+      && (!a.sym || !definedIn(a.sym, iv->second.body))) {
+    Induction &v = iv->second;
+    T::TempExp start(v.init);
+    Bound init, next{b.sym, 0};
+    bool bounded = form(&start, &init) && shift(init, b.c, &init)
+      && T::fold(T::PLUS_OP, b.c, v.step, &next.c);
+    expanding.insert(b.sym);
+    bounded = bounded && less(a, init, v.pre, depth - 1);
+    if (v.step < 0)
+      for (auto &it : v.nexts)
+        bounded = bounded && less(a, next, it.first, depth - 1);
+    for (auto &it : v.steps) {
+      T::TempExp step(it.second);
+      Bound k;
+      bounded = bounded && form(&step, &k) && less(Bound{nullptr, -1}, k, it.first, depth - 1);
+    }
+    expanding.erase(b.sym);
+    if (bounded)
+      return true;
+  }
+
+  // a constant against what's computed from counters with constant limits
+  int lo, hi;
+  if (depth > 1 && !a.sym && b.sym && !arrays.count(b.sym)) {
+    T::TempExp t(b.sym);
+    return range(&t, blk, &lo, &hi, depth - 1) && (long)a.c - b.c < lo;
+  }
+  if (depth > 1 && a.sym && !b.sym && !arrays.count(a.sym)) {
+    T::TempExp t(a.sym);
+    return range(&t, blk, &lo, &hi, depth - 1) && hi < (long)b.c - a.c;
+  }
+  return false;
+}
+
+bool Eliminator::definedIn(TEMP::Temp *t, const std::vector<bool> &body)
+{
+  auto array = arrays.find(t);
+  if (array != arrays.end())
+    t = array->second;
+  auto it = def_block.find(t);
+  return it == def_block.end() || body[it->second];
+}
+
+bool Eliminator::check(int b, Check *c)
+{
+  T::Stm *last = LastOf(fn->blocks[b]);
+  if (last->kind != T::Stm::CJUMP)
+    return false;
+  c->jump = (T::CjumpStm *)last;
+  auto bad = block_of.find(c->jump->true_label);
+  return c->jump->op == T::UGE_OP && bad != block_of.end() && NoReturn(fn->blocks[bad->second])
+    && form(c->jump->left, &c->index) && length(c->jump->right, &c->length, &c->base);
+}
+
+int Eliminator::count()
+{
+  int checks = 0;
+  Check c;
+  for (int b : fn->preorder)
+    checks += check(b, &c);
+  return checks;
+}
+
+// constant bounds on an expression in a block, for subscripts computed
+// from counters with constant limits, as a row * columns + column
+bool Eliminator::range(T::Exp *exp, int blk, int *lo, int *hi, int depth)
+{
+  Bound b;
+  bool linear = form(exp, &b);
+  if (linear && !b.sym) {
+    *lo = *hi = b.c;
+    return true;
+  }
+  if (depth == 0)
+    return false;
+  switch (exp->kind) {
+  case T::Exp::TEMP: {
+    auto iv = linear ? ivs.find(b.sym) : ivs.end();
+    if (iv == ivs.end() || !iv->second.steps.empty()) {
+      auto it = def_src.find(((T::TempExp *)exp)->temp);
+      return it != def_src.end() && range(it->second, blk, lo, hi, depth);
+    }
+    // where it starts on one side, the other from the tests of the back
+    // edges, the closest on each
+    Induction &v = iv->second;
+    T::TempExp start(v.init);
+    Bound init;
+    if (!form(&start, &init) || init.sym)
+      return false;
+    int l = init.c, h = init.c;
+    for (auto &it : v.nexts) {
+      bool found = false;
+      int closest = 0;
+      for (const Fact &f : facts(it.first)) {
+        int k;
+        if (v.step > 0 && f.a.sym == b.sym && !f.b.sym && T::fold(T::MINUS_OP, f.b.c, f.a.c, &k)
+            && T::fold(T::PLUS_OP, k, v.step - 1, &k)) {
+          closest = found ? std::min(closest, k) : k;
+          found = true;
+        }
+        if (v.step < 0 && f.b.sym == b.sym && !f.a.sym && T::fold(T::MINUS_OP, f.a.c, f.b.c, &k)
+            && T::fold(T::PLUS_OP, k, v.step + 1, &k)) {
+          closest = found ? std::max(closest, k) : k;
+          found = true;
+        }
+      }
+      if (!found)
+        return false;
+      h = std::max(h, closest);
+      l = std::min(l, closest);
+    }
+    Bound below{nullptr, 0}, above{nullptr, 0};
+    if (!T::fold(T::MINUS_OP, l, 1, &below.c) || !T::fold(T::PLUS_OP, h, 1, &above.c)
+        || !less(below, Bound{b.sym, 0}, blk, depth - 1)
+        || !less(Bound{b.sym, 0}, above, blk, depth - 1))
+      return false;
+    return T::fold(T::PLUS_OP, l, b.c, lo) && T::fold(T::PLUS_OP, h, b.c, hi);
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    int l1, h1, l2, h2;
+    if (!range(e->left, blk, &l1, &h1, depth) || !range(e->right, blk, &l2, &h2, depth))
+      return false;
+    switch (e->op) {
+    case T::PLUS_OP:
+      return T::fold(T::PLUS_OP, l1, l2, lo) && T::fold(T::PLUS_OP, h1, h2, hi);
+    case T::MINUS_OP:
+      return T::fold(T::MINUS_OP, l1, h2, lo) && T::fold(T::MINUS_OP, h1, l2, hi);
+    case T::MUL_OP: {
+      // by a constant
+      if (l1 == h1) {
+        std::swap(l1, l2);
+        std::swap(h1, h2);
+      }
+      if (l2 != h2 || !T::fold(T::MUL_OP, l1, l2, lo) || !T::fold(T::MUL_OP, h1, l2, hi))
+        return false;
+      if (*lo > *hi)
+        std::swap(*lo, *hi);
+      return true;
+    }
+    default:
+      return false;
+    }
+  }
+  default:
+    return false;
+  }
+}
+
+// the subscript of a check is in range
+bool Eliminator::inRange(const Check &c, int b)
+{
+  if (less(Bound{nullptr, -1}, c.index, b) && less(c.index, c.length, b))
+    return true;
+  int lo, hi;
+  return !c.length.sym && range(c.jump->left, b, &lo, &hi) && lo >= 0 && hi < c.length.c;
+}
+
+int Eliminator::eliminate()
+{
+  int removed = 0;
+  for (int b : fn->preorder) {
+    Check c;
+    if (check(b, &c) && inRange(c, b)) {
+      replaceLast(fn->blocks[b], jumpTo(c.jump->false_label));
+      removed++;
+    }
+  }
+  if (removed)
+    Analyze(fn);
+  return removed;
+}
+
+T::Exp *Eliminator::materialize(Bound b)
+{
+  if (!b.sym)
+    return new T::ConstExp(b.c);
+  if (b.c == 0)
+    return new T::TempExp(b.sym);
+  return new T::BinopExp(T::PLUS_OP, new T::TempExp(b.sym), new T::ConstExp(b.c));
+}
+
+// one check of the loop done in its preheader instead
+// an invariant subscript is checked there as it is, one going with a
+// counter stepped by one from its first value to its last, the last being
+// what the only exit test leaves the loop at, if the check comes before
+// that test on every trip
+// the preheader's checks run in the order they're found, so with several
+// hoisted from one loop the runtime may report a subscript other than the
+// one the loop would have failed on first, and none of the loop's trips
+// run before it
+bool Eliminator::hoist(const Loop &loop)
+{
+  int pre = Preheader(fn, loop);
+  if (pre < 0)
+    return false;
+  int exit = -1;
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (!loop.body[b])
+      continue;
+    bool exits = fn->succ[b].empty();
+    for (int s : fn->succ[b])
+      exits |= !loop.body[s] && !NoReturn(fn->blocks[s]);
+    if (exits) {
+      if (exit >= 0)
+        return false;
+      exit = b;
+    }
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      T::Stm *stm = l->head;
+      T::Exp *exp = nullptr;
+      if (stm->kind == T::Stm::MOVE)
+        exp = ((T::MoveStm *)stm)->src;
+      else if (stm->kind == T::Stm::EXP)
+        exp = ((T::ExpStm *)stm)->exp;
+      if (exp && exp->kind == T::Exp::CALL) {
+        T::Exp *fun = ((T::CallExp *)exp)->fun;
+        if (fun->kind != T::Exp::NAME || !F::X64Frame::isPure(((T::NameExp *)fun)->name))
+          return false;
+      }
+    }
+  }
+  if (exit < 0)
+    return false;
+  for (int p : fn->pred[loop.header])
+    if (loop.body[p] && !fn->dominates(exit, p))
+      return false;
+
+  // the counter the loop stays in while counter + off < limit
+  T::Stm *last = LastOf(fn->blocks[exit]);
+  if (last->kind != T::Stm::CJUMP)
+    return false;
+  T::CjumpStm *test = (T::CjumpStm *)last;
+  auto in = block_of.find(test->true_label);
+  T::RelOp op = in != block_of.end() && loop.body[in->second] ? test->op : T::notRel(test->op);
+  Bound counter, limit;
+  if ((op != T::LT_OP && op != T::LE_OP) || !form(test->left, &counter)
+      || !form(test->right, &limit) || (limit.sym && definedIn(limit.sym, loop.body))
+      || arrays.count(limit.sym))
+    return false;
+  auto iv = ivs.find(counter.sym);
+  bool counts = iv != ivs.end() && iv->second.step == 1 && iv->second.pre == pre
+    && loop.body[def_block[counter.sym]];
+  // the last value the check sees
+  Bound first, end;
+  T::TempExp start(counts ? iv->second.init : nullptr);
+  counts = counts && form(&start, &first)
+    && T::fold(T::MINUS_OP, op == T::LE_OP ? 1 : 0, counter.c, &counter.c)
+    && shift(limit, counter.c, &end) && !arrays.count(first.sym);
+  Bound after;
+  counts = counts && shift(end, 1, &after) && less(first, after, pre);
+
+  for (int b : fn->preorder) {
+    Check c;
+    if (!loop.body[b] || !fn->dominates(b, exit) || !check(b, &c)
+        || definedIn(c.base, loop.body))
+      continue;
+    std::vector<std::pair<T::Exp *, T::Exp *>> checks;  // subscript & what's reported
+    TEMP::Temp *len = TEMP::Temp::NewTemp();
+    std::vector<T::Stm *> moves{new T::MoveStm(new T::TempExp(len),
+      new T::MemExp(new T::BinopExp(T::PLUS_OP, new T::TempExp(c.base),
+        new T::ConstExp(-(int)TR::word_size))))};
+    if (!c.index.sym || !definedIn(c.index.sym, loop.body)) {
+      if (arrays.count(c.index.sym))
+        continue;
+      TEMP::Temp *index = TEMP::Temp::NewTemp();
+      moves.push_back(new T::MoveStm(new T::TempExp(index), materialize(c.index)));
+      checks.push_back({new T::TempExp(index), new T::TempExp(index)});
+    } else if (counts && c.index.sym == counter.sym) {
+      Bound lo, hi;
+      if (!shift(first, c.index.c, &lo) || !shift(end, c.index.c, &hi))
+        continue;
+      // past the length, the first subscript out of range is the length
+      if (!less(Bound{nullptr, -1}, lo, pre) || !less(lo, c.length, pre)) {
+        TEMP::Temp *t = TEMP::Temp::NewTemp();
+        moves.push_back(new T::MoveStm(new T::TempExp(t), materialize(lo)));
+        checks.push_back({new T::TempExp(t), new T::TempExp(t)});
+      }
+      TEMP::Temp *t = TEMP::Temp::NewTemp();
+      moves.push_back(new T::MoveStm(new T::TempExp(t), materialize(hi)));
+      checks.push_back({new T::TempExp(t), new T::TempExp(len)});
+    } else {
+      continue;
+    }
+
+    T::StmList *at = fn->blocks[pre];
+    while (at->tail->tail)
+      at = at->tail;
+    T::StmList *jump = at->tail;
+    for (T::Stm *move : moves)
+      at = at->tail = new T::StmList(move, nullptr);
+    for (auto &it : checks) {
+      TEMP::Label *bad = TEMP::NewLabel(), *ok = TEMP::NewLabel();
+      at->tail = new T::StmList(new T::CjumpStm(T::UGE_OP, it.first, new T::TempExp(len), bad, ok), nullptr);
+      fn->blocks.push_back(new T::StmList(new T::LabelStm(bad),
+        new T::StmList(new T::ExpStm(new T::CallExp(
+          new T::NameExp(F::X64Frame::runtimeLabel("outOfBounds")), new T::ExpList(it.second, nullptr))),
+        new T::StmList(jumpTo(bad), nullptr))));
+      at = new T::StmList(new T::LabelStm(ok), nullptr);
+      fn->blocks.push_back(at);
+    }
+    at->tail = jump;
+    fn->phis.resize(fn->blocks.size());
+    int from = fn->blocks.size() - 1;
+    for (Phi &phi : fn->phis[loop.header]) {
+      phi.src[from] = phi.src[pre];
+      phi.src.erase(pre);
+    }
+    replaceLast(fn->blocks[b], jumpTo(c.jump->false_label));
+    Analyze(fn);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void EliminateBoundsChecks(Function *fn)
+{
+  Eliminator e(fn);
+  e.analyze();
+  int checks = e.count(), removed = e.eliminate(), hoisted = 0;
+  for (bool changed = true; changed;) {
+    changed = false;
+    e.analyze();
+    for (Loop &loop : FindLoops(fn))
+      if (e.hoist(loop)) {
+        hoisted++;
+        changed = true;
+        break;
+      }
+  }
+  // what's hoisted out of an inner loop may go for the checks before it
+  e.analyze();
+  removed += e.eliminate();
+  e.analyze();
+  std::cout << "BCE: " << removed << " of " << checks << " bounds checks removed, " << hoisted
+            << " hoisted out of loops, " << e.count() << " left" << std::endl;
+}
+
+}  // namespace SSA
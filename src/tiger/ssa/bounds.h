@@ -0,0 +1,22 @@
+#ifndef TIGER_SSA_BOUNDS_H_
+#define TIGER_SSA_BOUNDS_H_
+
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// bounds check elimination, on the checks SubscriptVar::Translate emits
+// a check goes if the conditions of the jumps on the way to it prove the
+// subscript in range, as a check with the same subscript & array before it
+// does, the range of a basic induction variable is where it starts & what
+// it's compared with on every back edge, the length of an array allocated
+// in the function is the size it was allocated with
+// a check in a loop on an invariant subscript, or on a counter stepped by
+// one, is done for the whole loop in its preheader instead, if the loop
+// only leaves by that counter's test, the check is on the way to it & only
+// memory would tell the loop had run before an error
+void EliminateBoundsChecks(Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_BOUNDS_H_
@@ -0,0 +1,196 @@
+#include "tiger/ssa/dce.h"
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+inline TEMP::Temp *tempOf(T::Exp **ref) { return ((T::TempExp *)*ref)->temp; }
+
+bool pure(T::Exp *exp)
+{
+  switch (exp->kind) {
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    // idivq traps on a zero divisor
+    if (e->op == T::DIV_OP
+        && (e->right->kind != T::Exp::CONST || ((T::ConstExp *)e->right)->consti == 0))
+      return false;
+    return pure(e->left) && pure(e->right);
+  }
+  case T::Exp::MEM:
+    return pure(((T::MemExp *)exp)->exp);
+  case T::Exp::TEMP:
+  case T::Exp::CONST:
+  case T::Exp::NAME:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// whether a statement can go if nothing needs what it defines
+bool removable(T::Stm *stm)
+{
+  if (stm->kind == T::Stm::EXP)
+    return pure(((T::ExpStm *)stm)->exp);
+  return Def(stm) && pure(((T::MoveStm *)stm)->src);
+}
+
+// mark what the statements that have to stay need, remove everything else
+int sweep(Function *fn)
+{
+  std::map<TEMP::Temp *, T::Stm *> def_stm;
+  std::map<TEMP::Temp *, Phi *> def_phi;
+  std::set<T::Stm *> needed;
+  std::set<TEMP::Temp *> live;
+  std::vector<TEMP::Temp *> work;
+  auto need = [&](T::Stm *stm) {
+    if (needed.insert(stm).second)
+      for (T::Exp **ref : Uses(stm))
+        work.push_back(tempOf(ref));
+  };
+  for (int b : fn->preorder) {
+    for (Phi &phi : fn->phis[b])
+      def_phi[phi.dst] = &phi;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (TEMP::Temp *d = Def(l->head))
+        def_stm[d] = l->head;
+  }
+  for (int b : fn->preorder)
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (!removable(l->head))
+        need(l->head);
+  while (!work.empty()) {
+    TEMP::Temp *t = work.back();
+    work.pop_back();
+    if (!live.insert(t).second)
+      continue;
+    auto s = def_stm.find(t);
+    if (s != def_stm.end()) {
+      need(s->second);
+      continue;
+    }
+    auto p = def_phi.find(t);
+    if (p != def_phi.end())
+      for (auto &src : p->second->src)
+        work.push_back(src.second);
+  }
+
+  int swept = 0;
+  for (int b : fn->preorder) {
+    std::vector<Phi> phis;
+    for (Phi &phi : fn->phis[b])
+      if (live.count(phi.dst))
+        phis.push_back(phi);
+    swept += fn->phis[b].size() - phis.size();
+    fn->phis[b].swap(phis);
+    for (T::StmList *l = fn->blocks[b]; l->tail;)
+      if (needed.count(l->tail->head)) {
+        l = l->tail;
+      } else {
+        l->tail = l->tail->tail;
+        swept++;
+      }
+  }
+  return swept;
+}
+
+// send the predecessors of a block that only jumps on straight to its
+// target, it can't be bypassed if that leaves a phi there with two sources
+// from the same block
+int bypass(Function *fn)
+{
+  int bypassed = 0;
+  for (int b = 1; b < (int)fn->blocks.size(); b++) {
+    T::StmList *block = fn->blocks[b];
+    if (!block || !fn->reachable(b) || !fn->phis[b].empty() || block->tail->tail
+        || block->tail->head->kind != T::Stm::JUMP)
+      continue;
+    T::JumpStm *jump = (T::JumpStm *)block->tail->head;
+    TEMP::Label *label = LabelOf(block), *target = jump->exp->name;
+    if (jump->jumps->tail || target == label)
+      continue;
+    int t = -1;
+    if (!fn->succ[b].empty())
+      t = fn->succ[b][0];
+    if (t >= 0 && !fn->phis[t].empty()) {
+      bool clash = false;
+      for (int p : fn->pred[b])
+        for (int q : fn->pred[t])
+          clash |= p == q;
+      if (clash)
+        continue;
+      for (Phi &phi : fn->phis[t]) {
+        TEMP::Temp *src = phi.src[b];
+        phi.src.erase(b);
+        for (int p : fn->pred[b])
+          phi.src[p] = src;
+      }
+    }
+    for (int p : fn->pred[b])
+      Retarget(LastOf(fn->blocks[p]), label, target);
+    bypassed++;
+    Analyze(fn);
+  }
+
+  // a conditional jump going the same way either way
+  for (int b : fn->preorder) {
+    T::StmList *last = fn->blocks[b];
+    while (last->tail)
+      last = last->tail;
+    if (last->head->kind != T::Stm::CJUMP)
+      continue;
+    T::CjumpStm *s = (T::CjumpStm *)last->head;
+    if (s->true_label != s->false_label)
+      continue;
+    last->head = new T::JumpStm(new T::NameExp(s->true_label), new TEMP::LabelList(s->true_label, nullptr));
+    bypassed++;
+  }
+  return bypassed;
+}
+
+int removeUnreachable(Function *fn)
+{
+  Analyze(fn);
+  int removed = 0;
+  for (int b = 0; b < (int)fn->blocks.size(); b++)
+    if (fn->blocks[b] && !fn->reachable(b)) {
+      fn->blocks[b] = nullptr;
+      fn->phis[b].clear();
+      removed++;
+    }
+  if (removed == 0)
+    return 0;
+  Analyze(fn);
+  for (int b : fn->preorder)
+    for (Phi &phi : fn->phis[b])
+      for (auto src = phi.src.begin(); src != phi.src.end();)
+        if (fn->reachable(src->first))
+          src++;
+        else
+          src = phi.src.erase(src);
+  return removed;
+}
+
+}  // namespace
+
+void EliminateDeadCode(Function *fn)
+{
+  int swept = 0, bypassed = 0, removed = 0;
+  bool changed;
+  do {
+    int s = sweep(fn), b = bypass(fn), r = removeUnreachable(fn);
+    swept += s;
+    bypassed += b;
+    removed += r;
+    changed = s || b || r;
+  } while (changed);
+  std::cout << "DCE: " << swept << " statements & phis removed, " << bypassed
+            << " jumps bypassed, " << removed << " blocks removed" << std::endl;
+}
+
+}  // namespace SSA
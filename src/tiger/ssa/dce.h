@@ -0,0 +1,18 @@
+#ifndef TIGER_SSA_DCE_H_
+#define TIGER_SSA_DCE_H_
+
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// dead code elimination, until nothing changes
+// moves & phis whose values are never needed go if computing them has no
+// side effects, loads included, divisions only by a nonzero constant
+// blocks with nothing but a jump are bypassed, conditional jumps with both
+// targets the same become jumps & blocks that can't be reached are removed
+// the control flow of fn is analyzed again afterwards
+void EliminateDeadCode(Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_DCE_H_
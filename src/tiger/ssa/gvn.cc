@@ -0,0 +1,367 @@
+#include "tiger/ssa/gvn.h"
+#include "tiger/frame/x64frame.h"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+// an expression with its operands replaced by their value numbers
+typedef std::tuple<int, intptr_t, int, int> Key;
+enum { CONST_KEY, NAME_KEY, BINOP_KEY, MEM_KEY };
+
+// a single instruction, or an address codegen folds into the instruction
+// using it, neither is worth a register of its own
+bool cheap(T::Exp *e)
+{
+  if (IsLeaf(e) || IsScaled(e) || IsIndexed(e))
+    return true;
+  if (e->kind != T::Exp::BINOP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)e;
+  if (IsLeaf(b->left) && IsLeaf(b->right))
+    return true;
+  if ((b->op == T::PLUS_OP || b->op == T::MINUS_OP) && b->right->kind == T::Exp::CONST)
+    return IsIndexed(b->left);
+  return b->op == T::PLUS_OP && b->left->kind == T::Exp::CONST && IsIndexed(b->right);
+}
+
+// operations in an expression
+int ops(T::Exp *e)
+{
+  if (e->kind == T::Exp::BINOP)
+    return 1 + ops(((T::BinopExp *)e)->left) + ops(((T::BinopExp *)e)->right);
+  if (e->kind == T::Exp::MEM)
+    return 1 + ops(((T::MemExp *)e)->exp);
+  return 0;
+}
+
+inline T::Exp *copyLeaf(T::Exp *e)
+{
+  if (e->kind == T::Exp::TEMP)
+    return new T::TempExp(((T::TempExp *)e)->temp);
+  return new T::ConstExp(((T::ConstExp *)e)->consti);
+}
+
+class Numberer {
+ public:
+  explicit Numberer(Function *fn) : fn(fn) { fp = vnOf(F::X64Frame::rbp); }
+  int run();
+
+ private:
+  // where an expression is available, either in a leaf or only nested in
+  // some statement yet
+  // loads also remember their address & when they were made
+  struct Avail {
+    int vn;
+    T::Exp *leaf;
+    T::Exp **ref;
+    int stamp;
+    int addr;  // -1 if not a load
+  };
+  // when the loads were last killed
+  struct Memory {
+    int all = 0, other = 0;
+    std::map<int, int> frame;  // by the address of the slot
+  };
+
+  Function *fn;
+  int next_vn = 0, clock = 0, eliminated = 0, fp;
+  std::map<Key, int> pure;
+  std::map<int, Key> key_of;
+  std::set<int> consts, frame_addrs;
+  std::map<TEMP::Temp *, int> temp_vn;
+  std::map<Key, Avail> avail;
+  std::vector<std::pair<Key, std::pair<bool, Avail>>> undo;
+  Memory mem;
+  std::map<T::Exp **, T::Stm *> owner;
+  std::map<T::Stm *, std::vector<T::Stm *>> pending;  // hoisted before a statement
+  std::set<T::Stm *> removed;
+  std::map<TEMP::Temp *, TEMP::Temp *> copy_of;
+
+  int fresh() { return next_vn++; }
+  int pureVn(Key k);
+  int vnOf(TEMP::Temp *t);
+  bool valid(const Avail &a);
+  void set(Key k, Avail a);
+  void reown(T::Exp **ref, T::Stm *stm);
+  int lookup(Key k, T::Exp **ref, T::Stm *stm, bool in_addr, int addr);
+  int number(T::Exp **ref, T::Stm *stm, bool in_addr);
+  void store(int addr);
+  void visit(T::Stm *stm);
+  void walk(int b);
+  void emit(T::Stm *stm, T::StmList *&tail);
+};
+
+int Numberer::pureVn(Key k)
+{
+  auto it = pure.find(k);
+  if (it != pure.end())
+    return it->second;
+  int vn = pure[k] = fresh();
+  key_of[vn] = k;
+  if (std::get<0>(k) == CONST_KEY)
+    consts.insert(vn);
+  return vn;
+}
+
+// precolored registers other than the frame pointer change behind our back
+int Numberer::vnOf(TEMP::Temp *t)
+{
+  if (t != F::X64Frame::rbp && !IsVirtual(t))
+    return -1;
+  auto it = temp_vn.find(t);
+  if (it != temp_vn.end())
+    return it->second;
+  return temp_vn[t] = fresh();
+}
+
+bool Numberer::valid(const Avail &a)
+{
+  if (a.addr < 0)
+    return true;
+  if (a.stamp <= mem.all)
+    return false;
+  if (frame_addrs.count(a.addr))
+    return a.stamp > mem.frame[a.addr];
+  return a.stamp > mem.other;
+}
+
+void Numberer::set(Key k, Avail a)
+{
+  auto it = avail.find(k);
+  if (it == avail.end())
+    undo.push_back({k, {false, a}});
+  else
+    undo.push_back({k, {true, it->second}});
+  avail[k] = a;
+}
+
+void Numberer::reown(T::Exp **ref, T::Stm *stm)
+{
+  owner[ref] = stm;
+  T::Exp *e = *ref;
+  if (e->kind == T::Exp::BINOP) {
+    reown(&((T::BinopExp *)e)->left, stm);
+    reown(&((T::BinopExp *)e)->right, stm);
+  } else if (e->kind == T::Exp::MEM) {
+    reown(&((T::MemExp *)e)->exp, stm);
+  }
+}
+
+int Numberer::lookup(Key k, T::Exp **ref, T::Stm *stm, bool in_addr, int addr)
+{
+  T::Exp *e = *ref;
+  auto it = avail.find(k);
+  if (it != avail.end() && valid(it->second)) {
+    Avail &a = it->second;
+    if (a.leaf) {
+      if (!in_addr || !cheap(e)) {
+        eliminated += ops(e);
+        *ref = copyLeaf(a.leaf);
+      }
+      return a.vn;
+    }
+    if (cheap(e))
+      return a.vn;
+    // the first computation gets a temp, right before its statement
+    TEMP::Temp *t = TEMP::Temp::NewTemp();
+    T::MoveStm *hoisted = new T::MoveStm(new T::TempExp(t), *a.ref);
+    pending[owner[a.ref]].push_back(hoisted);
+    reown(&hoisted->src, hoisted);
+    *a.ref = new T::TempExp(t);
+    a.leaf = new T::TempExp(t);
+    temp_vn[t] = a.vn;
+    eliminated += ops(e);
+    *ref = new T::TempExp(t);
+    return a.vn;
+  }
+  int vn = addr >= 0 ? fresh() : pureVn(k);
+  key_of[vn] = k;
+  owner[ref] = stm;
+  set(k, Avail{vn, nullptr, ref, ++clock, addr});
+  return vn;
+}
+
+int Numberer::number(T::Exp **ref, T::Stm *stm, bool in_addr)
+{
+  T::Exp *e = *ref;
+  switch (e->kind) {
+  case T::Exp::CONST:
+    return pureVn(Key(CONST_KEY, ((T::ConstExp *)e)->consti, 0, 0));
+  case T::Exp::NAME:
+    return pureVn(Key(NAME_KEY, (intptr_t)((T::NameExp *)e)->name, 0, 0));
+  case T::Exp::TEMP: {
+    TEMP::Temp *t = ((T::TempExp *)e)->temp;
+    auto c = copy_of.find(t);
+    if (c != copy_of.end()) {
+      t = c->second;
+      *ref = new T::TempExp(t);
+    }
+    return vnOf(t);
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *b = (T::BinopExp *)e;
+    int l = number(&b->left, stm, in_addr), r = number(&b->right, stm, in_addr);
+    if (l < 0 || r < 0)
+      return -1;
+    bool commutative = b->op == T::PLUS_OP || b->op == T::MUL_OP || b->op == T::AND_OP
+      || b->op == T::OR_OP || b->op == T::XOR_OP;
+    bool frame = (l == fp && consts.count(r) && (b->op == T::PLUS_OP || b->op == T::MINUS_OP))
+      || (r == fp && consts.count(l) && b->op == T::PLUS_OP);
+    if (commutative && l > r)
+      std::swap(l, r);
+    int vn = lookup(Key(BINOP_KEY, b->op, l, r), ref, stm, in_addr, -1);
+    if (frame)
+      frame_addrs.insert(vn);
+    return vn;
+  }
+  case T::Exp::MEM: {
+    int a = number(&((T::MemExp *)e)->exp, stm, true);
+    if (a < 0)
+      return -1;
+    return lookup(Key(MEM_KEY, 0, a, 0), ref, stm, false, a);
+  }
+  case T::Exp::CALL:
+    for (T::ExpList *l = ((T::CallExp *)e)->args; l; l = l->tail)
+      number(&l->head, stm, false);
+    // the callee may store anywhere
+    mem.all = ++clock;
+    return -1;
+  default:
+    return -1;
+  }
+}
+
+// a frame slot only aliases loads from that slot, other stores can't reach
+// the frame of this function, only those of the functions it's nested in
+void Numberer::store(int addr)
+{
+  if (addr < 0)
+    mem.all = ++clock;
+  else if (frame_addrs.count(addr))
+    mem.frame[addr] = ++clock;
+  else
+    mem.other = ++clock;
+}
+
+void Numberer::visit(T::Stm *stm)
+{
+  switch (stm->kind) {
+  case T::Stm::MOVE: {
+    T::MoveStm *s = (T::MoveStm *)stm;
+    if (s->dst->kind == T::Exp::MEM) {
+      int a = number(&((T::MemExp *)s->dst)->exp, stm, true);
+      int v = number(&s->src, stm, false);
+      store(a);
+      // the value stored is what a load from there gives next
+      if (a >= 0 && v >= 0 && (s->src->kind == T::Exp::TEMP || s->src->kind == T::Exp::CONST))
+        set(Key(MEM_KEY, 0, a, 0), Avail{v, copyLeaf(s->src), nullptr, ++clock, a});
+      break;
+    }
+    TEMP::Temp *d = ((T::TempExp *)s->dst)->temp;
+    int v = number(&s->src, stm, false);
+    if (!IsVirtual(d))
+      break;
+    if (s->src->kind == T::Exp::TEMP && IsVirtual(((T::TempExp *)s->src)->temp)) {
+      copy_of[d] = ((T::TempExp *)s->src)->temp;
+      removed.insert(stm);
+      eliminated++;
+      break;
+    }
+    if (v < 0) {
+      temp_vn[d] = fresh();
+      break;
+    }
+    temp_vn[d] = v;
+    // d holds the value from now on
+    auto it = key_of.find(v);
+    if (it == key_of.end())
+      break;
+    auto a = avail.find(it->second);
+    if (a != avail.end() && a->second.vn == v && !a->second.leaf && valid(a->second)) {
+      Avail leaf = a->second;
+      leaf.leaf = new T::TempExp(d);
+      set(it->second, leaf);
+    }
+    break;
+  }
+  case T::Stm::EXP:
+    number(&((T::ExpStm *)stm)->exp, stm, false);
+    break;
+  case T::Stm::CJUMP:
+    number(&((T::CjumpStm *)stm)->left, stm, false);
+    number(&((T::CjumpStm *)stm)->right, stm, false);
+    break;
+  default:
+    break;
+  }
+}
+
+// loads only carry over into a block entered from its dominator alone
+void Numberer::walk(int b)
+{
+  size_t mark = undo.size();
+  for (Phi &phi : fn->phis[b])
+    temp_vn[phi.dst] = fresh();
+  for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+    visit(l->head);
+  Memory end = mem;
+  for (int c : fn->children[b]) {
+    mem = end;
+    if (fn->pred[c].size() != 1)
+      mem.all = ++clock;
+    walk(c);
+  }
+  while (undo.size() > mark) {
+    auto &u = undo.back();
+    if (u.second.first)
+      avail[u.first] = u.second.second;
+    else
+      avail.erase(u.first);
+    undo.pop_back();
+  }
+}
+
+void Numberer::emit(T::Stm *stm, T::StmList *&tail)
+{
+  auto it = pending.find(stm);
+  if (it != pending.end())
+    for (T::Stm *p : it->second)
+      emit(p, tail);
+  tail = tail->tail = new T::StmList(stm, nullptr);
+}
+
+int Numberer::run()
+{
+  walk(0);
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (!fn->reachable(b))
+      continue;
+    T::StmList *prehead = new T::StmList(nullptr, nullptr), *tail = prehead;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (!removed.count(l->head))
+        emit(l->head, tail);
+    fn->blocks[b] = prehead->tail;
+    for (Phi &phi : fn->phis[b])
+      for (auto &src : phi.src) {
+        auto c = copy_of.find(src.second);
+        if (c != copy_of.end())
+          src.second = c->second;
+      }
+  }
+  return eliminated;
+}
+
+}  // namespace
+
+int NumberValues(Function *fn)
+{
+  return Numberer(fn).run();
+}
+
+}  // namespace SSA
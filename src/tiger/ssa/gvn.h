@@ -0,0 +1,20 @@
+#ifndef TIGER_SSA_GVN_H_
+#define TIGER_SSA_GVN_H_
+
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// dominator-based global value numbering
+// arithmetic, address computations & loads computed again where an earlier
+// computation dominates them are replaced by the temp holding its value, a
+// nested first computation gets a temp of its own
+// loads stay available until a store that may alias them or a call, and
+// only along a single predecessor
+// copies between virtual temps are propagated & removed
+// returns the number of operations eliminated
+int NumberValues(Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_GVN_H_
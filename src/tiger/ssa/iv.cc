@@ -0,0 +1,545 @@
+#include "tiger/ssa/iv.h"
+#include "tiger/frame/x64frame.h"
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+// iv * scale + the terms + constant, each term a coefficient times an
+// invariant leaf
+class Affine {
+ public:
+  TEMP::Temp *iv = nullptr;
+  int scale = 0;
+  std::vector<std::pair<int, T::Exp *>> terms;
+  int constant = 0;
+};
+
+// a basic induction variable, nexts are the temps it's stepped to
+class Induction {
+ public:
+  TEMP::Temp *var;
+  TEMP::Temp *init;  // from the preheader
+  int step;
+  std::map<int, TEMP::Temp *> nexts;  // by the block of the back edge
+};
+
+// a derived induction variable, without the constant of its affine form
+class Derived {
+ public:
+  Affine form;
+  TEMP::Temp *var;
+  std::map<TEMP::Temp *, TEMP::Temp *> nexts;  // by the next of the iv
+};
+
+class Candidate {
+ public:
+  T::Exp **ref;
+  Affine form;
+  int block;
+};
+
+T::Exp *copyLeaf(T::Exp *e)
+{
+  if (e->kind == T::Exp::TEMP)
+    return new T::TempExp(((T::TempExp *)e)->temp);
+  if (e->kind == T::Exp::NAME)
+    return new T::NameExp(((T::NameExp *)e)->name);
+  return new T::ConstExp(((T::ConstExp *)e)->consti);
+}
+
+// the terms & the constant
+T::Exp *build(const Affine &a)
+{
+  T::Exp *exp = nullptr;
+  for (auto &term : a.terms) {
+    T::Exp *leaf = copyLeaf(term.second);
+    if (exp && term.first == -1)
+      exp = new T::BinopExp(T::MINUS_OP, exp, leaf);
+    else {
+      if (term.first != 1)
+        leaf = new T::BinopExp(T::MUL_OP, leaf, new T::ConstExp(term.first));
+      exp = exp ? new T::BinopExp(T::PLUS_OP, exp, leaf) : leaf;
+    }
+  }
+  if (!exp)
+    return new T::ConstExp(a.constant);
+  if (a.constant != 0)
+    exp = new T::BinopExp(T::PLUS_OP, exp, new T::ConstExp(a.constant));
+  return exp;
+}
+
+bool scaleBy(Affine *a, int c)
+{
+  if (!T::fold(T::MUL_OP, a->scale, c, &a->scale) || !T::fold(T::MUL_OP, a->constant, c, &a->constant))
+    return false;
+  for (auto &term : a->terms)
+    if (!T::fold(T::MUL_OP, term.first, c, &term.first))
+      return false;
+  if (a->scale == 0)
+    a->iv = nullptr;
+  return true;
+}
+
+// a + b
+bool add(Affine *a, const Affine &b)
+{
+  if (a->iv && b.iv && a->iv != b.iv)
+    return false;
+  if (!a->iv)
+    a->iv = b.iv;
+  if (!T::fold(T::PLUS_OP, a->scale, b.scale, &a->scale)
+      || !T::fold(T::PLUS_OP, a->constant, b.constant, &a->constant))
+    return false;
+  a->terms.insert(a->terms.end(), b.terms.begin(), b.terms.end());
+  if (a->scale == 0)
+    a->iv = nullptr;
+  return true;
+}
+
+// the same but for the constant
+bool sameForm(const Affine &a, const Affine &b)
+{
+  if (a.iv != b.iv || a.scale != b.scale || a.terms.size() != b.terms.size())
+    return false;
+  for (int i = 0; i < (int)a.terms.size(); i++)
+    if (a.terms[i].first != b.terms[i].first || !Same(a.terms[i].second, b.terms[i].second))
+      return false;
+  return true;
+}
+
+int occurrences(T::Exp *exp, TEMP::Temp *t)
+{
+  switch (exp->kind) {
+  case T::Exp::TEMP:
+    return ((T::TempExp *)exp)->temp == t;
+  case T::Exp::BINOP:
+    return occurrences(((T::BinopExp *)exp)->left, t) + occurrences(((T::BinopExp *)exp)->right, t);
+  case T::Exp::MEM:
+    return occurrences(((T::MemExp *)exp)->exp, t);
+  case T::Exp::CALL: {
+    int n = 0;
+    for (T::ExpList *l = ((T::CallExp *)exp)->args; l; l = l->tail)
+      n += occurrences(l->head, t);
+    return n;
+  }
+  default:
+    return 0;
+  }
+}
+
+bool hasMul(T::Exp *exp)
+{
+  if (exp->kind == T::Exp::BINOP)
+    return ((T::BinopExp *)exp)->op == T::MUL_OP || hasMul(((T::BinopExp *)exp)->left)
+      || hasMul(((T::BinopExp *)exp)->right);
+  return false;
+}
+
+bool signedRel(T::RelOp op)
+{
+  return op == T::EQ_OP || op == T::NE_OP || op == T::LT_OP || op == T::GT_OP
+    || op == T::LE_OP || op == T::GE_OP;
+}
+
+class Reducer {
+ public:
+  Reducer(Function *fn, std::vector<Loop> &loops, Loop &loop, int pre)
+    : fn(fn), loops(loops), loop(loop), pre(pre) {}
+  bool reduce(int *derived, int *replaced);
+
+ private:
+  Function *fn;
+  std::vector<Loop> &loops;
+  Loop &loop;
+  int pre;
+  std::map<TEMP::Temp *, int> def_block;
+  std::map<TEMP::Temp *, T::StmList *> def_at;  // the list node holding the move
+  std::map<TEMP::Temp *, Induction> ivs;
+
+  void analyze();
+  bool invariant(TEMP::Temp *t);
+  bool affine(T::Exp *exp, Affine *a);
+  void collect(T::Exp **ref, int b, std::vector<Candidate> *cands);
+  bool everyIteration(int b);
+  T::CjumpStm *exitTest(const Induction &iv, bool *next);
+  Derived *derive(const Induction &iv, const Affine &form, std::vector<Derived> *derived);
+  void place(TEMP::Temp *t, const Affine &a);
+};
+
+void Reducer::analyze()
+{
+  def_block.clear();
+  def_at.clear();
+  ivs.clear();
+  for (int b : fn->preorder) {
+    for (Phi &phi : fn->phis[b])
+      def_block[phi.dst] = b;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (TEMP::Temp *d = Def(l->head)) {
+        def_block[d] = b;
+        def_at[d] = l;
+      }
+  }
+  for (Phi &phi : fn->phis[loop.header]) {
+    Induction iv{phi.dst, nullptr, 0, {}};
+    bool basic = true;
+    for (auto &src : phi.src) {
+      if (!loop.body[src.first]) {
+        basic &= src.first == pre;
+        iv.init = src.second;
+        continue;
+      }
+      auto at = def_at.find(src.second);
+      if (at == def_at.end()) {
+        basic = false;
+        break;
+      }
+      // next = var + step
+      T::Exp *exp = ((T::MoveStm *)at->second->head)->src;
+      int step;
+      if (exp->kind != T::Exp::BINOP) {
+        basic = false;
+        break;
+      }
+      T::BinopExp *e = (T::BinopExp *)exp;
+      T::Exp *var = e->left, *c = e->right;
+      if (e->op == T::PLUS_OP && var->kind == T::Exp::CONST)
+        std::swap(var, c);
+      if ((e->op != T::PLUS_OP && e->op != T::MINUS_OP) || var->kind != T::Exp::TEMP
+          || ((T::TempExp *)var)->temp != phi.dst || c->kind != T::Exp::CONST) {
+        basic = false;
+        break;
+      }
+      step = ((T::ConstExp *)c)->consti;
+      if (e->op == T::MINUS_OP && !T::fold(T::MINUS_OP, 0, step, &step)) {
+        basic = false;
+        break;
+      }
+      basic &= iv.nexts.empty() || step == iv.step;
+      iv.step = step;
+      iv.nexts[src.first] = src.second;
+    }
+    if (basic && iv.init && !iv.nexts.empty() && iv.step != 0)
+      ivs[phi.dst] = iv;
+  }
+}
+
+bool Reducer::invariant(TEMP::Temp *t)
+{
+  if (t == F::X64Frame::rbp)
+    return true;
+  auto it = def_block.find(t);
+  return IsVirtual(t) && it != def_block.end() && !loop.body[it->second];
+}
+
+bool Reducer::affine(T::Exp *exp, Affine *a)
+{
+  switch (exp->kind) {
+  case T::Exp::CONST:
+    a->constant = ((T::ConstExp *)exp)->consti;
+    return true;
+  case T::Exp::NAME:
+    a->terms.push_back(std::make_pair(1, exp));
+    return true;
+  case T::Exp::TEMP: {
+    TEMP::Temp *t = ((T::TempExp *)exp)->temp;
+    if (ivs.count(t)) {
+      a->iv = t;
+      a->scale = 1;
+      return true;
+    }
+    if (invariant(t)) {
+      a->terms.push_back(std::make_pair(1, exp));
+      return true;
+    }
+    // computed in the loop from the iv
+    auto at = def_at.find(t);
+    return at != def_at.end() && loop.body[def_block[t]]
+      && affine(((T::MoveStm *)at->second->head)->src, a);
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    Affine r;
+    switch (e->op) {
+    case T::PLUS_OP:
+      return affine(e->left, a) && affine(e->right, &r) && add(a, r);
+    case T::MINUS_OP:
+      return affine(e->left, a) && affine(e->right, &r) && scaleBy(&r, -1) && add(a, r);
+    case T::MUL_OP:
+      if (e->right->kind == T::Exp::CONST)
+        return affine(e->left, a) && scaleBy(a, ((T::ConstExp *)e->right)->consti);
+      if (e->left->kind == T::Exp::CONST)
+        return affine(e->right, a) && scaleBy(a, ((T::ConstExp *)e->left)->consti);
+      return false;
+    default:
+      return false;
+    }
+  }
+  default:
+    return false;
+  }
+}
+
+// the largest parts of an expression affine in an iv, but for the iv plus
+// a constant & temps, their definitions are looked at on their own
+void Reducer::collect(T::Exp **ref, int b, std::vector<Candidate> *cands)
+{
+  T::Exp *exp = *ref;
+  if (exp->kind == T::Exp::TEMP || exp->kind == T::Exp::CONST || exp->kind == T::Exp::NAME)
+    return;
+  Affine a;
+  if (affine(exp, &a)) {
+    if (a.iv && (a.scale != 1 || !a.terms.empty()))
+      cands->push_back(Candidate{ref, a, b});
+    return;
+  }
+  switch (exp->kind) {
+  case T::Exp::BINOP:
+    collect(&((T::BinopExp *)exp)->left, b, cands);
+    collect(&((T::BinopExp *)exp)->right, b, cands);
+    break;
+  case T::Exp::MEM:
+    collect(&((T::MemExp *)exp)->exp, b, cands);
+    break;
+  case T::Exp::CALL:
+    for (T::ExpList *l = ((T::CallExp *)exp)->args; l; l = l->tail)
+      collect(&l->head, b, cands);
+    break;
+  default:
+    break;
+  }
+}
+
+// on every trip around the loop
+bool Reducer::everyIteration(int b)
+{
+  for (int p : fn->pred[loop.header])
+    if (loop.body[p] && !fn->dominates(b, p))
+      return false;
+  return true;
+}
+
+// the conditional jump leaving the loop on the iv or one of its nexts
+// compared with an invariant
+T::CjumpStm *Reducer::exitTest(const Induction &iv, bool *next)
+{
+  for (int b : fn->preorder) {
+    if (!loop.body[b])
+      continue;
+    T::Stm *last = LastOf(fn->blocks[b]);
+    if (last->kind != T::Stm::CJUMP)
+      continue;
+    bool exits = false;
+    for (int s : fn->succ[b])
+      exits |= !loop.body[s];
+    T::CjumpStm *s = (T::CjumpStm *)last;
+    if (!exits || !signedRel(s->op) || s->left->kind != T::Exp::TEMP)
+      continue;
+    TEMP::Temp *t = ((T::TempExp *)s->left)->temp;
+    bool is_next = false;
+    for (auto &it : iv.nexts)
+      is_next |= it.second == t;
+    Affine bound;
+    if ((t == iv.var || is_next) && affine(s->right, &bound) && !bound.iv) {
+      *next = is_next;
+      return s;
+    }
+  }
+  return nullptr;
+}
+
+// t = the terms & constant of a, before the jump ending the preheader of
+// the outermost loop that doesn't change them
+void Reducer::place(TEMP::Temp *t, const Affine &a)
+{
+  int target = pre;
+  for (Loop &outer : loops) {
+    if (outer.size <= loop.size || !outer.body[loop.header])
+      continue;
+    int p = Preheader(fn, outer);
+    bool invariant = p >= 0;
+    for (auto &term : a.terms)
+      if (term.second->kind == T::Exp::TEMP) {
+        auto it = def_block.find(((T::TempExp *)term.second)->temp);
+        invariant &= it == def_block.end() || !outer.body[it->second];
+      }
+    if (!invariant)
+      break;
+    target = p;
+  }
+  T::StmList *at = fn->blocks[target];
+  while (at->tail->tail)
+    at = at->tail;
+  at->tail = new T::StmList(new T::MoveStm(new T::TempExp(t), build(a)), at->tail);
+  def_block[t] = target;
+}
+
+Derived *Reducer::derive(const Induction &iv, const Affine &form, std::vector<Derived> *derived)
+{
+  for (Derived &d : *derived)
+    if (sameForm(d.form, form))
+      return &d;
+  int step;
+  if (!T::fold(T::MUL_OP, iv.step, form.scale, &step))
+    return nullptr;
+  Derived d;
+  d.form = form;
+  d.form.constant = 0;
+  d.var = TEMP::Temp::NewTemp();
+  Affine start = d.form, first;
+  auto at = def_at.find(iv.init);
+  if (at != def_at.end() && ((T::MoveStm *)at->second->head)->src->kind == T::Exp::CONST)
+    first.constant = ((T::ConstExp *)((T::MoveStm *)at->second->head)->src)->consti;
+  else
+    first.terms.push_back(std::make_pair(1, (T::Exp *)new T::TempExp(iv.init)));
+  if (!scaleBy(&first, form.scale) || !add(&start, first))
+    return nullptr;
+  TEMP::Temp *init = TEMP::Temp::NewTemp();
+  place(init, start);
+  Phi phi{d.var, d.var, {}};
+  phi.src[pre] = init;
+  for (auto &it : iv.nexts) {
+    if (d.nexts.count(it.second) == 0) {
+      TEMP::Temp *next = TEMP::Temp::NewTemp();
+      T::StmList *at = def_at[it.second];
+      at->tail = new T::StmList(new T::MoveStm(new T::TempExp(next),
+        new T::BinopExp(T::PLUS_OP, new T::TempExp(d.var), new T::ConstExp(step))), at->tail);
+      d.nexts[it.second] = next;
+    }
+    phi.src[it.first] = d.nexts[it.second];
+  }
+  fn->phis[loop.header].push_back(phi);
+  derived->push_back(d);
+  return &derived->back();
+}
+
+bool Reducer::reduce(int *derived_count, int *replaced)
+{
+  analyze();
+  for (auto &it : ivs) {
+    const Induction &iv = it.second;
+    std::vector<Candidate> cands;
+    for (int b : fn->preorder) {
+      if (!loop.body[b])
+        continue;
+      for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+        T::Stm *stm = l->head;
+        if (stm->kind == T::Stm::MOVE) {
+          collect(&((T::MoveStm *)stm)->src, b, &cands);
+          if (((T::MoveStm *)stm)->dst->kind == T::Exp::MEM)
+            collect(&((T::MemExp *)((T::MoveStm *)stm)->dst)->exp, b, &cands);
+        } else if (stm->kind == T::Stm::CJUMP) {
+          collect(&((T::CjumpStm *)stm)->left, b, &cands);
+          collect(&((T::CjumpStm *)stm)->right, b, &cands);
+        } else if (stm->kind == T::Stm::EXP) {
+          collect(&((T::ExpStm *)stm)->exp, b, &cands);
+        }
+      }
+    }
+    for (auto c = cands.begin(); c != cands.end();)
+      c = c->form.iv == iv.var ? c + 1 : cands.erase(c);
+    if (cands.empty())
+      continue;
+
+    // the iv can go if the candidates, its nexts & the exit test are all
+    // that use it
+    bool next = false;
+    T::CjumpStm *test = exitTest(iv, &next);
+    const Candidate *by = nullptr;
+    for (const Candidate &c : cands)
+      if (c.form.scale > 0 && !by)
+        by = &c;
+    bool dies = test && by;
+    if (dies) {
+      int uses = 0, expected = 2 * iv.nexts.size() + 1;
+      for (const Candidate &c : cands)
+        expected += occurrences(*c.ref, iv.var);
+      for (int b : fn->preorder) {
+        for (Phi &phi : fn->phis[b])
+          for (auto &src : phi.src) {
+            uses += src.second == iv.var;
+            for (auto &n : iv.nexts)
+              uses += src.second == n.second;
+          }
+        for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+          for (T::Exp **ref : Uses(l->head)) {
+            TEMP::Temp *t = ((T::TempExp *)*ref)->temp;
+            uses += t == iv.var;
+            for (auto &n : iv.nexts)
+              uses += t == n.second;
+          }
+      }
+      dies = uses == expected;
+    }
+
+    std::vector<Derived> derived;
+    Affine test_form;
+    if (dies)
+      test_form = by->form;
+    for (Candidate &c : cands) {
+      // the iv staying, a derived one costs a register & an add on every
+      // trip, worth it only for a multiplication done just as often
+      if (!dies && (IsAddress(*c.ref) || !hasMul(*c.ref) || !everyIteration(c.block)))
+        continue;
+      Derived *d = derive(iv, c.form, &derived);
+      if (!d)
+        continue;
+      int delta = c.form.constant - d->form.constant;
+      *c.ref = new T::TempExp(d->var);
+      if (delta != 0)
+        *c.ref = new T::BinopExp(T::PLUS_OP, *c.ref, new T::ConstExp(delta));
+    }
+    *derived_count += derived.size();
+
+    if (dies) {
+      // var op bound is var * scale + rest op bound * scale + rest
+      Derived *d = derive(iv, test_form, &derived);
+      Affine bound;
+      TEMP::Temp *var = ((T::TempExp *)test->left)->temp;
+      if (d && affine(test->right, &bound) && scaleBy(&bound, test_form.scale)) {
+        Affine rest = d->form;
+        rest.iv = nullptr;
+        rest.scale = 0;
+        if (add(&bound, rest)) {
+          test->left = new T::TempExp(next ? d->nexts[var] : d->var);
+          if (bound.terms.empty()) {
+            test->right = new T::ConstExp(bound.constant);
+          } else {
+            TEMP::Temp *limit = TEMP::Temp::NewTemp();
+            place(limit, bound);
+            test->right = new T::TempExp(limit);
+          }
+          (*replaced)++;
+        }
+      }
+    }
+    if (!derived.empty())
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+void ReduceStrength(Function *fn)
+{
+  int derived = 0, replaced = 0;
+  std::vector<Loop> loops = FindLoops(fn);
+  for (Loop &loop : loops) {
+    int pre = Preheader(fn, loop);
+    if (pre < 0)
+      continue;
+    // one iv at a time, the forms of the others changed
+    Reducer reducer(fn, loops, loop, pre);
+    while (reducer.reduce(&derived, &replaced))
+      ;
+  }
+  std::cout << "IVSR: " << derived << " induction variables derived, " << replaced
+            << " exit tests replaced" << std::endl;
+}
+
+}  // namespace SSA
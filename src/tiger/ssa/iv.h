@@ -0,0 +1,19 @@
+#ifndef TIGER_SSA_IV_H_
+#define TIGER_SSA_IV_H_
+
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// induction variable strength reduction, on loops with a preheader
+// a basic induction variable is a phi at the header stepped by a constant
+// on every back edge, a derived one iv * scale + invariants gets a phi of
+// its own stepped by step * scale, as pointers walking an array do
+// if the iv is left with nothing but its exit test, that compares the
+// derived variable instead & the iv dies, otherwise only what codegen
+// can't fold into an address is replaced
+void ReduceStrength(Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_IV_H_
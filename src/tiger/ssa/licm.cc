@@ -0,0 +1,376 @@
+#include "tiger/ssa/licm.h"
+#include "tiger/frame/x64frame.h"
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+// the phis of the header move to the preheader for the edges coming from
+// outside the loop, if there's more than one of those
+void insertPreheaders(Function *fn)
+{
+  for (Loop &loop : FindLoops(fn)) {
+    int h = loop.header;
+    std::vector<int> outside;
+    for (int p : fn->pred[h])
+      if (fn->reachable(p) && !loop.body[p])
+        outside.push_back(p);
+    // the entry block has no predecessor to put a preheader after
+    if (outside.empty() || (outside.size() == 1 && fn->succ[outside[0]].size() == 1))
+      continue;
+    int pre = fn->blocks.size();
+    TEMP::Label *label = TEMP::NewLabel(), *target = LabelOf(fn->blocks[h]);
+    fn->blocks.push_back(new T::StmList(new T::LabelStm(label),
+      new T::StmList(new T::JumpStm(new T::NameExp(target),
+        new TEMP::LabelList(target, nullptr)), nullptr)));
+    fn->phis.push_back(std::vector<Phi>());
+    for (Phi &phi : fn->phis[h]) {
+      TEMP::Temp *src = phi.src[outside[0]];
+      if (outside.size() > 1) {
+        Phi merge{phi.var, TEMP::Temp::NewTemp(), {}};
+        for (int p : outside)
+          merge.src[p] = phi.src[p];
+        src = merge.dst;
+        fn->phis[pre].push_back(merge);
+      }
+      for (int p : outside)
+        phi.src.erase(p);
+      phi.src[pre] = src;
+    }
+    for (int p : outside)
+      Retarget(LastOf(fn->blocks[p]), target, label);
+  }
+  Analyze(fn);
+}
+
+class Hoister {
+ public:
+  Hoister(Function *fn, int static_link);
+  int hoist(Loop &loop);
+
+ private:
+  Function *fn;
+  int static_link;
+  std::map<TEMP::Temp *, int> def_block;
+  std::map<TEMP::Temp *, T::Exp *> def_src;
+
+  // what the loop being looked at does
+  Loop *loop;
+  bool calls, other_stores;
+  std::set<int> frame_stores;
+  std::vector<int> exiting;
+  int pre;
+  T::StmList *at;  // the last statement of the preheader before its jump
+  std::vector<std::pair<T::Exp *, TEMP::Temp *>> placed;
+
+  bool frameSlot(T::Exp *addr, int *offset);
+  bool speculable(T::Exp *addr);
+  bool invariant(T::Exp *exp, int b);
+  bool invariantLoad(T::Exp *addr, int b);
+  bool hoistable(T::Stm *stm, int b);
+  bool worthwhile(T::Exp *exp);
+  void place(T::MoveStm *stm);
+  int extract(T::Exp **ref, int b);
+  int extract(T::Stm *stm, int b);
+  void summarize();
+};
+
+Hoister::Hoister(Function *fn, int static_link) : fn(fn), static_link(static_link)
+{
+  for (int b : fn->preorder) {
+    for (Phi &phi : fn->phis[b])
+      def_block[phi.dst] = b;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      if (TEMP::Temp *d = Def(l->head)) {
+        def_block[d] = b;
+        def_src[d] = ((T::MoveStm *)l->head)->src;
+      }
+  }
+}
+
+// fp + offset, maybe through temps
+bool Hoister::frameSlot(T::Exp *addr, int *offset)
+{
+  if (addr->kind == T::Exp::TEMP) {
+    TEMP::Temp *t = ((T::TempExp *)addr)->temp;
+    if (t == F::X64Frame::rbp) {
+      *offset = 0;
+      return true;
+    }
+    auto it = def_src.find(t);
+    return it != def_src.end() && frameSlot(it->second, offset);
+  }
+  if (addr->kind != T::Exp::BINOP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)addr;
+  int base;
+  if (b->op == T::PLUS_OP && b->right->kind == T::Exp::CONST && frameSlot(b->left, &base)) {
+    *offset = base + ((T::ConstExp *)b->right)->consti;
+    return true;
+  }
+  if (b->op == T::PLUS_OP && b->left->kind == T::Exp::CONST && frameSlot(b->right, &base)) {
+    *offset = base + ((T::ConstExp *)b->left)->consti;
+    return true;
+  }
+  if (b->op == T::MINUS_OP && b->right->kind == T::Exp::CONST && frameSlot(b->left, &base)) {
+    *offset = base - ((T::ConstExp *)b->right)->consti;
+    return true;
+  }
+  return false;
+}
+
+// the static link points at the frame of the enclosing function, the
+// slots there can always be read
+bool Hoister::speculable(T::Exp *addr)
+{
+  if (addr->kind == T::Exp::BINOP && ((T::BinopExp *)addr)->op == T::PLUS_OP
+      && ((T::BinopExp *)addr)->right->kind == T::Exp::CONST)
+    addr = ((T::BinopExp *)addr)->left;
+  if (addr->kind == T::Exp::TEMP) {
+    auto it = def_src.find(((T::TempExp *)addr)->temp);
+    if (it == def_src.end())
+      return false;
+    addr = it->second;
+  }
+  int offset;
+  return addr->kind == T::Exp::MEM && frameSlot(((T::MemExp *)addr)->exp, &offset)
+    && offset == static_link;
+}
+
+bool Hoister::invariant(T::Exp *exp, int b)
+{
+  switch (exp->kind) {
+  case T::Exp::CONST:
+  case T::Exp::NAME:
+    return true;
+  case T::Exp::TEMP: {
+    TEMP::Temp *t = ((T::TempExp *)exp)->temp;
+    if (t == F::X64Frame::rbp)
+      return true;
+    auto it = def_block.find(t);
+    return IsVirtual(t) && it != def_block.end() && !loop->body[it->second];
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    // idivq traps on a zero divisor
+    if (e->op == T::DIV_OP
+        && (e->right->kind != T::Exp::CONST || ((T::ConstExp *)e->right)->consti == 0))
+      return false;
+    return invariant(e->left, b) && invariant(e->right, b);
+  }
+  case T::Exp::MEM:
+    return invariant(((T::MemExp *)exp)->exp, b) && invariantLoad(((T::MemExp *)exp)->exp, b);
+  default:
+    return false;
+  }
+}
+
+// frame slots are only stored to through fp in this function, or by the
+// functions it calls, other stores can't reach them
+bool Hoister::invariantLoad(T::Exp *addr, int b)
+{
+  int offset;
+  if (frameSlot(addr, &offset))
+    return (!calls || offset == static_link) && !frame_stores.count(offset);
+  if (calls || other_stores)
+    return false;
+  if (speculable(addr))
+    return true;
+  // a load that may fault has to run on every trip through the loop
+  for (int e : exiting)
+    if (!fn->dominates(b, e))
+      return false;
+  return true;
+}
+
+bool Hoister::hoistable(T::Stm *stm, int b)
+{
+  if (!Def(stm))
+    return false;
+  T::Exp *src = ((T::MoveStm *)stm)->src;
+  if (src->kind == T::Exp::CALL) {
+    T::CallExp *call = (T::CallExp *)src;
+    if (call->fun->kind != T::Exp::NAME || !F::X64Frame::isPure(((T::NameExp *)call->fun)->name))
+      return false;
+    for (T::ExpList *l = call->args; l; l = l->tail)
+      if (!invariant(l->head, b))
+        return false;
+    return true;
+  }
+  if (IsLeaf(src))
+    return false;
+  // kept across a call it'd only be spilled to the stack again
+  int offset;
+  if (calls && src->kind == T::Exp::MEM && frameSlot(((T::MemExp *)src)->exp, &offset))
+    return false;
+  return invariant(src, b);
+}
+
+// worth a temp of its own when part of a statement staying in the loop,
+// not if codegen folds it into an address or the leaq computing one
+bool Hoister::worthwhile(T::Exp *exp)
+{
+  if (exp->kind == T::Exp::MEM) {
+    int offset;
+    return !calls || !frameSlot(((T::MemExp *)exp)->exp, &offset);
+  }
+  return exp->kind == T::Exp::BINOP && !IsAddress(exp);
+}
+
+void Hoister::place(T::MoveStm *stm)
+{
+  TEMP::Temp *d = ((T::TempExp *)stm->dst)->temp;
+  for (auto &it : placed)
+    if (Same(it.first, stm->src)) {
+      stm->src = new T::TempExp(it.second);
+      break;
+    }
+  if (!IsLeaf(stm->src))
+    placed.push_back(std::make_pair(stm->src, d));
+  at = at->tail = new T::StmList(stm, at->tail);
+  def_block[d] = pre;
+  def_src[d] = stm->src;
+}
+
+// the largest invariant parts of an expression, into temps
+int Hoister::extract(T::Exp **ref, int b)
+{
+  T::Exp *exp = *ref;
+  if (worthwhile(exp) && invariant(exp, b)) {
+    TEMP::Temp *t = TEMP::Temp::NewTemp();
+    place(new T::MoveStm(new T::TempExp(t), exp));
+    *ref = new T::TempExp(t);
+    return 1;
+  }
+  switch (exp->kind) {
+  case T::Exp::BINOP:
+    return extract(&((T::BinopExp *)exp)->left, b) + extract(&((T::BinopExp *)exp)->right, b);
+  case T::Exp::MEM:
+    return extract(&((T::MemExp *)exp)->exp, b);
+  case T::Exp::CALL: {
+    int extracted = 0;
+    for (T::ExpList *l = ((T::CallExp *)exp)->args; l; l = l->tail)
+      extracted += extract(&l->head, b);
+    return extracted;
+  }
+  default:
+    return 0;
+  }
+}
+
+int Hoister::extract(T::Stm *stm, int b)
+{
+  switch (stm->kind) {
+  case T::Stm::MOVE: {
+    T::MoveStm *s = (T::MoveStm *)stm;
+    int extracted = extract(&s->src, b);
+    if (s->dst->kind == T::Exp::MEM)
+      extracted += extract(&((T::MemExp *)s->dst)->exp, b);
+    return extracted;
+  }
+  case T::Stm::CJUMP:
+    return extract(&((T::CjumpStm *)stm)->left, b) + extract(&((T::CjumpStm *)stm)->right, b);
+  case T::Stm::EXP:
+    return extract(&((T::ExpStm *)stm)->exp, b);
+  default:
+    return 0;
+  }
+}
+
+void Hoister::summarize()
+{
+  calls = other_stores = false;
+  frame_stores.clear();
+  exiting.clear();
+  for (int b : fn->preorder) {
+    if (!loop->body[b])
+      continue;
+    bool exits = false;
+    for (int s : fn->succ[b])
+      exits |= !loop->body[s];
+    T::Stm *last = LastOf(fn->blocks[b]);
+    if (last->kind == T::Stm::JUMP)
+      exits |= fn->succ[b].empty();
+    if (exits)
+      exiting.push_back(b);
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      T::Stm *stm = l->head;
+      T::Exp *exp = nullptr;
+      if (stm->kind == T::Stm::MOVE)
+        exp = ((T::MoveStm *)stm)->src;
+      else if (stm->kind == T::Stm::EXP)
+        exp = ((T::ExpStm *)stm)->exp;
+      if (exp && exp->kind == T::Exp::CALL) {
+        T::Exp *fun = ((T::CallExp *)exp)->fun;
+        calls |= fun->kind != T::Exp::NAME || !F::X64Frame::isPure(((T::NameExp *)fun)->name);
+      }
+      if (stm->kind == T::Stm::MOVE && ((T::MoveStm *)stm)->dst->kind == T::Exp::MEM) {
+        int offset;
+        if (frameSlot(((T::MemExp *)((T::MoveStm *)stm)->dst)->exp, &offset))
+          frame_stores.insert(offset);
+        else
+          other_stores = true;
+      }
+    }
+  }
+}
+
+int Hoister::hoist(Loop &loop)
+{
+  pre = Preheader(fn, loop);
+  if (pre < 0)
+    return 0;
+  this->loop = &loop;
+  summarize();
+  placed.clear();
+  at = fn->blocks[pre];
+  while (at->tail->tail)
+    at = at->tail;
+
+  int hoisted = 0;
+  bool changed;
+  do {
+    changed = false;
+    for (int b : fn->preorder) {
+      if (!loop.body[b])
+        continue;
+      for (T::StmList *l = fn->blocks[b]; l->tail;) {
+        T::Stm *stm = l->tail->head;
+        if (hoistable(stm, b)) {
+          l->tail = l->tail->tail;
+          place((T::MoveStm *)stm);
+          hoisted++;
+          changed = true;
+          continue;
+        }
+        int extracted = extract(stm, b);
+        hoisted += extracted;
+        changed |= extracted > 0;
+        l = l->tail;
+      }
+    }
+  } while (changed);
+  return hoisted;
+}
+
+}  // namespace
+
+void HoistLoopInvariants(Function *fn, F::Frame *frame)
+{
+  insertPreheaders(fn);
+  F::Access *link = frame->static_link;
+  int static_link = link && link->kind == F::Access::INFRAME ? ((F::InFrameAccess *)link)->offset : 1;
+  Hoister hoister(fn, static_link);
+  std::vector<Loop> loops = FindLoops(fn);
+  int hoisted = 0;
+  for (Loop &loop : loops)
+    hoisted += hoister.hoist(loop);
+  std::cout << "LICM: " << hoisted << " computations hoisted out of " << loops.size()
+            << " loops" << std::endl;
+}
+
+}  // namespace SSA
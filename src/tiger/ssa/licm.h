@@ -0,0 +1,22 @@
+#ifndef TIGER_SSA_LICM_H_
+#define TIGER_SSA_LICM_H_
+
+#include "tiger/frame/frame.h"
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// loop-invariant code motion
+// every natural loop gets a preheader, a block of its own the loop is
+// entered from, & what's computed the same on every iteration is hoisted
+// there, inner loops first, whole moves or the invariant parts of
+// statements staying in the loop
+// arithmetic that can't trap & calls to pure runtime functions always move,
+// loads only if nothing in the loop may store there & they can't fault
+// even where the loop wouldn't have run them
+// the frame tells where the static link is, which nothing ever stores to
+void HoistLoopInvariants(Function *fn, F::Frame *frame);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_LICM_H_
@@ -0,0 +1,310 @@
+#include "tiger/ssa/sccp.h"
+#include <iostream>
+#include <map>
+#include <queue>
+#include <set>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+// the lattice of a temp's value, TOP until a definition is seen to run
+class Value {
+ public:
+  enum Kind { TOP, CONST, BOTTOM } kind;
+  int c;
+
+  Value(Kind kind = TOP, int c = 0) : kind(kind), c(c) {}
+  bool operator!=(const Value &v) const { return kind != v.kind || (kind == CONST && c != v.c); }
+};
+
+Value meet(Value a, Value b)
+{
+  if (a.kind == Value::TOP)
+    return b;
+  if (b.kind == Value::TOP)
+    return a;
+  if (a.kind == Value::CONST && b.kind == Value::CONST && a.c == b.c)
+    return a;
+  return Value(Value::BOTTOM);
+}
+
+inline bool isConst(T::Exp *exp) { return exp->kind == T::Exp::CONST; }
+inline int constOf(T::Exp *exp) { return ((T::ConstExp *)exp)->consti; }
+
+// fold the constant operations of an expression in place
+T::Exp *fold(T::Exp *exp)
+{
+  switch (exp->kind) {
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    e->left = fold(e->left);
+    e->right = fold(e->right);
+    int v;
+    if (isConst(e->left) && isConst(e->right) && T::fold(e->op, constOf(e->left), constOf(e->right), &v))
+      return new T::ConstExp(v);
+    return exp;
+  }
+  case T::Exp::MEM:
+    ((T::MemExp *)exp)->exp = fold(((T::MemExp *)exp)->exp);
+    return exp;
+  case T::Exp::CALL:
+    for (T::ExpList *l = ((T::CallExp *)exp)->args; l; l = l->tail)
+      l->head = fold(l->head);
+    return exp;
+  default:
+    return exp;
+  }
+}
+
+class Propagator {
+ public:
+  explicit Propagator(Function *fn);
+  void run();
+  void rewrite();
+
+ private:
+  // a phi node, or a statement if phi is -1
+  struct Site {
+    int block;
+    int phi;
+    T::Stm *stm;
+  };
+
+  Function *fn;
+  std::map<TEMP::Label *, int> index;
+  std::map<TEMP::Temp *, Value> value;
+  std::map<TEMP::Temp *, std::vector<Site>> uses;
+  std::vector<bool> executable;
+  std::set<std::pair<int, int>> edges;  // the executable ones
+  std::queue<std::pair<int, int>> cfg_work;
+  std::queue<TEMP::Temp *> ssa_work;
+
+  Value eval(T::Exp *exp);
+  void lower(TEMP::Temp *t, Value v);
+  void reach(int from, TEMP::Label *target);
+  void visitPhi(int b, Phi &phi);
+  void visit(int b, T::Stm *stm);
+};
+
+Propagator::Propagator(Function *fn) : fn(fn), executable(fn->blocks.size(), false)
+{
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (!fn->blocks[b])
+      continue;
+    index[LabelOf(fn->blocks[b])] = b;
+    for (int i = 0; i < (int)fn->phis[b].size(); i++)
+      for (auto &src : fn->phis[b][i].src)
+        if (src.second)
+          uses[src.second].push_back(Site{b, i, nullptr});
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+      for (T::Exp **ref : Uses(l->head))
+        uses[((T::TempExp *)*ref)->temp].push_back(Site{b, -1, l->head});
+  }
+}
+
+Value Propagator::eval(T::Exp *exp)
+{
+  switch (exp->kind) {
+  case T::Exp::CONST:
+    return Value(Value::CONST, constOf(exp));
+  case T::Exp::TEMP: {
+    TEMP::Temp *t = ((T::TempExp *)exp)->temp;
+    return IsVirtual(t) ? value[t] : Value(Value::BOTTOM);
+  }
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    Value l = eval(e->left), r = eval(e->right);
+    if (l.kind == Value::BOTTOM || r.kind == Value::BOTTOM)
+      return Value(Value::BOTTOM);
+    if (l.kind == Value::TOP || r.kind == Value::TOP)
+      return Value(Value::TOP);
+    int v;
+    if (T::fold(e->op, l.c, r.c, &v))
+      return Value(Value::CONST, v);
+    return Value(Value::BOTTOM);
+  }
+  default:
+    // loads & calls
+    return Value(Value::BOTTOM);
+  }
+}
+
+void Propagator::lower(TEMP::Temp *t, Value v)
+{
+  Value &old = value[t];
+  v = meet(old, v);
+  if (v != old) {
+    old = v;
+    ssa_work.push(t);
+  }
+}
+
+void Propagator::reach(int from, TEMP::Label *target)
+{
+  auto it = index.find(target);
+  if (it != index.end())
+    cfg_work.push({from, it->second});
+}
+
+void Propagator::visitPhi(int b, Phi &phi)
+{
+  Value v;
+  for (auto &src : phi.src)
+    if (src.second && edges.count({src.first, b}))
+      v = meet(v, value[src.second]);
+  lower(phi.dst, v);
+}
+
+void Propagator::visit(int b, T::Stm *stm)
+{
+  if (TEMP::Temp *d = Def(stm)) {
+    lower(d, eval(((T::MoveStm *)stm)->src));
+  } else if (stm->kind == T::Stm::CJUMP) {
+    T::CjumpStm *s = (T::CjumpStm *)stm;
+    Value l = eval(s->left), r = eval(s->right);
+    if (l.kind == Value::CONST && r.kind == Value::CONST) {
+      reach(b, T::test(s->op, l.c, r.c) ? s->true_label : s->false_label);
+    } else if (l.kind == Value::BOTTOM || r.kind == Value::BOTTOM) {
+      reach(b, s->true_label);
+      reach(b, s->false_label);
+    }
+  } else if (stm->kind == T::Stm::JUMP) {
+    for (TEMP::LabelList *l = ((T::JumpStm *)stm)->jumps; l; l = l->tail)
+      reach(b, l->head);
+  }
+}
+
+void Propagator::run()
+{
+  cfg_work.push({-1, 0});
+  while (!cfg_work.empty() || !ssa_work.empty()) {
+    while (!cfg_work.empty()) {
+      std::pair<int, int> e = cfg_work.front();
+      cfg_work.pop();
+      if (!edges.insert(e).second)
+        continue;
+      int b = e.second;
+      for (Phi &phi : fn->phis[b])
+        visitPhi(b, phi);
+      if (executable[b])
+        continue;
+      executable[b] = true;
+      for (T::StmList *l = fn->blocks[b]; l; l = l->tail)
+        visit(b, l->head);
+    }
+    while (!ssa_work.empty()) {
+      TEMP::Temp *t = ssa_work.front();
+      ssa_work.pop();
+      for (Site &site : uses[t]) {
+        if (!executable[site.block])
+          continue;
+        if (site.phi >= 0)
+          visitPhi(site.block, fn->phis[site.block][site.phi]);
+        else
+          visit(site.block, site.stm);
+      }
+    }
+  }
+}
+
+void Propagator::rewrite()
+{
+  int consts = 0, branches = 0, removed = 0;
+  for (auto &it : value)
+    consts += it.second.kind == Value::CONST;
+  // the phis of constants go as their uses are replaced, except for those
+  // other phis still read from
+  std::map<TEMP::Temp *, Phi *> const_phi;
+  std::vector<TEMP::Temp *> work;
+  for (int b = 0; b < (int)fn->blocks.size(); b++)
+    if (fn->blocks[b] && executable[b])
+      for (Phi &phi : fn->phis[b]) {
+        if (value[phi.dst].kind == Value::CONST)
+          const_phi[phi.dst] = &phi;
+        else
+          for (auto &src : phi.src)
+            work.push_back(src.second);
+      }
+  std::set<TEMP::Temp *> read;
+  while (!work.empty()) {
+    TEMP::Temp *t = work.back();
+    work.pop_back();
+    auto it = const_phi.find(t);
+    if (it == const_phi.end() || !read.insert(t).second)
+      continue;
+    for (auto &src : it->second->src)
+      work.push_back(src.second);
+  }
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (!fn->blocks[b])
+      continue;
+    if (!executable[b]) {
+      fn->blocks[b] = nullptr;
+      fn->phis[b].clear();
+      removed++;
+      continue;
+    }
+    // so do the phi sources on edges that are never taken
+    std::vector<Phi> phis;
+    for (Phi &phi : fn->phis[b]) {
+      if (value[phi.dst].kind == Value::CONST && !read.count(phi.dst))
+        continue;
+      for (auto src = phi.src.begin(); src != phi.src.end();)
+        if (edges.count({src->first, b}))
+          src++;
+        else
+          src = phi.src.erase(src);
+      phis.push_back(phi);
+    }
+    fn->phis[b].swap(phis);
+
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      for (T::Exp **ref : Uses(l->head)) {
+        Value v = value[((T::TempExp *)*ref)->temp];
+        if (v.kind == Value::CONST)
+          *ref = new T::ConstExp(v.c);
+      }
+      switch (l->head->kind) {
+      case T::Stm::MOVE: {
+        T::MoveStm *s = (T::MoveStm *)l->head;
+        s->dst = fold(s->dst);
+        s->src = fold(s->src);
+        break;
+      }
+      case T::Stm::EXP:
+        ((T::ExpStm *)l->head)->exp = fold(((T::ExpStm *)l->head)->exp);
+        break;
+      case T::Stm::CJUMP: {
+        T::CjumpStm *s = (T::CjumpStm *)l->head;
+        s->left = fold(s->left);
+        s->right = fold(s->right);
+        if (isConst(s->left) && isConst(s->right)) {
+          TEMP::Label *target = T::test(s->op, constOf(s->left), constOf(s->right))
+            ? s->true_label : s->false_label;
+          l->head = new T::JumpStm(new T::NameExp(target), new TEMP::LabelList(target, nullptr));
+          branches++;
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+  std::cout << "SCCP: " << consts << " constant temps, " << branches
+            << " branches folded, " << removed << " blocks removed" << std::endl;
+}
+
+}  // namespace
+
+void PropagateConstants(Function *fn)
+{
+  Propagator p(fn);
+  p.run();
+  p.rewrite();
+  Analyze(fn);
+}
+
+}  // namespace SSA
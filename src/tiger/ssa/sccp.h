@@ -0,0 +1,17 @@
+#ifndef TIGER_SSA_SCCP_H_
+#define TIGER_SSA_SCCP_H_
+
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// sparse conditional constant propagation
+// temps that turn out to be constant are replaced by their values & the
+// constant expressions folded, conditional jumps that always go the same way
+// become jumps & the blocks that can't be reached are removed
+// the control flow of fn is analyzed again afterwards
+void PropagateConstants(Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_SCCP_H_
@@ -0,0 +1,795 @@
+#include "tiger/ssa/ssa.h"
+#include "tiger/frame/x64frame.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace SSA {
+
+namespace {
+
+typedef std::set<TEMP::Temp *> TempSet;
+
+T::Exp *clone(T::Exp *exp)
+{
+  switch (exp->kind) {
+  case T::Exp::BINOP: {
+    T::BinopExp *e = (T::BinopExp *)exp;
+    return new T::BinopExp(e->op, clone(e->left), clone(e->right));
+  }
+  case T::Exp::MEM:
+    return new T::MemExp(clone(((T::MemExp *)exp)->exp));
+  case T::Exp::TEMP:
+    return new T::TempExp(((T::TempExp *)exp)->temp);
+  case T::Exp::NAME:
+    return new T::NameExp(((T::NameExp *)exp)->name);
+  case T::Exp::CONST:
+    return new T::ConstExp(((T::ConstExp *)exp)->consti);
+  case T::Exp::CALL: {
+    T::CallExp *e = (T::CallExp *)exp;
+    T::ExpList *prehead = new T::ExpList(nullptr, nullptr), *tail = prehead;
+    for (T::ExpList *l = e->args; l; l = l->tail)
+      tail = tail->tail = new T::ExpList(clone(l->head), nullptr);
+    T::CallExp *call = new T::CallExp(clone(e->fun), prehead->tail);
+    call->tail = e->tail;
+    return call;
+  }
+  default:
+    // no ESEQ after canonicalization
+    assert(0);
+  }
+  return nullptr;
+}
+
+T::Stm *clone(T::Stm *stm)
+{
+  switch (stm->kind) {
+  case T::Stm::LABEL:
+    return new T::LabelStm(((T::LabelStm *)stm)->label);
+  case T::Stm::JUMP: {
+    T::JumpStm *s = (T::JumpStm *)stm;
+    return new T::JumpStm((T::NameExp *)clone(s->exp), s->jumps);
+  }
+  case T::Stm::CJUMP: {
+    T::CjumpStm *s = (T::CjumpStm *)stm;
+    return new T::CjumpStm(s->op, clone(s->left), clone(s->right), s->true_label, s->false_label);
+  }
+  case T::Stm::MOVE:
+    return new T::MoveStm(clone(((T::MoveStm *)stm)->dst), clone(((T::MoveStm *)stm)->src));
+  case T::Stm::EXP:
+    return new T::ExpStm(clone(((T::ExpStm *)stm)->exp));
+  default:
+    assert(0);
+  }
+  return nullptr;
+}
+
+void expUses(T::Exp **ref, std::vector<T::Exp **> &refs)
+{
+  T::Exp *exp = *ref;
+  switch (exp->kind) {
+  case T::Exp::BINOP:
+    expUses(&((T::BinopExp *)exp)->left, refs);
+    expUses(&((T::BinopExp *)exp)->right, refs);
+    break;
+  case T::Exp::MEM:
+    expUses(&((T::MemExp *)exp)->exp, refs);
+    break;
+  case T::Exp::TEMP:
+    if (IsVirtual(((T::TempExp *)exp)->temp))
+      refs.push_back(ref);
+    break;
+  case T::Exp::CALL:
+    expUses(&((T::CallExp *)exp)->fun, refs);
+    for (T::ExpList *l = ((T::CallExp *)exp)->args; l; l = l->tail)
+      expUses(&l->head, refs);
+    break;
+  default:
+    break;
+  }
+}
+
+inline TEMP::Temp *tempOf(T::Exp **ref) { return ((T::TempExp *)*ref)->temp; }
+
+// turn the parallel copies dst <- src into a sequence of moves
+// a copy goes once no other one still reads its destination, the cycles
+// that remain are broken up by saving a destination in a fresh temp first
+T::StmList *sequentialize(std::vector<std::pair<TEMP::Temp *, TEMP::Temp *>> moves)
+{
+  T::StmList *prehead = new T::StmList(nullptr, nullptr), *tail = prehead;
+  auto emit = [&tail](TEMP::Temp *dst, TEMP::Temp *src) {
+    tail = tail->tail = new T::StmList(
+      new T::MoveStm(new T::TempExp(dst), new T::TempExp(src)), nullptr);
+  };
+  while (!moves.empty()) {
+    bool emitted = false;
+    for (size_t i = 0; i < moves.size() && !emitted; i++) {
+      bool read = false;
+      for (size_t j = 0; j < moves.size(); j++)
+        read |= j != i && moves[j].second == moves[i].first;
+      if (read)
+        continue;
+      emit(moves[i].first, moves[i].second);
+      moves.erase(moves.begin() + i);
+      emitted = true;
+    }
+    if (emitted)
+      continue;
+    TEMP::Temp *dst = moves.back().first;
+    TEMP::Temp *save = TEMP::Temp::NewTemp();
+    emit(save, dst);
+    for (auto &m : moves)
+      if (m.second == dst)
+        m.second = save;
+  }
+  return prehead->tail;
+}
+
+}  // namespace
+
+bool IsVirtual(TEMP::Temp *t)
+{
+  return F::X64Frame::getTempMap()->Look(t) == nullptr;
+}
+
+TEMP::Temp *Def(T::Stm *stm)
+{
+  if (stm->kind != T::Stm::MOVE || ((T::MoveStm *)stm)->dst->kind != T::Exp::TEMP)
+    return nullptr;
+  TEMP::Temp *t = ((T::TempExp *)((T::MoveStm *)stm)->dst)->temp;
+  return IsVirtual(t) ? t : nullptr;
+}
+
+std::vector<T::Exp **> Uses(T::Stm *stm)
+{
+  std::vector<T::Exp **> refs;
+  switch (stm->kind) {
+  case T::Stm::MOVE: {
+    T::MoveStm *s = (T::MoveStm *)stm;
+    if (s->dst->kind == T::Exp::MEM)
+      expUses(&((T::MemExp *)s->dst)->exp, refs);
+    expUses(&s->src, refs);
+    break;
+  }
+  case T::Stm::EXP:
+    expUses(&((T::ExpStm *)stm)->exp, refs);
+    break;
+  case T::Stm::CJUMP:
+    expUses(&((T::CjumpStm *)stm)->left, refs);
+    expUses(&((T::CjumpStm *)stm)->right, refs);
+    break;
+  default:
+    break;
+  }
+  return refs;
+}
+
+TEMP::Label *LabelOf(T::StmList *block)
+{
+  assert(block->head->kind == T::Stm::LABEL);
+  return ((T::LabelStm *)block->head)->label;
+}
+
+T::Stm *LastOf(T::StmList *block)
+{
+  while (block->tail)
+    block = block->tail;
+  return block->head;
+}
+
+bool NoReturn(T::StmList *block)
+{
+  T::Stm *call = nullptr;
+  for (; block->tail; block = block->tail)
+    call = block->head;
+  if (!call || call->kind != T::Stm::EXP)
+    return false;
+  T::Exp *e = ((T::ExpStm *)call)->exp;
+  return e->kind == T::Exp::CALL && ((T::CallExp *)e)->fun->kind == T::Exp::NAME
+    && F::X64Frame::isNoReturn(((T::NameExp *)((T::CallExp *)e)->fun)->name);
+}
+
+bool IsLeaf(T::Exp *e)
+{
+  return e->kind == T::Exp::TEMP || e->kind == T::Exp::CONST || e->kind == T::Exp::NAME;
+}
+
+bool IsScaled(T::Exp *e)
+{
+  if (IsLeaf(e))
+    return true;
+  if (e->kind != T::Exp::BINOP || ((T::BinopExp *)e)->op != T::MUL_OP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)e;
+  if (!IsLeaf(b->left) || b->right->kind != T::Exp::CONST)
+    return false;
+  int scale = ((T::ConstExp *)b->right)->consti;
+  return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+bool IsIndexed(T::Exp *e)
+{
+  if (e->kind != T::Exp::BINOP || ((T::BinopExp *)e)->op != T::PLUS_OP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)e;
+  return (IsLeaf(b->left) && IsScaled(b->right)) || (IsScaled(b->left) && IsLeaf(b->right));
+}
+
+bool IsAddress(T::Exp *e)
+{
+  if (IsScaled(e) || IsIndexed(e))
+    return true;
+  if (e->kind != T::Exp::BINOP)
+    return false;
+  T::BinopExp *b = (T::BinopExp *)e;
+  if ((b->op == T::PLUS_OP || b->op == T::MINUS_OP) && b->right->kind == T::Exp::CONST)
+    return IsScaled(b->left) || IsIndexed(b->left);
+  return b->op == T::PLUS_OP && b->left->kind == T::Exp::CONST
+    && (IsScaled(b->right) || IsIndexed(b->right));
+}
+
+void Retarget(T::Stm *last, TEMP::Label *from, TEMP::Label *to)
+{
+  if (last->kind == T::Stm::CJUMP) {
+    T::CjumpStm *s = (T::CjumpStm *)last;
+    if (s->true_label == from)
+      s->true_label = to;
+    if (s->false_label == from)
+      s->false_label = to;
+    return;
+  }
+  T::JumpStm *s = (T::JumpStm *)last;
+  TEMP::LabelList *prehead = new TEMP::LabelList(nullptr, nullptr), *tail = prehead;
+  for (TEMP::LabelList *l = s->jumps; l; l = l->tail)
+    tail = tail->tail = new TEMP::LabelList(l->head == from ? to : l->head, nullptr);
+  s->jumps = prehead->tail;
+  if (s->exp->name == from)
+    s->exp = new T::NameExp(to);
+}
+
+bool Same(T::Exp *a, T::Exp *b)
+{
+  if (a->kind != b->kind)
+    return false;
+  switch (a->kind) {
+  case T::Exp::CONST:
+    return ((T::ConstExp *)a)->consti == ((T::ConstExp *)b)->consti;
+  case T::Exp::NAME:
+    return ((T::NameExp *)a)->name == ((T::NameExp *)b)->name;
+  case T::Exp::TEMP:
+    return ((T::TempExp *)a)->temp == ((T::TempExp *)b)->temp;
+  case T::Exp::BINOP:
+    return ((T::BinopExp *)a)->op == ((T::BinopExp *)b)->op
+      && Same(((T::BinopExp *)a)->left, ((T::BinopExp *)b)->left)
+      && Same(((T::BinopExp *)a)->right, ((T::BinopExp *)b)->right);
+  case T::Exp::MEM:
+    return Same(((T::MemExp *)a)->exp, ((T::MemExp *)b)->exp);
+  default:
+    return false;
+  }
+}
+
+std::vector<Loop> FindLoops(Function *fn)
+{
+  int n = fn->blocks.size();
+  std::map<int, std::vector<bool>> bodies;
+  for (int b : fn->preorder)
+    for (int h : fn->succ[b]) {
+      if (!fn->dominates(h, b))
+        continue;
+      std::vector<bool> &body = bodies[h];
+      if (body.empty()) {
+        body.assign(n, false);
+        body[h] = true;
+      }
+      std::vector<int> work{b};
+      while (!work.empty()) {
+        int x = work.back();
+        work.pop_back();
+        if (body[x])
+          continue;
+        body[x] = true;
+        for (int p : fn->pred[x])
+          if (fn->reachable(p))
+            work.push_back(p);
+      }
+    }
+  std::vector<Loop> loops;
+  for (auto &it : bodies)
+    loops.push_back(Loop{it.first, it.second, (int)std::count(it.second.begin(), it.second.end(), true)});
+  std::stable_sort(loops.begin(), loops.end(),
+    [](const Loop &a, const Loop &b) { return a.size < b.size; });
+  return loops;
+}
+
+int Preheader(Function *fn, const Loop &loop)
+{
+  int pre = -1;
+  for (int p : fn->pred[loop.header])
+    if (fn->reachable(p) && !loop.body[p]) {
+      if (pre >= 0 || fn->succ[p].size() != 1)
+        return -1;
+      pre = p;
+    }
+  return pre;
+}
+
+bool Function::dominates(int a, int b) const
+{
+  while (b != a) {
+    if (idom[b] == b || idom[b] == -1)
+      return false;
+    b = idom[b];
+  }
+  return true;
+}
+
+// dominators with the iterative algorithm of Cooper et al., as in
+// FG::Dominators
+void Analyze(Function *fn)
+{
+  int n = fn->blocks.size();
+  std::map<TEMP::Label *, int> index;
+  for (int b = 0; b < n; b++)
+    if (fn->blocks[b])
+      index[LabelOf(fn->blocks[b])] = b;
+  fn->succ.assign(n, std::vector<int>());
+  fn->pred.assign(n, std::vector<int>());
+  auto edge = [&](int b, TEMP::Label *target) {
+    auto it = index.find(target);
+    if (it == index.end())
+      return;
+    std::vector<int> &s = fn->succ[b];
+    if (std::find(s.begin(), s.end(), it->second) != s.end())
+      return;
+    s.push_back(it->second);
+    fn->pred[it->second].push_back(b);
+  };
+  for (int b = 0; b < n; b++) {
+    if (!fn->blocks[b])
+      continue;
+    if (NoReturn(fn->blocks[b]))
+      continue;
+    T::Stm *last = LastOf(fn->blocks[b]);
+    if (last->kind == T::Stm::JUMP) {
+      for (TEMP::LabelList *l = ((T::JumpStm *)last)->jumps; l; l = l->tail)
+        edge(b, l->head);
+    } else {
+      assert(last->kind == T::Stm::CJUMP);
+      edge(b, ((T::CjumpStm *)last)->true_label);
+      edge(b, ((T::CjumpStm *)last)->false_label);
+    }
+  }
+
+  // reverse post order from the entry
+  std::vector<int> rpo, rpo_index(n, -1);
+  std::vector<bool> visited(n, false);
+  std::vector<std::pair<int, size_t>> stack{{0, 0}};
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    if (top.second < fn->succ[top.first].size()) {
+      int s = fn->succ[top.first][top.second++];
+      if (!visited[s]) {
+        visited[s] = true;
+        stack.push_back({s, 0});
+      }
+    } else {
+      rpo.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  std::reverse(rpo.begin(), rpo.end());
+  for (int i = 0; i < (int)rpo.size(); i++)
+    rpo_index[rpo[i]] = i;
+
+  std::vector<int> &idom = fn->idom;
+  idom.assign(n, -1);
+  idom[0] = 0;
+  bool changed;
+  do {
+    changed = false;
+    for (int i = 1; i < (int)rpo.size(); i++) {
+      int b = rpo[i], new_idom = -1;
+      for (int p : fn->pred[b]) {
+        if (idom[p] == -1)
+          continue;
+        if (new_idom == -1) {
+          new_idom = p;
+          continue;
+        }
+        int x = p, y = new_idom;
+        while (x != y) {
+          while (rpo_index[x] > rpo_index[y]) x = idom[x];
+          while (rpo_index[y] > rpo_index[x]) y = idom[y];
+        }
+        new_idom = x;
+      }
+      if (idom[b] != new_idom) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  fn->children.assign(n, std::vector<int>());
+  for (int b : rpo)
+    if (b != 0)
+      fn->children[idom[b]].push_back(b);
+  fn->preorder.clear();
+  std::vector<int> work{0};
+  while (!work.empty()) {
+    int b = work.back();
+    work.pop_back();
+    fn->preorder.push_back(b);
+    for (auto c = fn->children[b].rbegin(); c != fn->children[b].rend(); c++)
+      work.push_back(*c);
+  }
+
+  fn->df.assign(n, std::set<int>());
+  for (int b : rpo) {
+    int preds = 0;
+    for (int p : fn->pred[b])
+      preds += idom[p] != -1;
+    if (preds < 2)
+      continue;
+    for (int p : fn->pred[b]) {
+      if (idom[p] == -1)
+        continue;
+      for (int runner = p; runner != idom[b]; runner = idom[runner])
+        fn->df[runner].insert(b);
+    }
+  }
+}
+
+std::vector<std::set<TEMP::Temp *>> LiveIn(Function *fn)
+{
+  int n = fn->blocks.size();
+  std::vector<TempSet> use(n), def(n), in(n);
+  for (int b : fn->preorder) {
+    for (Phi &phi : fn->phis[b])
+      def[b].insert(phi.dst);
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      for (T::Exp **ref : Uses(l->head))
+        if (def[b].find(tempOf(ref)) == def[b].end())
+          use[b].insert(tempOf(ref));
+      if (TEMP::Temp *d = Def(l->head))
+        def[b].insert(d);
+    }
+  }
+  bool changed;
+  do {
+    changed = false;
+    for (auto b = fn->preorder.rbegin(); b != fn->preorder.rend(); b++) {
+      TempSet i = use[*b];
+      for (int s : fn->succ[*b]) {
+        for (TEMP::Temp *t : in[s])
+          if (def[*b].find(t) == def[*b].end())
+            i.insert(t);
+        for (Phi &phi : fn->phis[s]) {
+          auto src = phi.src.find(*b);
+          if (src != phi.src.end() && src->second && def[*b].find(src->second) == def[*b].end())
+            i.insert(src->second);
+        }
+      }
+      if (i != in[*b]) {
+        in[*b].swap(i);
+        changed = true;
+      }
+    }
+  } while (changed);
+  return in;
+}
+
+Function *Build(C::Block block)
+{
+  Function *fn = new Function();
+  fn->exit = block.label;
+  for (C::StmListList *sl = block.stmLists; sl; sl = sl->tail) {
+    T::StmList *prehead = new T::StmList(nullptr, nullptr), *tail = prehead;
+    for (T::StmList *l = sl->head; l; l = l->tail)
+      tail = tail->tail = new T::StmList(clone(l->head), nullptr);
+    fn->blocks.push_back(prehead->tail);
+  }
+  Analyze(fn);
+  // the entry can't have phi nodes, give it a block of its own if it's the
+  // target of a jump
+  if (!fn->pred[0].empty()) {
+    TEMP::Label *entry = TEMP::NewLabel(), *target = LabelOf(fn->blocks[0]);
+    fn->blocks.insert(fn->blocks.begin(), new T::StmList(new T::LabelStm(entry),
+      new T::StmList(new T::JumpStm(new T::NameExp(target),
+        new TEMP::LabelList(target, nullptr)), nullptr)));
+    Analyze(fn);
+  }
+  int n = fn->blocks.size();
+  fn->phis.assign(n, std::vector<Phi>());
+
+  // liveness of virtual temps at block boundaries, for pruning
+  std::vector<TempSet> use(n), def(n), in(n), out(n);
+  std::map<TEMP::Temp *, std::vector<int>> def_blocks;
+  std::map<TEMP::Temp *, int> def_count;
+  for (int b : fn->preorder) {
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      for (T::Exp **ref : Uses(l->head))
+        if (def[b].find(tempOf(ref)) == def[b].end())
+          use[b].insert(tempOf(ref));
+      if (TEMP::Temp *d = Def(l->head)) {
+        def[b].insert(d);
+        def_count[d]++;
+        std::vector<int> &blocks = def_blocks[d];
+        if (blocks.empty() || blocks.back() != b)
+          blocks.push_back(b);
+      }
+    }
+  }
+  bool changed;
+  do {
+    changed = false;
+    for (auto b = fn->preorder.rbegin(); b != fn->preorder.rend(); b++) {
+      TempSet o, i = use[*b];
+      for (int s : fn->succ[*b])
+        o.insert(in[s].begin(), in[s].end());
+      for (TEMP::Temp *t : o)
+        if (def[*b].find(t) == def[*b].end())
+          i.insert(t);
+      if (i != in[*b] || o != out[*b]) {
+        in[*b].swap(i);
+        out[*b].swap(o);
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  // temps that may be used before they're set start out as 0, so that every
+  // use has a definition dominating it
+  T::StmList *entry = fn->blocks[0];
+  for (TEMP::Temp *t : in[0]) {
+    entry->tail = new T::StmList(
+      new T::MoveStm(new T::TempExp(t), new T::ConstExp(0)), entry->tail);
+    if (def_count[t]++ == 0 || def_blocks[t][0] != 0)
+      def_blocks[t].insert(def_blocks[t].begin(), 0);
+  }
+  in[0].clear();
+
+  // pruned phi placement, at the iterated dominance frontier of the
+  // definitions where the temp is live
+  std::set<TEMP::Temp *> renamed;
+  for (auto &it : def_blocks) {
+    TEMP::Temp *v = it.first;
+    if (def_count[v] < 2)
+      continue;
+    renamed.insert(v);
+    std::vector<bool> has_phi(n, false), queued(n, false);
+    std::vector<int> work = it.second;
+    for (int b : work)
+      queued[b] = true;
+    while (!work.empty()) {
+      int x = work.back();
+      work.pop_back();
+      for (int b : fn->df[x]) {
+        if (has_phi[b] || in[b].find(v) == in[b].end())
+          continue;
+        has_phi[b] = true;
+        fn->phis[b].push_back(Phi{v, nullptr, {}});
+        if (!queued[b]) {
+          queued[b] = true;
+          work.push_back(b);
+        }
+      }
+    }
+  }
+
+  // rename along the dominator tree
+  std::map<TEMP::Temp *, std::vector<TEMP::Temp *>> names;
+  std::vector<std::vector<TEMP::Temp *>> pushed(n);
+  auto current = [&](TEMP::Temp *v) -> TEMP::Temp * {
+    std::vector<TEMP::Temp *> &s = names[v];
+    return s.empty() ? nullptr : s.back();
+  };
+  std::vector<std::pair<int, bool>> walk{{0, false}};
+  while (!walk.empty()) {
+    int b = walk.back().first;
+    bool leaving = walk.back().second;
+    walk.pop_back();
+    if (leaving) {
+      for (TEMP::Temp *v : pushed[b])
+        names[v].pop_back();
+      continue;
+    }
+    walk.push_back({b, true});
+    for (Phi &phi : fn->phis[b]) {
+      phi.dst = TEMP::Temp::NewTemp();
+      names[phi.var].push_back(phi.dst);
+      pushed[b].push_back(phi.var);
+    }
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail) {
+      for (T::Exp **ref : Uses(l->head))
+        if (renamed.find(tempOf(ref)) != renamed.end())
+          ((T::TempExp *)*ref)->temp = current(tempOf(ref));
+      TEMP::Temp *d = Def(l->head);
+      if (d && renamed.find(d) != renamed.end()) {
+        TEMP::Temp *t = TEMP::Temp::NewTemp();
+        names[d].push_back(t);
+        pushed[b].push_back(d);
+        ((T::TempExp *)((T::MoveStm *)l->head)->dst)->temp = t;
+      }
+    }
+    for (int s : fn->succ[b])
+      for (Phi &phi : fn->phis[s])
+        phi.src[b] = current(phi.var);
+    for (auto c = fn->children[b].rbegin(); c != fn->children[b].rend(); c++)
+      walk.push_back({*c, false});
+  }
+  return fn;
+}
+
+bool Verify(Function *fn)
+{
+  int n = fn->blocks.size();
+  // where each temp is defined, -1 for phi nodes
+  std::map<TEMP::Temp *, std::pair<int, int>> def_at;
+  auto fail = [](const std::string &what, TEMP::Temp *t) {
+    std::cout << "SSA: " << what << " t" << (t ? t->Int() : -1) << std::endl;
+    return false;
+  };
+  for (int b = 0; b < n; b++) {
+    if (!fn->reachable(b))
+      continue;
+    for (Phi &phi : fn->phis[b])
+      if (!def_at.insert({phi.dst, {b, -1}}).second)
+        return fail("defined twice", phi.dst);
+    int i = 0;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail, i++)
+      if (TEMP::Temp *d = Def(l->head))
+        if (!def_at.insert({d, {b, i}}).second)
+          return fail("defined twice", d);
+  }
+  for (int b = 0; b < n; b++) {
+    if (!fn->reachable(b))
+      continue;
+    int i = 0;
+    for (T::StmList *l = fn->blocks[b]; l; l = l->tail, i++) {
+      for (T::Exp **ref : Uses(l->head)) {
+        auto it = def_at.find(tempOf(ref));
+        if (it == def_at.end())
+          return fail("used without definition", tempOf(ref));
+        int db = it->second.first, di = it->second.second;
+        if (db == b ? di >= i : !fn->dominates(db, b))
+          return fail("use not dominated by definition", tempOf(ref));
+      }
+    }
+    for (Phi &phi : fn->phis[b]) {
+      for (int p : fn->pred[b]) {
+        if (!fn->reachable(p))
+          continue;
+        auto src = phi.src.find(p);
+        if (src == phi.src.end() || !src->second)
+          return fail("phi without source for a predecessor", phi.dst);
+        auto it = def_at.find(src->second);
+        if (it == def_at.end())
+          return fail("phi source without definition", src->second);
+        if (!fn->dominates(it->second.first, p))
+          return fail("phi source not dominating its predecessor", src->second);
+      }
+    }
+  }
+  return true;
+}
+
+C::Block Destruct(Function *fn)
+{
+  int n = fn->blocks.size();
+  std::vector<TempSet> live_in = LiveIn(fn);
+  std::map<TEMP::Label *, int> index;
+  for (int b = 0; b < n; b++)
+    if (fn->blocks[b])
+      index[LabelOf(fn->blocks[b])] = b;
+  typedef std::vector<std::pair<TEMP::Temp *, TEMP::Temp *>> Moves;
+  auto movesOn = [fn](int p, int b) {
+    Moves moves;
+    for (Phi &phi : fn->phis[b])
+      if (phi.src[p] != phi.dst)
+        moves.push_back({phi.dst, phi.src[p]});
+    return moves;
+  };
+  // whether the copies on edge p -> b leave what edge p -> other needs alone
+  auto harmless = [&](int p, const Moves &moves, TEMP::Label *other) {
+    auto it = index.find(other);
+    if (it == index.end())
+      return true;
+    int o = it->second;
+    for (auto &m : moves) {
+      if (live_in[o].find(m.first) != live_in[o].end())
+        return false;
+      for (Phi &phi : fn->phis[o])
+        if (phi.src[p] == m.first)
+          return false;
+    }
+    return true;
+  };
+
+  std::vector<T::StmList *> split;
+  for (int p = 0; p < n; p++) {
+    if (!fn->reachable(p))
+      continue;
+    T::StmList *last = fn->blocks[p];
+    while (last->tail->tail)
+      last = last->tail;
+    for (int b : fn->succ[p]) {
+      Moves moves = movesOn(p, b);
+      if (moves.empty())
+        continue;
+      T::StmList *copies = sequentialize(moves);
+      T::StmList *tail = copies;
+      while (tail->tail)
+        tail = tail->tail;
+      TEMP::Label *target = LabelOf(fn->blocks[b]);
+      // copies go right before the jump, for a conditional one only if it
+      // doesn't read what they write & they're harmless on the other edge
+      bool before_jump = true;
+      if (last->tail->head->kind == T::Stm::CJUMP) {
+        T::CjumpStm *cjump = (T::CjumpStm *)last->tail->head;
+        for (T::Exp **ref : Uses(cjump))
+          for (auto &m : moves)
+            before_jump &= tempOf(ref) != m.first;
+        before_jump &= harmless(p, moves,
+          cjump->true_label == target ? cjump->false_label : cjump->true_label);
+      }
+      if (before_jump) {
+        // a conditional jump reads the copies instead, so that what they
+        // copy from can die at the copy & be coalesced with it
+        if (last->tail->head->kind == T::Stm::CJUMP)
+          for (T::Exp **ref : Uses(last->tail->head))
+            for (auto &m : moves)
+              if (tempOf(ref) == m.second) {
+                *ref = new T::TempExp(m.first);
+                break;
+              }
+        tail->tail = last->tail;
+        last->tail = copies;
+        last = tail;
+        continue;
+      }
+      // otherwise the copies get a block of their own on the edge
+      T::CjumpStm *cjump = (T::CjumpStm *)last->tail->head;
+      TEMP::Label *label = TEMP::NewLabel();
+      if (cjump->true_label == target)
+        cjump->true_label = label;
+      if (cjump->false_label == target)
+        cjump->false_label = label;
+      tail->tail = new T::StmList(new T::JumpStm(new T::NameExp(target),
+        new TEMP::LabelList(target, nullptr)), nullptr);
+      split.push_back(new T::StmList(new T::LabelStm(label), copies));
+    }
+  }
+
+  C::Block block;
+  block.label = fn->exit;
+  C::StmListList *prehead = new C::StmListList(nullptr, nullptr), *tail = prehead;
+  for (T::StmList *b : fn->blocks)
+    if (b)
+      tail = tail->tail = new C::StmListList(b, nullptr);
+  for (T::StmList *b : split)
+    tail = tail->tail = new C::StmListList(b, nullptr);
+  block.stmLists = prehead->tail;
+  return block;
+}
+
+void Print(FILE *out, Function *fn)
+{
+  for (int b = 0; b < (int)fn->blocks.size(); b++) {
+    if (!fn->blocks[b])
+      continue;
+    fprintf(out, "block %d, idom %d\n", b, fn->idom[b]);
+    for (Phi &phi : fn->phis[b]) {
+      fprintf(out, "t%d <- phi(", phi.dst->Int());
+      for (auto it = phi.src.begin(); it != phi.src.end(); it++)
+        fprintf(out, "%s%d: t%d", it == phi.src.begin() ? "" : ", ", it->first,
+          it->second ? it->second->Int() : -1);
+      fprintf(out, ")\n");
+    }
+    fn->blocks[b]->Print(out);
+  }
+}
+
+}  // namespace SSA
@@ -0,0 +1,114 @@
+#ifndef TIGER_SSA_SSA_H_
+#define TIGER_SSA_SSA_H_
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/frame/temp.h"
+#include "tiger/translate/tree.h"
+
+namespace SSA {
+
+// a phi node at the start of a block, with one source per predecessor
+// keyed by the predecessor's block index
+class Phi {
+ public:
+  TEMP::Temp *var;  // the temp before renaming
+  TEMP::Temp *dst;
+  std::map<int, TEMP::Temp *> src;
+};
+
+// the basic blocks of a function, with the temps in SSA form
+// every block starts with its LABEL and ends with a JUMP or CJUMP as in
+// C::Block, block 0 is the entry, blocks removed by a pass are nullptr
+// jumps to the exit label leave the function and aren't edges, neither
+// are the jumps after a call that never returns
+// only virtual temps are renamed, the precolored ones keep their names
+class Function {
+ public:
+  std::vector<T::StmList *> blocks;
+  std::vector<std::vector<Phi>> phis;
+  TEMP::Label *exit;
+
+  // filled in by Analyze
+  std::vector<std::vector<int>> succ, pred;
+  std::vector<int> idom;  // -1 for unreachable blocks, the entry is its own
+  std::vector<std::vector<int>> children;  // in the dominator tree
+  std::vector<std::set<int>> df;           // dominance frontiers
+  std::vector<int> preorder;               // of the dominator tree
+
+  bool reachable(int b) const { return blocks[b] && idom[b] != -1; }
+  bool dominates(int a, int b) const;
+};
+
+bool IsVirtual(TEMP::Temp *t);
+// the virtual temp a statement defines, or nullptr
+TEMP::Temp *Def(T::Stm *stm);
+// references to the TempExps of the virtual temps a statement uses
+std::vector<T::Exp **> Uses(T::Stm *stm);
+TEMP::Label *LabelOf(T::StmList *block);
+T::Stm *LastOf(T::StmList *block);
+// whether a block ends in a call to a runtime function that never returns,
+// the jump after it is never taken
+bool NoReturn(T::StmList *block);
+// point the jump or conditional jump ending a block at to instead of from
+void Retarget(T::Stm *last, TEMP::Label *from, TEMP::Label *to);
+
+// the shapes of expressions codegen folds into an operand
+bool IsLeaf(T::Exp *e);
+// a leaf, or a leaf times 1, 2, 4 or 8
+bool IsScaled(T::Exp *e);
+// base + index * scale
+bool IsIndexed(T::Exp *e);
+// any of those plus a constant, what a single leaq computes
+bool IsAddress(T::Exp *e);
+
+// the same tree, CALLs never are
+bool Same(T::Exp *a, T::Exp *b);
+
+// a natural loop, the loops sharing a header are one
+class Loop {
+ public:
+  int header;
+  std::vector<bool> body;  // by block index
+  int size;
+};
+
+// the loops of a function, smaller ones first so inner loops come before
+// the loops around them
+std::vector<Loop> FindLoops(Function *fn);
+// the only block outside a loop jumping to its header, if that's all it
+// does, or -1
+int Preheader(Function *fn, const Loop &loop);
+
+// the control flow graph & dominator tree of the blocks, again after a pass
+// changed jumps or removed blocks
+void Analyze(Function *fn);
+
+// virtual temps live on entry to each block, before its phi nodes
+// phi sources count as live out of the predecessor they come from
+std::vector<std::set<TEMP::Temp *>> LiveIn(Function *fn);
+
+// into pruned SSA form, the statements are copied so the blocks given are
+// left alone
+// temps used before any definition are set to 0 at the entry
+Function *Build(C::Block block);
+
+// check that every virtual temp is defined once & every use is dominated
+// by its definition, prints the first violation
+bool Verify(Function *fn);
+
+// out of SSA form, phi nodes become copies at the end of the predecessors
+// the parallel copies are sequentialized so that swapped values aren't
+// clobbered, & critical edges are split unless the copies can't be seen on
+// the other edge, so that no value still needed there gets lost
+C::Block Destruct(Function *fn);
+
+void Print(FILE *out, Function *fn);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_SSA_H_
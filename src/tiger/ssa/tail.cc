@@ -0,0 +1,256 @@
+#include "tiger/ssa/tail.h"
+#include "tiger/frame/x64frame.h"
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace SSA {
+
+namespace {
+
+typedef std::map<TEMP::Label *, T::StmList *> BlockMap;
+typedef std::map<TEMP::Temp *, std::vector<T::Exp *>> DefMap;
+
+// the call a statement makes, its result in a temp or ignored, or nullptr
+T::CallExp *callOf(T::Stm *stm)
+{
+  T::Exp *exp;
+  if (stm->kind == T::Stm::EXP)
+    exp = ((T::ExpStm *)stm)->exp;
+  else if (stm->kind == T::Stm::MOVE && ((T::MoveStm *)stm)->dst->kind == T::Exp::TEMP)
+    exp = ((T::MoveStm *)stm)->src;
+  else
+    return nullptr;
+  if (exp->kind != T::Exp::CALL || ((T::CallExp *)exp)->fun->kind != T::Exp::NAME)
+    return nullptr;
+  return (T::CallExp *)exp;
+}
+
+// the temp a call's result goes to, nullptr if it's ignored
+TEMP::Temp *resultOf(T::Stm *stm)
+{
+  if (stm->kind != T::Stm::MOVE)
+    return nullptr;
+  return ((T::TempExp *)((T::MoveStm *)stm)->dst)->temp;
+}
+
+// whether the rest of a block from stms on, and the blocks it goes on to,
+// return value & do nothing else that's still needed once the function has
+// returned, copies only
+// procedures don't set the return value at all, the value doesn't matter
+bool returns(const BlockMap &blocks, TEMP::Label *exit, T::StmList *stms,
+             TEMP::Temp *value, F::Frame *frame)
+{
+  std::set<TEMP::Temp *> copies = {value};
+  std::set<TEMP::Label *> visited;
+  while (stms) {
+    T::Stm *stm = stms->head;
+    stms = stms->tail;
+    switch (stm->kind) {
+    case T::Stm::LABEL:
+      break;
+    case T::Stm::MOVE: {
+      T::MoveStm *move = (T::MoveStm *)stm;
+      if (move->dst->kind != T::Exp::TEMP
+          || (move->src->kind != T::Exp::TEMP && move->src->kind != T::Exp::CONST))
+        return false;
+      TEMP::Temp *dst = ((T::TempExp *)move->dst)->temp;
+      bool copy = move->src->kind == T::Exp::TEMP
+        && copies.count(((T::TempExp *)move->src)->temp);
+      if (dst == frame->getReturnValue()) {
+        if (!copy)
+          return false;
+      } else if (!IsVirtual(dst)) {
+        return false;
+      } else if (copy) {
+        copies.insert(dst);
+      } else {
+        copies.erase(dst);
+      }
+      break;
+    }
+    case T::Stm::JUMP: {
+      T::JumpStm *jump = (T::JumpStm *)stm;
+      if (jump->exp->kind != T::Exp::NAME || jump->jumps->tail)
+        return false;
+      TEMP::Label *target = jump->jumps->head;
+      if (target == exit)
+        return true;
+      auto it = blocks.find(target);
+      if (it == blocks.end() || !visited.insert(target).second)
+        return false;
+      stms = it->second;
+      break;
+    }
+    case T::Stm::EXP:
+      if (((T::ExpStm *)stm)->exp->kind == T::Exp::CALL)
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+// an address in the frame, which a callee of a frame that's gone can't use
+// loads from the frame are only values
+// canon copies fp into a temp of its own when a later argument has effects,
+// so temps count as whatever they're set to anywhere in the function
+bool inFrame(T::Exp *exp, F::Frame *frame, const DefMap &defs,
+             std::set<TEMP::Temp *> &visited)
+{
+  switch (exp->kind) {
+  case T::Exp::TEMP: {
+    TEMP::Temp *temp = ((T::TempExp *)exp)->temp;
+    if (temp == frame->getFramePointer())
+      return true;
+    auto it = defs.find(temp);
+    if (it == defs.end() || !visited.insert(temp).second)
+      return false;
+    for (T::Exp *src : it->second)
+      if (inFrame(src, frame, defs, visited))
+        return true;
+    return false;
+  }
+  case T::Exp::BINOP:
+    return inFrame(((T::BinopExp *)exp)->left, frame, defs, visited)
+      || inFrame(((T::BinopExp *)exp)->right, frame, defs, visited);
+  default:
+    return false;
+  }
+}
+
+bool isSelf(T::CallExp *call, F::Frame *frame)
+{
+  return ((T::NameExp *)call->fun)->name == frame->label;
+}
+
+// whether the callee can run on the caller's return address, with the
+// caller's frame gone
+bool isSibling(T::CallExp *call, F::Frame *frame, const DefMap &defs)
+{
+  TEMP::Label *label = ((T::NameExp *)call->fun)->name;
+  if (F::X64Frame::isNoReturn(label))
+    return false;
+  int args = 0;
+  std::set<TEMP::Temp *> visited;
+  for (T::ExpList *l = call->args; l; l = l->tail, args++)
+    if (inFrame(l->head, frame, defs, visited))
+      return false;
+  return args <= F::X64Frame::param_reg_count;
+}
+
+// the call ending a block in tail position, with the statements before it
+// in prehead's list
+T::StmList *tailCall(const BlockMap &blocks, TEMP::Label *exit, T::StmList *prehead,
+                     F::Frame *frame)
+{
+  T::StmList *last = nullptr;
+  for (T::StmList *l = prehead; l->tail; l = l->tail) {
+    if (callOf(l->tail->head)
+        && returns(blocks, exit, l->tail->tail, resultOf(l->tail->head), frame))
+      last = l;
+  }
+  return last;
+}
+
+// formals set to the arguments, all of them read before any is written,
+// then back to the start of the body
+T::StmList *selfCall(T::CallExp *call, F::Frame *frame, TEMP::Label *entry)
+{
+  T::StmList *prehead = new T::StmList(nullptr, nullptr), *tail = prehead;
+  std::vector<std::pair<T::Exp *, TEMP::Temp *>> sets;
+  F::AccessList *formals = frame->getFormals();
+  for (T::ExpList *l = call->args; l; l = l->tail, formals = formals->tail) {
+    T::Exp *formal = formals->head->toExp(frame->getFramePointerExp());
+    // what a formal is passed on unchanged, the static link at least
+    if (Same(formal, l->head))
+      continue;
+    TEMP::Temp *t = TEMP::Temp::NewTemp();
+    tail = tail->tail = new T::StmList(new T::MoveStm(new T::TempExp(t), l->head), nullptr);
+    sets.push_back({formal, t});
+  }
+  assert(formals == nullptr);
+  for (auto &set : sets)
+    tail = tail->tail = new T::StmList(
+      new T::MoveStm(set.first, new T::TempExp(set.second)), nullptr);
+  tail->tail = new T::StmList(
+    new T::JumpStm(new T::NameExp(entry), new TEMP::LabelList(entry, nullptr)), nullptr);
+  return prehead->tail;
+}
+
+}  // namespace
+
+C::Block EliminateTailCalls(C::Block block, F::Frame *frame)
+{
+  std::vector<T::StmList *> blocks;
+  for (C::StmListList *l = block.stmLists; l; l = l->tail)
+    blocks.push_back(l->head);
+  BlockMap index;
+  DefMap defs;
+  for (T::StmList *b : blocks) {
+    index[LabelOf(b)] = b;
+    for (T::StmList *l = b; l; l = l->tail) {
+      if (l->head->kind != T::Stm::MOVE)
+        continue;
+      T::MoveStm *move = (T::MoveStm *)l->head;
+      if (move->dst->kind == T::Exp::TEMP)
+        defs[((T::TempExp *)move->dst)->temp].push_back(move->src);
+    }
+  }
+
+  // the body starts after the view shift in the entry block, a block of
+  // its own if a call is to come back there
+  TEMP::Label *entry = nullptr;
+  for (size_t b = 0; b < blocks.size() && !entry; b++) {
+    T::StmList *prehead = new T::StmList(nullptr, blocks[b]);
+    T::StmList *at = tailCall(index, block.label, prehead, frame);
+    if (at && isSelf(callOf(at->tail->head), frame)) {
+      entry = TEMP::NewLabel();
+      T::StmList *shift = blocks[0];
+      for (int i = ((F::X64Frame *)frame)->viewShiftLength(); i > 0; i--)
+        shift = shift->tail;
+      T::StmList *body = new T::StmList(new T::LabelStm(entry), shift->tail);
+      shift->tail = new T::StmList(
+        new T::JumpStm(new T::NameExp(entry), new TEMP::LabelList(entry, nullptr)), nullptr);
+      blocks.insert(blocks.begin() + 1, body);
+      index[entry] = body;
+    }
+  }
+
+  int self = 0, sibling = 0;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    T::StmList *prehead = new T::StmList(nullptr, blocks[b]);
+    T::StmList *at = tailCall(index, block.label, prehead, frame);
+    if (!at)
+      continue;
+    T::CallExp *call = callOf(at->tail->head);
+    if (isSelf(call, frame)) {
+      at->tail = selfCall(call, frame, entry);
+      self++;
+    } else if (isSibling(call, frame, defs)) {
+      call->tail = true;
+      at->tail = new T::StmList(new T::ExpStm(call),
+        new T::StmList(new T::JumpStm(new T::NameExp(block.label),
+          new TEMP::LabelList(block.label, nullptr)), nullptr));
+      sibling++;
+    } else {
+      continue;
+    }
+    blocks[b] = prehead->tail;
+    index[LabelOf(blocks[b])] = blocks[b];
+  }
+
+  C::StmListList *prehead = new C::StmListList(nullptr, nullptr), *tail = prehead;
+  for (T::StmList *b : blocks)
+    tail = tail->tail = new C::StmListList(b, nullptr);
+  block.stmLists = prehead->tail;
+  std::cout << "TCE: " << self << " self & " << sibling << " sibling tail calls in "
+            << frame->label->Name() << std::endl;
+  return block;
+}
+
+}  // namespace SSA
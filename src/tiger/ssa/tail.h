@@ -0,0 +1,22 @@
+#ifndef TIGER_SSA_TAIL_H_
+#define TIGER_SSA_TAIL_H_
+
+#include "tiger/frame/frame.h"
+#include "tiger/ssa/ssa.h"
+
+namespace SSA {
+
+// tail call elimination, on the basic blocks before they go into SSA form
+// a call is in tail position if from there to the exit nothing but copies
+// of its result happen, the last into the return value
+// a call of the function to itself sets the formals to the arguments and
+// jumps back to where the body starts, past the view shift, so the
+// recursion becomes a loop
+// other calls passing no more arguments than fit in registers, none of
+// them our own frame as a static link, are only marked, codegen makes them
+// a jmp after the epilogue, and the callee returns to our caller
+C::Block EliminateTailCalls(C::Block block, F::Frame *frame);
+
+}  // namespace SSA
+
+#endif  // TIGER_SSA_TAIL_H_
@@ -2,11 +2,14 @@
 
 #include <cassert>
 #include <cstdio>
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "tiger/errormsg/errormsg.h"
 #include "tiger/frame/temp.h"
+#include "tiger/inline/inline.h"
 #include "tiger/semant/semant.h"
 #include "tiger/semant/types.h"
 #include "tiger/util/util.h"
@@ -46,10 +49,122 @@ static TY::FieldList* make_fieldlist(TEnvType tenv, A::FieldList* fields)
       make_fieldlist(tenv, fields->tail));
 }
 
+// a comparison, or a constant that reads the same as one
+static bool isCondition(TR::Exp* exp)
+{
+  if (exp->kind == TR::Exp::CX)
+    return true;
+  if (exp->kind != TR::Exp::EX || ((TR::ExExp*)exp)->exp->kind != T::Exp::CONST)
+    return false;
+  int value = ((T::ConstExp*)((TR::ExExp*)exp)->exp)->consti;
+  return value == 0 || value == 1;
+}
+
+// a function calls to which may be inlined, with what the names its body
+// takes from outside meant where it was declared
+class Inlinee {
+ public:
+  A::FunDec* dec;
+  INL::FunInfo* info;
+  std::map<S::Symbol*, E::EnvEntry*> names;
+  std::map<S::Symbol*, TY::Ty*> types;
+  // an expansion reported errors in the body, not to be checked again
+  bool errors;
+
+  Inlinee(A::FunDec* dec, INL::FunInfo* info) : dec(dec), info(info), errors(false) {}
+};
+
+static std::map<E::FunEntry*, Inlinee*> inlinees;
+// functions being expanded, innermost last
+static std::vector<E::FunEntry*> expanding;
+static int inlined = 0;
+
+static void makeInlinee(VEnvType venv, TEnvType tenv, E::FunEntry* fun, A::FunDec* dec)
+{
+  INL::FunInfo* info = INL::Info(dec);
+  if (info == nullptr || !info->inlinable)
+    return;
+  Inlinee* inlinee = new Inlinee(dec, info);
+  for (S::Symbol* name : info->free_names)
+    inlinee->names[name] = venv->Look(name);
+  for (S::Symbol* name : info->free_types)
+    inlinee->types[name] = tenv->Look(name);
+  inlinees[fun] = inlinee;
+}
+
+// the callee if a call to fun here should be inlined, the names its body
+// takes from outside must mean here what they did where it was declared
+static Inlinee* inlineCandidate(VEnvType venv, TEnvType tenv, E::FunEntry* fun,
+    int args, int constant_args)
+{
+  auto it = inlinees.find(fun);
+  if (it == inlinees.end())
+    return nullptr;
+  Inlinee* inlinee = it->second;
+  // past the first error a copy would only report the callee's errors again
+  if (errormsg.anyErrors)
+    return nullptr;
+  if (!INL::Worth(inlinee->info, args, constant_args)
+      || expanding.size() >= INL::depth_limit)
+    return nullptr;
+  int copies = 0;
+  for (E::FunEntry* outer : expanding)
+    copies += outer == fun;
+  if (copies >= INL::recursion_limit)
+    return nullptr;
+  for (auto& name : inlinee->names)
+    if (venv->Look(name.first) != name.second)
+      return nullptr;
+  for (auto& name : inlinee->types)
+    if (tenv->Look(name.first) != name.second)
+      return nullptr;
+  return inlinee;
+}
+
+// the body of fun in place of a call to it, translated in the caller's level
+// the parameters are locals of the caller set to the arguments, and the
+// variables the body takes from outside are reached through the caller's
+// static links, never more of them than the callee itself would follow
+static TR::ExpAndTy expandCall(VEnvType venv, TEnvType tenv, TR::Level* level,
+    E::FunEntry* fun, Inlinee* inlinee, T::ExpList* args)
+{
+  venv->BeginScope();
+  tenv->BeginScope();
+  level->frame->BeginScope();
+  T::Stm* moves = nullptr;
+  TY::FieldList* fields = make_fieldlist(tenv, inlinee->dec->params);
+  A::FieldList* params = inlinee->dec->params;
+  for (; fields; fields = fields->tail, params = params->tail, args = args->tail) {
+    TR::Access* acc = level->AllocateLocal(params->head->escape);
+    venv->Enter(fields->head->name, new E::VarEntry(acc, fields->head->ty));
+    T::Stm* move = new T::MoveStm(acc->toExp()->UnEx(), args->head);
+    moves = moves ? new T::SeqStm(moves, move) : move;
+  }
+  expanding.push_back(fun);
+  TR::ExpAndTy body = inlinee->dec->body->Translate(venv, tenv, level, fun->label);
+  expanding.pop_back();
+  // nothing is expanded once there are errors, so these came from the copy
+  inlinee->errors |= errormsg.anyErrors;
+  level->frame->EndScope();
+  venv->EndScope();
+  tenv->EndScope();
+  inlined++;
+
+  if (fun->result->kind == TY::Ty::Kind::VOID) {
+    T::Stm* stm = body.exp ? body.exp->UnNx() : new T::ExpStm(new T::ConstExp(0));
+    return TR::ExpAndTy(new TR::NxExp(moves ? new T::SeqStm(moves, stm) : stm), fun->result);
+  }
+  T::Exp* exp = body.exp->UnEx();
+  return TR::ExpAndTy(new TR::ExExp(moves ? new T::EseqExp(moves, exp) : exp), fun->result);
+}
+
 } // namespace
 
 namespace TR {
 
+bool check_bounds = false;
+NonlocalAccess nonlocal_access = STATIC_LINKS;
+
 // Expression translations
 
 T::Exp* ExExp::UnEx() const
@@ -65,6 +180,14 @@ T::Stm* ExExp::UnNx() const
 
 TR::Cx ExExp::UnCx() const
 {
+  // a constant test always goes the same way
+  if (this->exp->kind == T::Exp::CONST) {
+    T::JumpStm* jmp = new T::JumpStm(new T::NameExp(nullptr), new TEMP::LabelList(nullptr, nullptr));
+    TR::PatchList* target = new PatchList(&(jmp->exp->name), new PatchList(&(jmp->jumps->head), nullptr));
+    if (((T::ConstExp*)this->exp)->consti)
+      return TR::Cx(target, nullptr, jmp);
+    return TR::Cx(nullptr, target, jmp);
+  }
   T::CjumpStm* jmp = new T::CjumpStm(T::NE_OP, this->exp, new T::ConstExp(0), nullptr, nullptr);
   TR::PatchList* trues = new PatchList(&(jmp->true_label), nullptr);
   TR::PatchList* falses = new PatchList(&(jmp->false_label), nullptr);
@@ -115,11 +238,14 @@ TR::Cx CxExp::UnCx() const
 }
 
 Level* Level::NewLevel(
-    Level* parent, TEMP::Label* name, U::BoolList* formals)
+    Level* parent, TEMP::Label* name, U::BoolList* formals, bool static_link)
 {
   // add static link as first parameter
-  formals = new U::BoolList(true, formals);
+  if (static_link)
+    formals = new U::BoolList(true, formals);
   Level* ret = new Level(F::NewFrame(name, formals), parent);
+  if (static_link)
+    ret->frame->static_link = ret->frame->getFormals()->head;
   return ret;
 }
 
@@ -133,9 +259,10 @@ PatchList* join_patch(PatchList* first, PatchList* second)
 {
   if (!first)
     return second;
-  for (; first->tail; first = first->tail)
+  PatchList* last = first;
+  for (; last->tail; last = last->tail)
     ;
-  first->tail = second;
+  last->tail = second;
   return first;
 }
 
@@ -145,7 +272,8 @@ Level* Outermost()
   if (lv != nullptr)
     return lv;
 
-  lv = Level::NewLevel(nullptr, TEMP::NamedLabel("tigermain"), nullptr);
+  // the runtime passes a link, nothing is outside to use it
+  lv = Level::NewLevel(nullptr, TEMP::NamedLabel("tigermain"), nullptr, false);
   return lv;
 }
 
@@ -155,11 +283,31 @@ TR::Access* Level::AllocateLocal(bool escape, unsigned byte_count)
   return new TR::Access(this, frame->allocSpace(byte_count, escape));
 }
 
+T::Exp* Level::framePointerOf(Level* target)
+{
+  T::Exp* fp = frame->getFramePointerExp();
+  Level* level = this;
+  size_t hops = 0;
+  for (; level != target; level = level->parent, hops++) {
+    // nothing reaches past a lifted function
+    assert(level->frame->static_link);
+    if (nonlocal_access == STATIC_LINKS || hops == 0)
+      fp = level->frame->static_link->toExp(fp);
+  }
+  if (nonlocal_access == STATIC_LINKS || hops < 2)
+    return fp;
+  while (ancestors.size() < hops - 1)
+    ancestors.push_back(TEMP::Temp::NewTemp());
+  return new T::TempExp(ancestors[hops - 2]);
+}
+
 TR::AccessList* Level::getFormals()
 {
   // make TR access out of Frame access
   // escape static link here
-  F::AccessList* frame_access = frame->getFormals()->tail;
+  F::AccessList* frame_access = frame->getFormals();
+  if (frame->static_link)
+    frame_access = frame_access->tail;
   TR::AccessList* prehead = new TR::AccessList(nullptr, nullptr);
   TR::AccessList* tail = prehead;
   while (frame_access) {
@@ -191,9 +339,27 @@ T::Stm* makeRecordArray(T::ExpList* fields, T::Exp* r, int offset, int size)
 
 // wrapper
 // do proc entry exit
-inline void TR::Level::doProcEntryExit(TR::Exp* body_stm)
+inline void TR::Level::doProcEntryExit(TR::Exp* body_stm, bool returns_value)
 {
-  frame->doProcEntryExit1(body_stm->UnEx());
+  // load the frame pointers the body uses, each from the link in the frame
+  // before it
+  T::Exp* body = body_stm->UnEx();
+  T::Exp* fp = frame->getFramePointerExp();
+  Level* level = this;
+  T::Stm* loads = nullptr;
+  if (!ancestors.empty()) {
+    fp = frame->static_link->toExp(fp);
+    level = parent;
+  }
+  for (TEMP::Temp* ancestor : ancestors) {
+    T::Stm* load = new T::MoveStm(new T::TempExp(ancestor), level->frame->static_link->toExp(fp));
+    loads = loads ? new T::SeqStm(loads, load) : load;
+    fp = new T::TempExp(ancestor);
+    level = level->parent;
+  }
+  if (loads)
+    body = new T::EseqExp(loads, body);
+  frame->doProcEntryExit1(body, returns_value);
 }
 
 // wrapper
@@ -209,6 +375,7 @@ F::FragList* TranslateProgram(A::Exp* root)
   assert(root->kind == A::Exp::LET);
   TR::ExpAndTy ret = root->Translate(E::BaseVEnv(), E::BaseTEnv(), Outermost(), nullptr);
   F::FragAllocator::appendFrag(new F::ProcFrag(ret.exp->UnNx(), Outermost()->frame));
+  printf("Inliner: %d calls inlined\n", inlined);
   return F::FragAllocator::getFragListHead();
 }
 
@@ -228,13 +395,7 @@ TR::ExpAndTy SimpleVar::Translate(S::Table<E::EnvEntry>* venv,
     errormsg.Error(this->pos, "%s is not a variable.", this->sym);
   else {
     // type is checked now, go through static link
-    T::Exp* ret = level->frame->getFramePointerExp();
-    while (level != env_entry->access->level) {
-      // static link is the first word in frame
-      ret = new T::MemExp(
-          new T::BinopExp(T::PLUS_OP, ret, new T::ConstExp(-TR::word_size)));
-      level = level->parent;
-    }
+    T::Exp* ret = level->framePointerOf(env_entry->access->level);
     ret = env_entry->access->access->toExp(ret);
     return TR::ExpAndTy(new TR::ExExp(ret), env_entry->ty);
   }
@@ -287,13 +448,52 @@ TR::ExpAndTy SubscriptVar::Translate(S::Table<E::EnvEntry>* venv,
     errormsg.Error(this->pos, "int type required for subscript");
     return TR::ExpAndTy(nullptr, TY::VoidTy::Instance());
   }
+  if (!TR::check_bounds)
+    return TR::ExpAndTy(
+        new TR::ExExp(new T::MemExp(
+            new T::BinopExp(T::PLUS_OP,
+                ret.exp->UnEx(),
+                new T::BinopExp(
+                    T::BinOp::MUL_OP, sub.exp->UnEx(),
+                    new T::ConstExp(TR::word_size))))),
+        static_cast<TY::ArrayTy*>(ret.ty)->ty);
+  // the length is in the word before the elements, compared unsigned so a
+  // negative subscript is out of range too
+  // the runtime reports a subscript out of range & exits, the jump after
+  // the call is never taken
+  TEMP::Temp *base = TEMP::Temp::NewTemp(), *t = nullptr;
+  T::Exp* subscript = sub.exp->UnEx();
+  T::Stm* check = new T::MoveStm(new T::TempExp(base), ret.exp->UnEx());
+  if (subscript->kind != T::Exp::CONST) {
+    t = TEMP::Temp::NewTemp();
+    check = new T::SeqStm(check, new T::MoveStm(new T::TempExp(t), subscript));
+  }
+  auto index = [&]() -> T::Exp* {
+    if (t)
+      return new T::TempExp(t);
+    return new T::ConstExp(((T::ConstExp*)subscript)->consti);
+  };
+  TEMP::Label *bad = TEMP::NewLabel(), *ok = TEMP::NewLabel();
+  check = new T::SeqStm(check,
+      new T::SeqStm(new T::CjumpStm(T::UGE_OP, index(),
+                        new T::MemExp(new T::BinopExp(T::PLUS_OP,
+                            new T::TempExp(base),
+                            new T::ConstExp(-(int)TR::word_size))),
+                        bad, ok),
+          new T::SeqStm(new T::LabelStm(bad),
+              new T::SeqStm(new T::ExpStm(level->frame->externalCall(
+                                "outOfBounds", new T::ExpList(index(), nullptr))),
+                  new T::SeqStm(new T::JumpStm(new T::NameExp(bad),
+                                    new TEMP::LabelList(bad, nullptr)),
+                      new T::LabelStm(ok))))));
   return TR::ExpAndTy(
-      new TR::ExExp(new T::MemExp(
-          new T::BinopExp(T::PLUS_OP,
-              ret.exp->UnEx(),
-              new T::BinopExp(
-                  T::BinOp::MUL_OP, sub.exp->UnEx(),
-                  new T::ConstExp(TR::word_size))))),
+      new TR::ExExp(new T::EseqExp(check,
+          new T::MemExp(
+              new T::BinopExp(T::PLUS_OP,
+                  new T::TempExp(base),
+                  new T::BinopExp(
+                      T::BinOp::MUL_OP, index(),
+                      new T::ConstExp(TR::word_size)))))),
       static_cast<TY::ArrayTy*>(ret.ty)->ty);
 }
 
@@ -360,21 +560,15 @@ TR::ExpAndTy CallExp::Translate(S::Table<E::EnvEntry>* venv,
     T::ExpList* params_tail = params_prehead;
     // find static link first
     // insert static link as first parameter
-    // do not add static link for external functions
-    if (fun->level->parent != nullptr) {
-      T::Exp* static_link = level->frame->getFramePointerExp();
-      TR::Level* static_container = level;
-      while (static_container && static_container != fun->level->parent) {
-        static_link = new T::MemExp(
-            new T::BinopExp(T::PLUS_OP, static_link, new T::ConstExp(-TR::word_size)));
-        static_container = static_container->parent;
-      }
+    // do not add static link for external functions, or lifted ones
+    if (fun->level->frame->static_link) {
+      T::Exp* static_link = level->framePointerOf(fun->level->parent);
       params_tail = params_tail->tail = new T::ExpList(static_link, nullptr);
     }
-    // if static container is nullptr, then reached root
-    // assert(static_container != nullptr);
     // check params, and make ExpList the same time
 
+    T::ExpList* args = params_tail;
+    int arg_count = 0, constant_args = 0;
     while (formals && actuals) {
       // keep parsing formal list even if there's a mismatch
       TR::ExpAndTy now = actuals->head->Translate(venv, tenv, level, label);
@@ -382,6 +576,8 @@ TR::ExpAndTy CallExp::Translate(S::Table<E::EnvEntry>* venv,
         errormsg.Error(actuals->head->pos, "para type mismatch");
       // append to ExpList
       params_tail = params_tail->tail = new T::ExpList(now.exp->UnEx(), nullptr);
+      arg_count++;
+      constant_args += params_tail->head->kind == T::Exp::CONST;
       formals = formals->tail;
       actuals = actuals->tail;
     }
@@ -390,6 +586,9 @@ TR::ExpAndTy CallExp::Translate(S::Table<E::EnvEntry>* venv,
     else if (actuals != nullptr)
       errormsg.Error(this->pos, "too many params in function %s", this->func->Name().c_str());
     // no error up till now
+    Inlinee* inlinee = inlineCandidate(venv, tenv, fun, arg_count, constant_args);
+    if (inlinee)
+      return expandCall(venv, tenv, level, fun, inlinee, args->tail);
     if (fun->level->parent)
       return TR::ExpAndTy(
           new TR::ExExp(new T::CallExp(new T::NameExp(this->func), params_prehead->tail)),
@@ -436,8 +635,20 @@ TR::ExpAndTy OpExp::Translate(S::Table<E::EnvEntry>* venv,
         op = T::DIV_OP;
         break;
       }
-      return TR::ExpAndTy(new TR::ExExp(
-                              new T::BinopExp(op, l.exp->UnEx(), r.exp->UnEx())),
+      T::Exp *le = l.exp->UnEx(), *re = r.exp->UnEx();
+      // fold constants, & drop the operations that leave the other operand
+      // as it is
+      int v;
+      if (le->kind == T::Exp::CONST && re->kind == T::Exp::CONST
+          && T::fold(op, ((T::ConstExp*)le)->consti, ((T::ConstExp*)re)->consti, &v))
+        return TR::ExpAndTy(new TR::ExExp(new T::ConstExp(v)), TY::IntTy::Instance());
+      if (re->kind == T::Exp::CONST
+          && ((T::ConstExp*)re)->consti == (op == T::PLUS_OP || op == T::MINUS_OP ? 0 : 1))
+        return TR::ExpAndTy(new TR::ExExp(le), TY::IntTy::Instance());
+      if (le->kind == T::Exp::CONST && (op == T::PLUS_OP || op == T::MUL_OP)
+          && ((T::ConstExp*)le)->consti == (op == T::PLUS_OP ? 0 : 1))
+        return TR::ExpAndTy(new TR::ExExp(re), TY::IntTy::Instance());
+      return TR::ExpAndTy(new TR::ExExp(new T::BinopExp(op, le, re)),
           TY::IntTy::Instance());
     }
     break;
@@ -479,8 +690,15 @@ TR::ExpAndTy OpExp::Translate(S::Table<E::EnvEntry>* venv,
         T::CallExp *call_exp = level->frame->externalCall(
           "stringEqual", new T::ExpList(l.exp->UnEx(), new T::ExpList(r.exp->UnEx(), nullptr)));
         stm = new T::CjumpStm(op, call_exp, new T::ConstExp(1), nullptr, nullptr);
-      } else
-        stm = new T::CjumpStm(op, l.exp->UnEx(), r.exp->UnEx(), nullptr, nullptr);
+      } else {
+        T::Exp *le = l.exp->UnEx(), *re = r.exp->UnEx();
+        // the outcome is known for constants
+        if (le->kind == T::Exp::CONST && re->kind == T::Exp::CONST)
+          return TR::ExpAndTy(new TR::ExExp(new T::ConstExp(
+              T::test(op, ((T::ConstExp*)le)->consti, ((T::ConstExp*)re)->consti))),
+              TY::IntTy::Instance());
+        stm = new T::CjumpStm(op, le, re, nullptr, nullptr);
+      }
       TR::PatchList* trues = new TR::PatchList(&(stm->true_label), nullptr);
       TR::PatchList* falses = new TR::PatchList(&(stm->false_label), nullptr);
       return TR::ExpAndTy(new TR::CxExp(trues, falses, stm), TY::IntTy::Instance());
@@ -650,6 +868,19 @@ TR::ExpAndTy IfExp::Translate(S::Table<E::EnvEntry>* venv,
       errormsg.Error(this->pos, "then exp and else exp type mismatch");
       return TR::ExpAndTy(nullptr, TY::VoidTy::Instance());
     }
+    // conditions made of conditions, like the & and | the parser turns
+    // into ifs, stay conditions, 0 or 1 is only materialized if needed
+    if (isCondition(then_eat.exp) && isCondition(else_eat.exp)) {
+      TR::Cx then_cx = then_eat.exp->UnCx();
+      TR::Cx else_cx = else_eat.exp->UnCx();
+      T::Stm* s = new T::SeqStm(test_cx.stm,
+          new T::SeqStm(new T::LabelStm(true_label),
+              new T::SeqStm(then_cx.stm,
+                  new T::SeqStm(new T::LabelStm(false_label), else_cx.stm))));
+      return TR::ExpAndTy(new TR::CxExp(TR::join_patch(then_cx.trues, else_cx.trues),
+                              TR::join_patch(then_cx.falses, else_cx.falses), s),
+          then_eat.ty);
+    }
     TEMP::Label* meeting = TEMP::NewLabel();
     T::Exp* exp = new T::EseqExp(test_cx.stm,
         new T::EseqExp(new T::LabelStm(true_label),
@@ -802,6 +1033,7 @@ TR::ExpAndTy LetExp::Translate(S::Table<E::EnvEntry>* venv,
 {
   venv->BeginScope();
   tenv->BeginScope();
+  level->frame->BeginScope();
   T::EseqExp* prehead = new T::EseqExp(nullptr, nullptr);
   T::EseqExp* tail = prehead;
   for (A::DecList* decs = this->decs; decs; decs = decs->tail) {
@@ -813,6 +1045,7 @@ TR::ExpAndTy LetExp::Translate(S::Table<E::EnvEntry>* venv,
   }
   TR::ExpAndTy ret = this->body->Translate(venv, tenv, level, label);
   tail->exp = ret.exp->UnEx();
+  level->frame->EndScope();
   venv->EndScope();
   tenv->EndScope();
   return TR::ExpAndTy(new TR::ExExp(prehead->exp), ret.ty);
@@ -887,17 +1120,28 @@ TR::Exp* FunctionDec::Translate(S::Table<E::EnvEntry>* venv,
     for (A::FieldList* cur = func->params; cur; cur = cur->tail)
       bool_list_tail = bool_list_tail->tail = new U::BoolList(cur->head->escape, nullptr);
     // make new level
-    TR::Level* new_level = TR::Level::NewLevel(level, func->name, bool_list_prehead->tail);
+    TR::Level* new_level = TR::Level::NewLevel(level, func->name, bool_list_prehead->tail,
+        func->static_link);
     // seems unnecessarily, but I'm not sure...
     TEMP::Label* label = TEMP::NamedLabel(func->name->Name());
     // push to the environment
     venv->Enter(func->name, new E::FunEntry(new_level, label, formal_types, result_type));
   }
+  // the functions of the group are in scope, their bodies may be inlined
+  // wherever the names they use still mean the same
+  for (auto funcs = this->functions; funcs; funcs = funcs->tail)
+    makeInlinee(venv, tenv, static_cast<E::FunEntry*>(venv->Look(funcs->head->name)),
+        funcs->head);
 
   // do actual parsing
   for (auto funcs = this->functions; funcs; funcs = funcs->tail) {
     auto func = funcs->head;
     E::FunEntry* fun_entry = static_cast<E::FunEntry*>(venv->Look(func->name));
+    // a sibling's call expanded the body before it got here, and reported
+    // what's wrong with it there
+    auto inlinee = inlinees.find(fun_entry);
+    if (inlinee != inlinees.end() && inlinee->second->errors)
+      continue;
 
     // begin function body parsing
     venv->BeginScope();
@@ -933,7 +1177,8 @@ TR::Exp* FunctionDec::Translate(S::Table<E::EnvEntry>* venv,
         errormsg.Error(this->pos, "function return value doesn't match");
     } else
       // add procedure exit and add to fraglist
-      fun_entry->level->doProcEntryExit(body_eat.exp);
+      fun_entry->level->doProcEntryExit(body_eat.exp,
+          decl_type->kind != TY::Ty::Kind::VOID);
   }
   return nullptr;
 }
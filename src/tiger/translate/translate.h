@@ -1,6 +1,8 @@
 #ifndef TIGER_TRANSLATE_TRANSLATE_H_
 #define TIGER_TRANSLATE_TRANSLATE_H_
 
+#include <vector>
+
 #include "tiger/absyn/absyn.h"
 #include "tiger/frame/frame.h"
 
@@ -32,6 +34,16 @@ class AccessList;
 const unsigned word_size = 8;
 const unsigned int_size = 4;
 
+// whether subscripts are checked against the length of the array, off
+// unless asked for
+extern bool check_bounds;
+
+// how a function reaches the frames of the functions around it, following
+// the static links on every access unless told otherwise, or with the frame
+// pointers it needs loaded into temps once on entry
+enum NonlocalAccess { STATIC_LINKS, CACHED_LINKS };
+extern NonlocalAccess nonlocal_access;
+
 // translate program - main() for phase 1
 F::FragList* TranslateProgram(A::Exp *);
 
@@ -39,15 +51,24 @@ class Level {
  public:
   F::Frame *frame;
   Level *parent;
+  // temps caching the frame pointers of the levels around, the
+  // grandparent's first, as far out as the body goes
+  // the parent's is a load from our own frame anyway
+  std::vector<TEMP::Temp *> ancestors;
 
   Level(F::Frame *frame, Level *parent) : frame(frame), parent(parent) {}
   AccessList *getFormals();
+  // the frame pointer of target, this level or one around it, as the body
+  // sees it
+  T::Exp *framePointerOf(Level *target);
 
+  // a level without a static link is a function lifted to the top, nothing
+  // may reach past its frame
   static Level *NewLevel(Level *parent, TEMP::Label *name,
-                         U::BoolList *formals);
+                         U::BoolList *formals, bool static_link=true);
   
   TR::Access *AllocateLocal(bool escape, unsigned byte_count=word_size);
-  void doProcEntryExit(TR::Exp *func_body);
+  void doProcEntryExit(TR::Exp *func_body, bool returns_value);
 };
 
 Level* Outermost();
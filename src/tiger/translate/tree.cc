@@ -1,6 +1,7 @@
 #include "tiger/translate/tree.h"
 
 #include <cassert>
+#include <climits>
 
 namespace {
 
@@ -112,7 +113,7 @@ void ConstExp::Print(FILE *out, int d) const {
 void CallExp::Print(FILE *out, int d) const {
   ExpList *args = this->args;
   indent(out, d);
-  fprintf(out, "CALL(\n");
+  fprintf(out, this->tail ? "TAILCALL(\n" : "CALL(\n");
   this->fun->Print(out, d + 1);
   for (; args; args = args->tail) {
     fprintf(out, ",\n");
@@ -181,4 +182,79 @@ RelOp commute(RelOp r) {
   }
 }
 
+bool fold(BinOp op, int a, int b, int* result) {
+  long long l = a, r = b, v;
+  switch (op) {
+    case PLUS_OP:
+      v = l + r;
+      break;
+    case MINUS_OP:
+      v = l - r;
+      break;
+    case MUL_OP:
+      v = l * r;
+      break;
+    case DIV_OP:
+      // idivq traps on a zero divisor, keep it that way
+      if (r == 0) return false;
+      v = l / r;
+      break;
+    case AND_OP:
+      v = l & r;
+      break;
+    case OR_OP:
+      v = l | r;
+      break;
+    case XOR_OP:
+      v = l ^ r;
+      break;
+    case LSHIFT_OP:
+      if (r < 0 || r >= 32) return false;
+      v = l * (1LL << r);
+      break;
+    case RSHIFT_OP:
+      if (r < 0 || r >= 64) return false;
+      v = (long long)((unsigned long long)l >> r);
+      break;
+    case ARSHIFT_OP:
+      if (r < 0 || r >= 64) return false;
+      v = l >> r;
+      break;
+    default:
+      return false;
+  }
+  if (v < INT_MIN || v > INT_MAX) return false;
+  *result = (int)v;
+  return true;
+}
+
+bool test(RelOp op, int a, int b) {
+  long long l = a, r = b;
+  unsigned long long ul = l, ur = r;
+  switch (op) {
+    case EQ_OP:
+      return l == r;
+    case NE_OP:
+      return l != r;
+    case LT_OP:
+      return l < r;
+    case GT_OP:
+      return l > r;
+    case LE_OP:
+      return l <= r;
+    case GE_OP:
+      return l >= r;
+    case ULT_OP:
+      return ul < ur;
+    case ULE_OP:
+      return ul <= ur;
+    case UGT_OP:
+      return ul > ur;
+    case UGE_OP:
+      return ul >= ur;
+    default:
+      assert(false);
+  }
+}
+
 }  // namespace T
@@ -235,8 +235,12 @@ class CallExp : public Exp {
  public:
   Exp* fun;
   ExpList* args;
+  // in tail position, the caller's frame is gone & the callee returns to
+  // the caller's caller, set by SSA::EliminateTailCalls
+  bool tail;
 
-  CallExp(Exp* fun, ExpList* args) : Exp(CALL), fun(fun), args(args) {}
+  CallExp(Exp* fun, ExpList* args)
+      : Exp(CALL), fun(fun), args(args), tail(false) {}
   void Print(FILE* out, int d) const override;
 
   /*Lab6 only*/
@@ -263,6 +267,11 @@ class StmList {
 RelOp notRel(RelOp);  /* a op b    ==     not(a notRel(op) b)  */
 RelOp commute(RelOp); /* a op b    ==    b commute(op) a       */
 
+/* the value of a op b on the 64-bit machine words, false if it doesn't fit
+ * in a ConstExp or is left to trap at run time, like a division by zero */
+bool fold(BinOp op, int a, int b, int* result);
+bool test(RelOp op, int a, int b); /* a op b on the machine words */
+
 }  // namespace T
 
 #endif  // TIGER_TRANSLATE_TREE_H_